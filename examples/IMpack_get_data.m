@@ -1,14 +1,20 @@
-function [ta_LSM, a_LSM, tg_LSM, g_LSM, ta_IIS, a_IIS, ta_ADX, a_ADX] = IMpack_get_data(file, a_LSM_range, g_LSM_range, a_IIS_range, a_ADX_range)
+function [ta_LSM, a_LSM, tg_LSM, g_LSM, ta_IIS, a_IIS, ta_ADX, a_ADX, info] = IMpack_get_data(file, a_LSM_range, g_LSM_range, a_IIS_range, a_ADX_range)
 
 % opens a binary *.dat file generated by the IMpack and returns arrays of
 % time and acceleration/angular rate for each of the sensors on the device
 
-% the time arrays have units of seconds, the acceleration is in g, and the
-% angular rate is in degrees per second.
+% the time arrays have units of seconds from the trigger (negative in a
+% pre-trigger window), the acceleration is in g, and the angular rate is in
+% degrees per second. Multi-shot recordings hold several triggered events
+% one after the other, timed from the first trigger, and info.events lists
+% where each one is.
 
-% the range arguments should be the measurement ranges that each chip was
-% set to while generating the data file. For instance, if the IIS3DWB chip
-% was set to a range of +/- 16 g, then a_IIS_range = 16.
+% recordings start with a header that describes each channel and holds
+% the settings, which are returned in info. The range arguments are only
+% needed for older recordings without a header, and should be the
+% measurement ranges that each chip was set to while generating the data
+% file. For instance, if the IIS3DWB chip was set to a range of +/- 16 g,
+% then a_IIS_range = 16.
 
 % ids for which sensor the data point came from
 type_LSM6DSx_accel = 0x1000;
@@ -21,15 +27,63 @@ type_ADXL37x = 0x0010;
 bytes_per_data_point = 12;
 
 
-num_data_points = dir(file).bytes / bytes_per_data_point;
+% read the data file along with any further segments
+[folder, name] = fileparts(file);
+bytes = read_segments(file);
+
+% channel scales (units per count) and byte order, from the header if
+% there is one
+types = [type_LSM6DSx_accel, type_LSM6DSx_gyro, type_IIS3DWB, type_ADXL37x];
+if numel(bytes) >= 32 && isequal(char(bytes(1:4))', 'IMPK')
+    info = parse_header(bytes);
+    bytes = bytes(info.header_size + 1:end);
+    scale = zeros(1, 4);
+    big_endian = false(1, 4);
+    for k = 1:4
+        channel = info.channels([info.channels.data_type] == types(k));
+        if ~isempty(channel)
+            scale(k) = channel(1).scale;
+            big_endian(k) = channel(1).big_endian;
+        end
+    end
+    if info.separate_channel_files
+        % the data file only holds the header, each channel is in a file
+        % named after it with the same recording number (LSMA12.BIN)
+        number = regexp(name, '\d+$', 'match', 'once');
+        t = cell(1, 4);
+        d = cell(1, 4);
+        for k = 1:4
+            channel = info.channels([info.channels.data_type] == types(k));
+            [t{k}, d{k}] = deal(zeros(0, 1), zeros(0, 3));
+            if ~isempty(channel) && channel(1).enabled
+                [t{k}, d{k}] = read_channel_file(fullfile(folder, [channel(1).name, number, '.BIN']));
+            end
+        end
+        ta_LSM = (t{1} - info.trigger_micros) * 1e-6;
+        tg_LSM = (t{2} - info.trigger_micros) * 1e-6;
+        ta_IIS = (t{3} - info.trigger_micros) * 1e-6;
+        ta_ADX = (t{4} - info.trigger_micros) * 1e-6;
+        a_LSM = convert(d{1}, scale(1), big_endian(1));
+        g_LSM = convert(d{2}, scale(2), big_endian(2));
+        a_IIS = convert(d{3}, scale(3), big_endian(3));
+        a_ADX = convert(d{4}, scale(4), big_endian(4));
+        return;
+    end
+else
+    if nargin < 5
+        error('%s has no header, pass the sensor ranges it was recorded with', file);
+    end
+    info = struct('trigger_micros', 0);
+    scale = [a_LSM_range, g_LSM_range, a_IIS_range, a_ADX_range] / 2^15;
+    big_endian = [false, false, false, true];
+end
+
+num_data_points = floor(numel(bytes) / bytes_per_data_point);
+bytes = reshape(bytes(1:num_data_points * bytes_per_data_point), bytes_per_data_point, num_data_points);
 
-fileID = fopen(file, 'r');
-time = fread(fileID, num_data_points, 'uint32', 8);
-fseek(fileID, 4, "bof");
-data = fread(fileID, [3, num_data_points], '3*int16', 6)';
-fseek(fileID, 10, "bof");
-type = fread(fileID, num_data_points, 'uint16', 10);
-fclose(fileID);
+time = double(typecast(reshape(bytes(1:4, :), [], 1), 'uint32'));
+data = double(reshape(typecast(reshape(bytes(5:10, :), [], 1), 'int16'), 3, num_data_points)');
+type = double(typecast(reshape(bytes(11:12, :), [], 1), 'uint16'));
 
 ind = find(type == type_LSM6DSx_accel);
 ta_LSM_raw = time(ind);
@@ -45,20 +99,124 @@ a_IIS_raw = data(ind, :);
 
 ind = find(type == type_ADXL37x);
 ta_ADX_raw = time(ind);
-a_ADX_raw = int16(data(ind, :));
+a_ADX_raw = data(ind, :);
 
 
 % convert the binary data
-ta_LSM = ta_LSM_raw * 1e-6;
-tg_LSM = tg_LSM_raw * 1e-6;
-ta_IIS = ta_IIS_raw * 1e-6;
-ta_ADX = ta_ADX_raw * 1e-6;
+ta_LSM = (ta_LSM_raw - info.trigger_micros) * 1e-6;
+tg_LSM = (tg_LSM_raw - info.trigger_micros) * 1e-6;
+ta_IIS = (ta_IIS_raw - info.trigger_micros) * 1e-6;
+ta_ADX = (ta_ADX_raw - info.trigger_micros) * 1e-6;
+
+a_LSM = convert(a_LSM_raw, scale(1), big_endian(1));
+g_LSM = convert(g_LSM_raw, scale(2), big_endian(2));
+a_IIS = convert(a_IIS_raw, scale(3), big_endian(3));
+a_ADX = convert(a_ADX_raw, scale(4), big_endian(4));
+
+
+end
+
 
-a_LSM = a_LSM_raw / 2^15 * a_LSM_range;
-g_LSM = g_LSM_raw / 2^15 * g_LSM_range;
-a_IIS = a_IIS_raw / 2^15 * a_IIS_range;
-a_ADX = double(bitshift(swapbytes(a_ADX_raw), -4)) / 2^11 * a_ADX_range;
+function bytes = read_segments(file)
+
+% long recordings are split into segments DATAn.DAT, DATAn.D01, DATAn.D02
+% and so on, which are read back to back
+[folder, name, ext] = fileparts(file);
+bytes = zeros(0, 1, 'uint8');
+segment = 0;
+while isfile(file)
+    fileID = fopen(file, 'r');
+    bytes = [bytes; fread(fileID, Inf, 'uint8=>uint8')];
+    fclose(fileID);
+    segment = segment + 1;
+    file = fullfile(folder, sprintf('%s%s%02d', name, ext(1:2), segment));
+end
+
+end
+
+
+function [time, data] = read_channel_file(file)
+
+% channel files hold uint32 timestamp and 3x int16 data values per point.
+% They are preallocated, so after a power loss they can end in old data
+% from the card, which is cut off where the time stamps stop increasing
+bytes = read_segments(file);
+num_data_points = floor(numel(bytes) / 10);
+bytes = reshape(bytes(1:num_data_points * 10), 10, num_data_points);
+time = double(typecast(reshape(bytes(1:4, :), [], 1), 'uint32'));
+data = double(reshape(typecast(reshape(bytes(5:10, :), [], 1), 'int16'), 3, num_data_points)');
+last = find(diff(time) <= 0, 1);
+if ~isempty(last)
+    time = time(1:last);
+    data = data(1:last, :);
+end
+
+end
+
+
+function values = convert(raw, scale, big_endian)
+
+% the ADXL373 stores its values with opposite endianness
+if big_endian
+    raw = double(swapbytes(int16(raw)));
+end
+values = raw * scale;
+
+end
+
+
+function info = parse_header(bytes)
+
+% all header fields are little endian
+u16 = @(offset) double(typecast(bytes(offset + 1:offset + 2), 'uint16'));
+u32 = @(offset) double(typecast(bytes(offset + 1:offset + 4), 'uint32'));
+f32 = @(offset) double(typecast(bytes(offset + 1:offset + 4), 'single'));
+str = @(offset, len) strtok(char(bytes(offset + 1:offset + len))', char(0));
+
+info.version = u16(4);
+info.header_size = u16(6);
+info.firmware_version = str(8, 16);
+info.data_point_size = u16(24);
+channel_count = double(bytes(27));
+info.separate_channel_files = bitand(double(bytes(28)), 1) ~= 0;
+settings_offset = u16(28);
+settings_len = u16(30);
+
+% time stamp of the trigger, and the index of the data point that crossed
+% the threshold (from 0)
+info.trigger_micros = u32(160);
+info.trigger_sample = u32(164);
+
+% event table of multi-shot recordings right after the 2048 byte header,
+% with the first data point (from 0), number of data points, trigger time
+% stamp and trigger data point of each event. The event times are returned
+% in seconds from the first trigger, the same as the time arrays
+info.events = struct('first_point', {}, 'point_count', {}, 'trigger_time', {}, 'trigger_point', {});
+event_count = min(u32(168), u32(172));
+for k = 1:event_count
+    offset = 2048 + 16 * (k - 1);
+    info.events(k).first_point = u32(offset);
+    info.events(k).point_count = u32(offset + 4);
+    info.events(k).trigger_time = (u32(offset + 8) - info.trigger_micros) * 1e-6;
+    info.events(k).trigger_point = u32(offset + 12);
+end
+
+info.channels = struct('data_type', {}, 'enabled', {}, 'big_endian', {}, 'resolution', {}, 'full_scale', {}, 'scale', {}, 'odr_hz', {}, 'name', {}, 'unit', {});
+for k = 1:channel_count
+    offset = 32 + 32 * (k - 1);
+    flags = double(bytes(offset + 3));
+    info.channels(k).data_type = u16(offset);
+    info.channels(k).enabled = bitand(flags, 1) ~= 0;
+    info.channels(k).big_endian = bitand(flags, 2) ~= 0;
+    info.channels(k).resolution = double(bytes(offset + 4));
+    info.channels(k).full_scale = u32(offset + 4);
+    info.channels(k).scale = f32(offset + 8);
+    info.channels(k).odr_hz = f32(offset + 12);
+    info.channels(k).name = str(offset + 16, 8);
+    info.channels(k).unit = str(offset + 24, 8);
+end
 
+info.settings = char(bytes(settings_offset + 1:settings_offset + settings_len))';
 
 end
 
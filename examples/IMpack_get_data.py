@@ -1,60 +1,161 @@
+import io
+import os
+import re
 import struct
 from collections import defaultdict
 import matplotlib.pyplot as plt
 
-def IMpack_get_data(file_name, range_LSM_accel, range_LSM_gyro, range_IIS, range_ADX):
 
-    ID_LSM_ACCEL = 0x1000
-    ID_LSM_GYRO = 0x0020
-    ID_IIS = 0x8000
-    ID_ADX = 0x0010
-
-    with open(file_name, 'rb') as file:
+def IMpack_read_segments(file_name):
+    # long recordings are split into segments DATAn.DAT, DATAn.D01, DATAn.D02 and so on which are read back to back
+    root, ext = os.path.splitext(file_name)
+    data = b''
+    segment = 0
+    while os.path.exists(file_name):
+        with open(file_name, 'rb') as file:
+            data += file.read()
+        segment += 1
+        file_name = "%s%s%02d" % (root, ext[0:2], segment)
+    return data
+
+
+HEADER_MAGIC = b'IMPK'
+HEADER_SIZE = 2048
+SEPARATE_CHANNEL_FILES = 0x01
+CHANNEL_ENABLED = 0x01
+CHANNEL_BIG_ENDIAN = 0x02
+
+
+def IMpack_read_header(data):
+    # recordings start with a header describing the channels and settings, returns None for older recordings without one
+    if data[0:4] != HEADER_MAGIC:
+        return None
+    version, header_size = struct.unpack_from('<HH', data, 4)
+    firmware_version = data[8:24].split(b'\x00')[0].decode('ascii')
+    data_point_size, channel_count, flags, settings_offset, settings_len = struct.unpack_from('<HBBHH', data, 24)
+
+    channels = []
+    for i in range(channel_count):
+        data_type, flags, resolution, full_scale, scale, odr_hz, name, unit = struct.unpack_from('<HBBLff8s8s', data, 32 + 32 * i)
+        channels.append({"data_type": data_type, "enabled": bool(flags & CHANNEL_ENABLED), "big_endian": bool(flags & CHANNEL_BIG_ENDIAN),
+                         "resolution": resolution, "full_scale": full_scale, "scale": scale, "odr_hz": odr_hz,
+                         "name": name.split(b'\x00')[0].decode('ascii'), "unit": unit.split(b'\x00')[0].decode('ascii')})
+
+    # time stamp of the trigger, the end of the pre-trigger window, and the index of the data point that crossed the threshold
+    trigger_micros, trigger_sample = struct.unpack_from('<LL', data, 32 + 32 * 4)
+
+    # event table of multi-shot recordings, right after the header. Each event is [first data point, number of data points,
+    # time stamp of the trigger, data point that set off the trigger]
+    events = []
+    event_count, event_capacity = struct.unpack_from('<LL', data, 40 + 32 * 4)
+    for i in range(min(event_count, event_capacity)):
+        first_point, point_count, event_trigger_micros, trigger_point = struct.unpack_from('<LLLL', data, HEADER_SIZE + 16 * i)
+        events.append({"first_point": first_point, "point_count": point_count, "trigger_micros": event_trigger_micros,
+                       "trigger_point": trigger_point})
+
+    settings = {}
+    for line in data[settings_offset:settings_offset + settings_len].decode('ascii', 'replace').splitlines():
+        key, sep, value = line.partition('=')
+        if sep:
+            settings[key.strip()] = int(value)
+
+    return {"version": version, "header_size": header_size, "firmware_version": firmware_version, "data_point_size": data_point_size,
+            "separate_channel_files": bool(flags & SEPARATE_CHANNEL_FILES), "channels": channels, "trigger_micros": trigger_micros,
+            "trigger_sample": trigger_sample, "events": events, "settings": settings}
+
+
+def IMpack_read_channel_file(file_name):
+    # in the channel files mode each channel is in its own file (LSMA12.BIN and so on) as [time, x, y, z] records. The
+    # files are preallocated, so after a power loss they can end in old data from the card, which is cut off where the
+    # time stamps stop increasing
+    data = IMpack_read_segments(file_name)
+    points = []
+    for item in struct.iter_unpack('<Lhhh', data[:len(data) - len(data) % 10]):
+        if points and item[0] <= points[-1][0]:
+            break
+        points.append(list(item))
+    return points
+
+
+def IMpack_scale_points(points, channel, trigger_micros=0):
+    # convert the time to seconds from the trigger and the binary values to g or degree/s with the channel's scale
+    for point in points:
+        point[0] = (point[0] - trigger_micros) * 1e-6
+        for axis in range(1, 4):
+            if channel["big_endian"]:
+                # the ADXL373 stores its values with opposite endianness
+                point[axis] = struct.unpack('>h', struct.pack('<h', point[axis]))[0]
+            point[axis] *= channel["scale"]
+    return points
+
+
+def IMpack_get_data(file_name, range_LSM_accel=None, range_LSM_gyro=None, range_IIS=None, range_ADX=None):
+    # returns the data of each channel as lists of [time (s), x, y, z] in the order LSM6DSx accelerometer, LSM6DSx
+    # gyroscope, IIS3DWB, ADXL37x. The ranges are only needed for older recordings that don't start with a header. Times
+    # are relative to the trigger, so data from a pre-trigger window has negative times
+
+    data = IMpack_read_segments(file_name)
+    header = IMpack_read_header(data)
+
+    if header is None:
+        # older recording, the channel layout is fixed and the ranges have to be given
+        if None in (range_LSM_accel, range_LSM_gyro, range_IIS, range_ADX):
+            raise ValueError("%s has no header, pass the sensor ranges it was recorded with" % file_name)
+        channels = [{"data_type": 0x1000, "big_endian": False, "scale": range_LSM_accel / 2**15},
+                    {"data_type": 0x0020, "big_endian": False, "scale": range_LSM_gyro / 2**15},
+                    {"data_type": 0x8000, "big_endian": False, "scale": range_IIS / 2**15},
+                    {"data_type": 0x0010, "big_endian": True, "scale": range_ADX / 2**15}]
+        data_start = 0
+        trigger_micros = 0
+    elif header["separate_channel_files"]:
+        # the data file only holds the header, the channels are in files named after them with the same recording number
+        folder, base = os.path.split(file_name)
+        number = re.search(r'(\d+)\.', base).group(1)
+        result = []
+        for channel in header["channels"]:
+            channel_file = os.path.join(folder, channel["name"] + number + ".BIN")
+            points = IMpack_read_channel_file(channel_file) if channel["enabled"] and os.path.exists(channel_file) else []
+            result.append(IMpack_scale_points(points, channel, header["trigger_micros"]))
+        return result
+    else:
+        channels = header["channels"]
+        data_start = header["header_size"]
+        trigger_micros = header["trigger_micros"]
+
+    with io.BytesIO(data[data_start:]) as file:
         data = list(struct.iter_unpack('<LhhhH', file.read()))
         grouped_data = defaultdict(list)
         for item in data:
             grouped_data[item[4]].append(list(item[0:4]))
 
-        # split data by channel
-        data_LSM_accel = grouped_data[ID_LSM_ACCEL]
-        data_LSM_gyro = grouped_data[ID_LSM_GYRO]
-        data_IIS = grouped_data[ID_IIS]
-        data_ADX = grouped_data[ID_ADX]
-
-        # convert the binary acceleration to g or degree/s
-        for i in range(len(data_LSM_accel)):
-            data_LSM_accel[i][0] *= 1e-6  # convert to seconds
-            data_LSM_accel[i][1] *= range_LSM_accel / 2**15  # convert to g
-            data_LSM_accel[i][2] *= range_LSM_accel / 2**15
-            data_LSM_accel[i][3] *= range_LSM_accel / 2**15
-
-        for i in range(len(data_LSM_gyro)):
-            data_LSM_gyro[i][0] *= 1e-6  # convert to seconds
-            data_LSM_gyro[i][1] *= range_LSM_gyro / 2**15  # convert to degree/s
-            data_LSM_gyro[i][2] *= range_LSM_gyro / 2**15
-            data_LSM_gyro[i][3] *= range_LSM_gyro / 2**15
-
-        for i in range(len(data_IIS)):
-            data_IIS[i][0] *= 1e-6  # convert to seconds
-            data_IIS[i][1] *= range_IIS / 2**15  # convert to g
-            data_IIS[i][2] *= range_IIS / 2**15
-            data_IIS[i][3] *= range_IIS / 2**15
+        # split data by channel and scale it
+        return [IMpack_scale_points(grouped_data[channel["data_type"]], channel, trigger_micros) for channel in channels]
 
-        # the ADXL373 is more complicated to convert because it is a 12 bit sensor with opposite endianness
-        for i in range(len(data_ADX)):
-            data_ADX[i][0] *= 1e-6  # convert to seconds
-            data_ADX[i][1] = struct.unpack('>h', struct.pack('<h', data_ADX[i][1]))[0] * range_ADX / 2**15  # convert to g
-            data_ADX[i][2] = struct.unpack('>h', struct.pack('<h', data_ADX[i][2]))[0] * range_ADX / 2**15
-            data_ADX[i][3] = struct.unpack('>h', struct.pack('<h', data_ADX[i][3]))[0] * range_ADX / 2**15
 
+def IMpack_get_events(file_name):
+    # returns the events of a multi-shot recording as lists of [trigger time (s), start time (s), end time (s)] on the same
+    # time base as IMpack_get_data, so relative to the first trigger. Recordings without an event table give an empty list
+    data = IMpack_read_segments(file_name)
+    header = IMpack_read_header(data)
+    if header is None:
+        return []
 
-        return [data_LSM_accel, data_LSM_gyro, data_IIS, data_ADX]
+    events = []
+    for event in header["events"]:
+        first = header["header_size"] + event["first_point"] * header["data_point_size"]
+        last = first + (event["point_count"] - 1) * header["data_point_size"]
+        start_micros, = struct.unpack_from('<L', data, first)
+        end_micros, = struct.unpack_from('<L', data, last)
+        events.append([(event["trigger_micros"] - header["trigger_micros"]) * 1e-6, (start_micros - header["trigger_micros"]) * 1e-6,
+                       (end_micros - header["trigger_micros"]) * 1e-6])
+    return events
 
 
 if __name__ == "__main__":
 
-    # call the parsing function with the appropriate file path and sensor ranges (depending how they are configured)
-    [data_LSM_accel, data_LSM_gyro, data_IIS, data_ADX] = IMpack_get_data("4mps_sphere_1.dat", 32, 2000, 16, 400)
+    # call the parsing function with the data file, older recordings without a header also need the sensor ranges
+    # (depending how they were configured), e.g. IMpack_get_data("4mps_sphere_1.dat", 32, 2000, 16, 400)
+    [data_LSM_accel, data_LSM_gyro, data_IIS, data_ADX] = IMpack_get_data("DATA1.DAT")
     fig, ax = plt.subplots(2, 2)
 
     # LSM6DSx accelerometer
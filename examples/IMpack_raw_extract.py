@@ -0,0 +1,90 @@
+import argparse
+import os
+import struct
+from IMpack_recover import FAT32Volume, SECTOR_SIZE
+
+# list and extract recordings made in the raw logging mode (raw_logging_enabled = 1) from an image of the SD card or
+# the card's block device, for example:
+#   sudo python IMpack_raw_extract.py /dev/sdX list
+#   sudo python IMpack_raw_extract.py /dev/sdX extract -o recordings
+# the extracted recordings are written in the same binary format as the DATA files
+
+RAW_LOG_FILE = "RAWLOG.BIN"
+SUPERBLOCK_MAGIC = b'IMPKRAW\x00'
+HEADER_MAGIC = b'IMPKREC\x00'
+HEADER_SECTORS = 2
+RECORDING_HEADER_MAGIC = b'IMPK'  # the data of each recording starts with the same header as a data file
+
+
+def read_sectors(file, sector, count):
+    file.seek(sector * SECTOR_SIZE)
+    return file.read(count * SECTOR_SIZE)
+
+
+def find_region(file):
+    # the raw region is a contiguous file on the card so its first sector can be found from the directory
+    volume = FAT32Volume(file)
+    for name, first_cluster, size in volume.root_entries():
+        if name == RAW_LOG_FILE:
+            return volume.data_start + (first_cluster - 2) * volume.sectors_per_cluster
+    raise ValueError("no %s on the card" % RAW_LOG_FILE)
+
+
+def read_recordings(file, region_start):
+    superblock = read_sectors(file, region_start, 1)
+    if superblock[0:8] != SUPERBLOCK_MAGIC:
+        raise ValueError("no raw region superblock at sector %d" % region_start)
+    _, stored_start, region_sectors, next_sector, recording_count = struct.unpack_from('<5L', superblock, 8)
+
+    # the recordings are stored back to back, each a header followed by its data
+    recordings = []
+    sector = 1
+    while sector < next_sector and len(recordings) < recording_count:
+        header = read_sectors(file, region_start + sector, HEADER_SECTORS)
+        if header[0:8] != HEADER_MAGIC:
+            break
+        _, number, start_sector, length, data_point_size, description_len = struct.unpack_from('<4L2H', header, 8)
+        description = header[28:28 + description_len].decode('ascii', 'replace')
+        recordings.append((number, start_sector, length, data_point_size, description))
+        sector = start_sector + -(-length // SECTOR_SIZE)
+    return recordings
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="List and extract IMpack raw mode recordings")
+    parser.add_argument("device", help="card image or block device")
+    parser.add_argument("command", choices=["list", "extract"])
+    parser.add_argument("-n", "--number", type=int, action="append", help="recording number to extract (default all)")
+    parser.add_argument("-o", "--output", default=".", help="directory for the extracted data files")
+    parser.add_argument("--sector", type=int, help="start sector of the raw region, if not found from the file system")
+    args = parser.parse_args()
+
+    with open(args.device, 'rb') as file:
+        region_start = args.sector if args.sector is not None else find_region(file)
+        recordings = read_recordings(file, region_start)
+
+        if args.command == "list":
+            for number, start_sector, length, data_point_size, description in recordings:
+                data = read_sectors(file, region_start + start_sector, 1)
+                header_size = struct.unpack_from('<H', data, 6)[0] if data[0:4] == RECORDING_HEADER_MAGIC else 0
+                print("recording %d: %d bytes (%d data points) at sector %d" % (number, length, max(length - header_size, 0) // data_point_size, region_start + start_sector))
+
+        else:
+            os.makedirs(args.output, exist_ok=True)
+            for number, start_sector, length, data_point_size, description in recordings:
+                if args.number and number not in args.number:
+                    continue
+                name = os.path.join(args.output, "RAW%d" % number)
+                with open(name + ".DAT", 'wb') as output:
+                    file.seek((region_start + start_sector) * SECTOR_SIZE)
+                    remaining = length
+                    while remaining > 0:
+                        data = file.read(min(remaining, 1 << 20))
+                        if not data:
+                            break
+                        output.write(data)
+                        remaining -= len(data)
+                with open(name + "_settings.txt", 'w') as output:
+                    output.write(description)
+                print("extracted recording %d to %s.DAT" % (number, name))
@@ -0,0 +1,164 @@
+import argparse
+import os
+import re
+import struct
+
+# recover IMpack recordings that were never closed (e.g. the battery died or the power switch was flipped while
+# recording) from an image of the SD card or the card's block device, for example:
+#   sudo dd if=/dev/sdX of=card.img bs=4M
+#   python IMpack_recover.py card.img -o recovered
+
+SECTOR_SIZE = 512
+BYTES_PER_DATA_POINT = 12
+DATA_POINT_IDS = (0x1000, 0x0020, 0x8000, 0x0010)  # data type tags of the 4 channels in recordings without a header
+HEADER_MAGIC = b'IMPK'
+MAX_TIME_STEP_US = 10000000  # consecutive data points more than this far apart are treated as stale data
+
+
+class FAT32Volume:
+
+    def __init__(self, file):
+        self.file = file
+
+        # the image may be the whole card (starting with a partition table) or just the volume
+        sector = self.read_sectors(0, 1)
+        if sector[510:512] != b'\x55\xaa':
+            raise ValueError("no boot sector found")
+        if sector[82:90] == b'FAT32   ':
+            self.volume_start = 0
+        else:
+            self.volume_start = struct.unpack_from('<L', sector, 446 + 8)[0]  # start of the first partition
+            sector = self.read_sectors(self.volume_start, 1)
+            if sector[82:90] != b'FAT32   ':
+                raise ValueError("first partition is not FAT32")
+
+        # BIOS parameter block
+        bytes_per_sector, self.sectors_per_cluster, reserved_sectors, num_fats = struct.unpack_from('<HBHB', sector, 11)
+        if bytes_per_sector != SECTOR_SIZE:
+            raise ValueError("unsupported sector size")
+        total_sectors = struct.unpack_from('<L', sector, 32)[0]
+        fat_size, _, _, self.root_cluster = struct.unpack_from('<LHHL', sector, 36)
+
+        self.fat_start = self.volume_start + reserved_sectors
+        self.data_start = self.fat_start + num_fats * fat_size
+        self.cluster_size = self.sectors_per_cluster * SECTOR_SIZE
+        self.num_clusters = (total_sectors - (self.data_start - self.volume_start)) // self.sectors_per_cluster
+
+        # keep the whole first FAT in memory, it is at most a few MB
+        fat = self.read_sectors(self.fat_start, fat_size)
+        self.fat = [entry & 0x0FFFFFFF for entry in struct.unpack_from('<%dL' % (self.num_clusters + 2), fat)]
+
+    def read_sectors(self, sector, count):
+        self.file.seek(sector * SECTOR_SIZE)
+        return self.file.read(count * SECTOR_SIZE)
+
+    def read_cluster(self, cluster):
+        return self.read_sectors(self.data_start + (cluster - 2) * self.sectors_per_cluster, self.sectors_per_cluster)
+
+    def chain(self, cluster):
+        # follow the cluster chain in the FAT
+        clusters = []
+        while 2 <= cluster < self.num_clusters + 2 and len(clusters) < self.num_clusters:
+            clusters.append(cluster)
+            cluster = self.fat[cluster]
+            if cluster >= 0x0FFFFFF7:
+                break
+        return clusters
+
+    def root_entries(self):
+        # short file name entries in the root directory as (name, first cluster, size)
+        for cluster in self.chain(self.root_cluster):
+            data = self.read_cluster(cluster)
+            for offset in range(0, len(data), 32):
+                entry = data[offset:offset + 32]
+                if entry[0] == 0x00:
+                    return
+                if entry[0] == 0xE5 or entry[11] == 0x0F or entry[11] & 0x18:
+                    continue  # deleted entry, long file name entry, volume label or directory
+                name = entry[0:8].decode('ascii', 'replace').rstrip()
+                ext = entry[8:11].decode('ascii', 'replace').rstrip()
+                cluster_hi, = struct.unpack_from('<H', entry, 20)
+                cluster_lo, size = struct.unpack_from('<HL', entry, 26)
+                yield (name + '.' + ext if ext else name, (cluster_hi << 16) | cluster_lo, size)
+
+
+def file_clusters(volume, first_cluster):
+    # clusters of the file along its chain in the FAT, followed by the free clusters directly after it. Clusters
+    # allocated after the last commit may not be in the FAT on the card yet, but the logger writes sequentially so
+    # they usually follow on from the end of the chain
+    clusters = volume.chain(first_cluster)
+    for cluster in clusters:
+        yield cluster
+    cluster = clusters[-1] + 1
+    while cluster < volume.num_clusters + 2 and volume.fat[cluster] == 0:
+        yield cluster
+        cluster += 1
+
+
+def recovered_length(volume, first_cluster, committed_size):
+    # the committed part of the file is trusted, after that keep going while the data points look like a
+    # continuation of the recording (known channel tag and time stamps moving forward)
+    length = 0
+    data_point_ids = DATA_POINT_IDS
+    first = volume.read_cluster(first_cluster)
+    if first[0:4] == HEADER_MAGIC:
+        # the first segment of a recording starts with a header, which also lists the channel tags
+        length, = struct.unpack_from('<H', first, 6)
+        data_point_ids = [struct.unpack_from('<H', first, 32 + 32 * i)[0] for i in range(first[26])]
+    committed_size -= max(committed_size - length, 0) % BYTES_PER_DATA_POINT
+
+    last_time = 0
+    pending = b''
+    skip = length
+    for cluster in file_clusters(volume, first_cluster):
+        pending += volume.read_cluster(cluster)
+        if skip > 0:
+            pending, skip = pending[skip:], max(skip - len(pending), 0)
+        offset = 0
+        while offset + BYTES_PER_DATA_POINT <= len(pending):
+            time, data_type = struct.unpack_from('<L6xH', pending, offset)
+            if length >= committed_size:
+                if data_type not in data_point_ids or time < last_time or time - last_time > MAX_TIME_STEP_US:
+                    return length
+            last_time = time
+            length += BYTES_PER_DATA_POINT
+            offset += BYTES_PER_DATA_POINT
+        pending = pending[offset:]
+    return length
+
+
+def copy_recovered(volume, first_cluster, length, output):
+    for cluster in file_clusters(volume, first_cluster):
+        if length <= 0:
+            break
+        data = volume.read_cluster(cluster)[:length]
+        output.write(data)
+        length -= len(data)
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description="Recover unclosed IMpack recordings from an SD card image")
+    parser.add_argument("image", help="card image or block device")
+    parser.add_argument("-o", "--output", default="recovered", help="directory for the recovered data files")
+    parser.add_argument("--all", action="store_true", help="also copy recordings that were closed normally")
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as file:
+        volume = FAT32Volume(file)
+        os.makedirs(args.output, exist_ok=True)
+
+        for name, first_cluster, size in volume.root_entries():
+            if not re.match(r'DATA\d+\.D(AT|\d\d)$', name):
+                continue  # only recordings and their segments (DATAn.DAT, DATAn.D01, ...)
+            if first_cluster == 0:
+                print("%s: never committed, nothing to recover" % name)
+                continue
+
+            length = recovered_length(volume, first_cluster, size)
+            if length > size or args.all:
+                with open(os.path.join(args.output, name), 'wb') as output:
+                    copy_recovered(volume, first_cluster, length, output)
+                print("%s: %d bytes in directory entry, recovered %d bytes" % (name, size, length))
+            else:
+                print("%s: closed normally (%d bytes)" % (name, size))
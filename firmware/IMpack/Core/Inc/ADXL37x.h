@@ -135,15 +135,18 @@ uint8_t ADXL37x_ConvertReadRegister(uint8_t reg)
 	return ((reg << 1) | 0x01);
 }
 
-void ADXL37x_ProcessData(uint8_t* raw_data, float units_per_bit, float* data_x, float* data_y, float* data_z)
+void ADXL37x_ProcessDataRaw(uint8_t* raw_data, int16_t* data_x, int16_t* data_y, int16_t* data_z)
 {
-	int16_t raw_data_x = (raw_data[0] << 8) | (raw_data[1]);
-	int16_t raw_data_y = (raw_data[2] << 8) | (raw_data[3]);
-	int16_t raw_data_z = (raw_data[4] << 8) | (raw_data[5]);
+	/* 12 bit signed counts, left justified in big endian data registers */
+	*data_x = ((int16_t)((raw_data[0] << 8) | (raw_data[1]))) >> 4;
+	*data_y = ((int16_t)((raw_data[2] << 8) | (raw_data[3]))) >> 4;
+	*data_z = ((int16_t)((raw_data[4] << 8) | (raw_data[5]))) >> 4;
+}
 
-	raw_data_x = raw_data_x >> 4;
-	raw_data_y = raw_data_y >> 4;
-	raw_data_z = raw_data_z >> 4;
+void ADXL37x_ProcessData(uint8_t* raw_data, float units_per_bit, float* data_x, float* data_y, float* data_z)
+{
+	int16_t raw_data_x, raw_data_y, raw_data_z;
+	ADXL37x_ProcessDataRaw(raw_data, &raw_data_x, &raw_data_y, &raw_data_z);
 
 	*data_x = units_per_bit * (float)raw_data_x;
 	*data_y = units_per_bit * (float)raw_data_y;
@@ -11,6 +11,7 @@
 #define IIS3DWB_DEVICE_ID 0x7B  /* fixed value of WHO_AM_I register */
 
 #define IIS3DWB_RESOLUTION 16  /* bit depth of sensor */
+#define IIS3DWB_ODR 26667  /* fixed output data rate in Hz */
 #define IIS3DWB_OFFSET_WEIGHT 0.0009765625f  /* g per bit of user offset */
 
 /* device register addresses (p.26) */
@@ -161,11 +162,18 @@ uint8_t IIS3DWB_ConvertReadRegister(uint8_t reg)
 	return (reg | 0x80);
 }
 
+void IIS3DWB_ProcessDataRaw(uint8_t* raw_data, int16_t* data_x, int16_t* data_y, int16_t* data_z)
+{
+	/* signed counts from the little endian data registers */
+	*data_x = ((int16_t)(raw_data[0])) | (((int16_t)(raw_data[1])) << 8);
+	*data_y = ((int16_t)(raw_data[2])) | (((int16_t)(raw_data[3])) << 8);
+	*data_z = ((int16_t)(raw_data[4])) | (((int16_t)(raw_data[5])) << 8);
+}
+
 void IIS3DWB_ProcessData(uint8_t* raw_data, float units_per_bit, float* data_x, float* data_y, float* data_z)
 {
-	int16_t raw_data_x = ((int16_t)(raw_data[0])) | (((int16_t)(raw_data[1])) << 8);
-	int16_t raw_data_y = ((int16_t)(raw_data[2])) | (((int16_t)(raw_data[3])) << 8);
-	int16_t raw_data_z = ((int16_t)(raw_data[4])) | (((int16_t)(raw_data[5])) << 8);
+	int16_t raw_data_x, raw_data_y, raw_data_z;
+	IIS3DWB_ProcessDataRaw(raw_data, &raw_data_x, &raw_data_y, &raw_data_z);
 
 	*data_x = units_per_bit * (float)raw_data_x;
 	*data_y = units_per_bit * (float)raw_data_y;
@@ -70,7 +70,7 @@
 
 /* sensor configuration */
 #define LSM6DSx_CONFIGURATION_REG  {LSM6DSx_REG_CTRL1_XL, LSM6DSx_REG_CTRL2_G, LSM6DSx_REG_INT1_CTRL, LSM6DSx_REG_INT2_CTRL, LSM6DSx_REG_CTRL4_C, LSM6DSx_REG_CTRL6_C, LSM6DSx_REG_X_OFS_USR, LSM6DSx_REG_Y_OFS_USR, LSM6DSx_REG_Z_OFS_USR, LSM6DSx_REG_CTRL8_XL}
-#define LSM6DSx_CONFIGURATION_DATA {0x00, 0x00, 0x01, 0x02, 0x0C, 0x03, 0x00, 0x00, 0x00}
+#define LSM6DSx_CONFIGURATION_DATA {0x00, 0x00, 0x01, 0x02, 0x0C, 0x03, 0x00, 0x00, 0x00, 0x00}
 
 /*
  * Configuration sequence:
@@ -297,11 +297,18 @@ uint8_t LSM6DSx_ConvertReadRegister(uint8_t reg)
 	return (reg | 0x80);
 }
 
+void LSM6DSx_ProcessDataRaw(uint8_t* raw_data, int16_t* data_x, int16_t* data_y, int16_t* data_z)
+{
+	/* signed counts from the little endian data registers */
+	*data_x = ((int16_t)(raw_data[0])) | (((int16_t)(raw_data[1])) << 8);
+	*data_y = ((int16_t)(raw_data[2])) | (((int16_t)(raw_data[3])) << 8);
+	*data_z = ((int16_t)(raw_data[4])) | (((int16_t)(raw_data[5])) << 8);
+}
+
 void LSM6DSx_ProcessData(uint8_t* raw_data, float units_per_bit, float* data_x, float* data_y, float* data_z)
 {
-	int16_t raw_data_x = ((int16_t)(raw_data[0])) | (((int16_t)(raw_data[1])) << 8);
-	int16_t raw_data_y = ((int16_t)(raw_data[2])) | (((int16_t)(raw_data[3])) << 8);
-	int16_t raw_data_z = ((int16_t)(raw_data[4])) | (((int16_t)(raw_data[5])) << 8);
+	int16_t raw_data_x, raw_data_y, raw_data_z;
+	LSM6DSx_ProcessDataRaw(raw_data, &raw_data_x, &raw_data_y, &raw_data_z);
 
 	*data_x = units_per_bit * (float)raw_data_x;
 	*data_y = units_per_bit * (float)raw_data_y;
@@ -0,0 +1,43 @@
+/*
+ * Motion detector that ends a recording once it has settled
+ */
+
+#ifndef INC_ACTIVITY_H_
+#define INC_ACTIVITY_H_
+
+#include <stdint.h>
+
+#define ACTIVITY_MAX_CHANNELS 4
+#define ACTIVITY_AVERAGE_BITS 8  /* fraction bits of the running averages */
+
+/*
+ * Each accelerometer keeps a running average of its axes, an exponential one with a power of two weight so it only takes a
+ * shift, which follows gravity and any slow drift. A data point that is further than the level from the average on any axis
+ * is motion, and the recording can stop once there has been none for a while. Like the trigger the level is in counts of
+ * each sensor, so an update is a few integer operations in the timer interrupt.
+ */
+typedef struct
+{
+	uint8_t enabled;
+	uint8_t big_endian;  /* 16 bit values stored most significant byte first */
+	uint8_t shift;  /* lower resolution values are left justified, shifted down to counts */
+	uint8_t average_shift;  /* each data point moves the average by 1 / 2^average_shift of the difference */
+	uint32_t level;  /* distance from the average in counts */
+	uint8_t started;  /* the averages start from the first data point */
+	int32_t average[3];  /* in counts, with ACTIVITY_AVERAGE_BITS fraction bits */
+} ActivityChannel;
+
+typedef struct
+{
+	ActivityChannel channels[ACTIVITY_MAX_CHANNELS];
+	volatile uint32_t last_motion_micros;
+} Activity;
+
+void Activity_Init(Activity* activity);
+void Activity_SetChannel(Activity* activity, uint8_t channel, uint32_t level_milli, uint32_t full_scale, uint8_t resolution, uint8_t big_endian,
+						 float odr_hz, uint32_t average_micros);  /* level in thousandths of the unit of the +/- full_scale range */
+void Activity_Reset(Activity* activity, uint32_t time_micros);  /* start the averages again, counting as motion at time_micros */
+void Activity_Update(Activity* activity, uint8_t channel, const uint8_t* raw_data, uint32_t time_micros);
+uint8_t Activity_IsSettled(const Activity* activity, uint32_t time_micros, uint32_t hold_micros);  /* true if there has been no motion for hold_micros, at most INT32_MAX */
+
+#endif /* INC_ACTIVITY_H_ */
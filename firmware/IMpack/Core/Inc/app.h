@@ -14,8 +14,24 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DS3, SPI_Handl
 void App_Loop();
 void App_PinInterrupt(uint16_t GPIO_Pin);
 void App_TimerInterrupt();
+uint8_t App_ChannelNamesAreShort();
+void App_StartChannelRecordings();
+void App_JoinPretrigger(uint32_t trigger_index);
+void App_EndEvent();
+void App_ApplySettings();
+void App_SelectProfile(int32_t profile);
+int32_t App_ReadProfileFile();
+uint8_t App_WriteProfileFile();
+uint8_t App_CheckBudget();
+void App_WriteBootLog();
+uint32_t App_SettingsFileKey();
+uint8_t App_LoadSettingsCache(uint32_t key);
+uint8_t App_SaveSettingsCache(uint32_t key);
+uint8_t App_PrepareCard();
+void App_SPITransmitComplete(SPI_HandleTypeDef* hspi, uint8_t error);
 
 void App_EnableAccelerometerInterrupts();
 void App_DisableAccelerometerInterrupts();
+void App_StopSensors();
 
 #endif /* INC_APP_H_ */
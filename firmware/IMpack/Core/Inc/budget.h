@@ -0,0 +1,59 @@
+/*
+ * Throughput budget of the configured channel mix
+ */
+
+#ifndef INC_BUDGET_H_
+#define INC_BUDGET_H_
+
+#include <stdint.h>
+
+#define BUDGET_MAX_CHANNELS 4
+#define BUDGET_MAX_BUSES 2  /* SPI1 and SPI2 */
+
+/* timing model, measured roughly on the IMpack at 168 MHz */
+#define BUDGET_BYTE_GAP_MICROS 0.2f  /* polling the status register between bytes */
+#define BUDGET_READ_OVERHEAD_MICROS 1.0f  /* finding the sensor and toggling its chip select */
+#define BUDGET_PIN_INTERRUPT_MICROS 0.5f  /* time stamping each sample in the data ready interrupt */
+#define BUDGET_MAX_CPU_LOAD 0.75f  /* the rest is left for the main loop */
+
+/* limits that were exceeded, any of them means samples will be dropped */
+#define BUDGET_BUS_OVERLOAD 0x01  /* an SPI bus can't keep up with the reads */
+#define BUDGET_CPU_OVERLOAD 0x02  /* the interrupts leave too little time for the main loop to write the card */
+#define BUDGET_CARD_OVERLOAD 0x04  /* the data rate is more than the card can write */
+#define BUDGET_BUFFER_OVERRUN 0x08  /* a buffer half fills up before the other one can be written out */
+
+/*
+ * Estimate of whether a recording can keep up, worked out from the data rates before anything is recorded. Each sample is
+ * read over SPI by polling inside the timer interrupt, so the bus time of a read is also CPU time taken from the main loop,
+ * which is left to write the buffer halves out to the card. Each stream is one double buffer with its own half size (the
+ * shared data buffer, or one per channel in channel files mode) and they are assumed to all come due at once.
+ */
+typedef struct
+{
+	/* configuration */
+	float bus_clock_hz[BUDGET_MAX_BUSES];
+	float odr_hz[BUDGET_MAX_CHANNELS];  /* 0 for a disabled channel */
+	uint8_t bus[BUDGET_MAX_CHANNELS];
+	uint32_t read_bytes[BUDGET_MAX_CHANNELS];  /* SPI bytes per sample including the address */
+	uint32_t record_bytes[BUDGET_MAX_CHANNELS];  /* bytes stored per sample */
+	uint8_t stream[BUDGET_MAX_CHANNELS];
+	uint32_t stream_half_bytes[BUDGET_MAX_CHANNELS];
+
+	/* results */
+	float sample_rate_hz;  /* all channels together */
+	float bus_load[BUDGET_MAX_BUSES];  /* fraction of the time each bus is busy */
+	float cpu_load;  /* fraction of the CPU time spent in the sensor interrupts */
+	float card_bytes_per_sec;  /* write bandwidth needed */
+	float fill_micros;  /* time for the quickest buffer half to fill */
+	float write_micros;  /* worst case time to write every stream's half out, slowed down by the interrupts */
+	uint8_t overloads;  /* BUDGET_ flags */
+} ThroughputBudget;
+
+void ThroughputBudget_Init(ThroughputBudget* budget);
+void ThroughputBudget_SetBus(ThroughputBudget* budget, uint8_t bus, float clock_hz);
+void ThroughputBudget_SetStream(ThroughputBudget* budget, uint8_t stream, uint32_t half_bytes);
+void ThroughputBudget_SetChannel(ThroughputBudget* budget, uint8_t channel, float odr_hz, uint8_t bus, uint32_t read_bytes, uint32_t record_bytes, uint8_t stream);
+uint8_t ThroughputBudget_Evaluate(ThroughputBudget* budget, float card_bytes_per_sec, float card_latency_micros);  /* returns true if nothing will be dropped */
+uint32_t ThroughputBudget_Format(ThroughputBudget* budget, char* buf, uint32_t buf_len);  /* text report, returns the length */
+
+#endif /* INC_BUDGET_H_ */
@@ -25,9 +25,22 @@ typedef struct
 	/* time of last press */
 	uint32_t time_last_press_micros;
 
+	/* telling short and long presses apart, which are only known at the release or once held long enough */
+	uint8_t is_held;
+	uint8_t long_press_reported;
+	uint32_t time_hold_started_micros;
+
 } ButtonDebounced;
 
+typedef enum
+{
+	BUTTON_NONE,
+	BUTTON_SHORT_PRESS,  /* released before the long press time */
+	BUTTON_LONG_PRESS  /* still held at the long press time */
+} ButtonGesture;
+
 void ButtonDebounced_Init(ButtonDebounced* button, GPIO_TypeDef* GPIO_Port, uint16_t GPIO_Pin, volatile uint32_t* time_micros_ptr, uint32_t time_debounce_micros);
 uint8_t ButtonDebounced_GetPressed(ButtonDebounced* button);
+uint8_t ButtonDebounced_GetGesture(ButtonDebounced* button, uint32_t long_press_micros);  /* returns a ButtonGesture, once for each press */
 
 #endif /* INC_BUTTON_H_ */
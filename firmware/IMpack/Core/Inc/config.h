@@ -49,11 +49,32 @@
 #define SETTING_DELAY_BEFORE_ARMED_ID 	    "delay_before_armed_ms"
 #define SETTING_RECORDING_LENGTH_ID 		"recording_length_ms"
 #define SETTING_FORMAT_DATA_EN_ID 			"data_formatting_enabled"
+#define SETTING_COMMIT_INTERVAL_ID			"commit_interval_ms"
+#define SETTING_RAW_LOGGING_EN_ID			"raw_logging_enabled"
+#define SETTING_RAW_REGION_SIZE_ID			"raw_region_size_mb"
+#define SETTING_CHANNEL_FILES_EN_ID			"channel_files_enabled"
 #define SETTING_ACCEL_TRIGGER_EN_ID			"accel_trigger_enabled"
 #define SETTING_ACCEL_TRIGGER_ANY_AXIS_ID	"accel_trigger_on_any_axis"
 #define SETTING_ACCEL_TRIGGER_AXIS_ID		"accel_trigger_axis"
 #define SETTING_ACCEL_TRIGGER_LEVEL_ID		"accel_trigger_level_mg"
 #define SETTING_ACCEL_TRIGGER_EDGE_ID		"accel_trigger_rising_edge"
+#define SETTING_TRIGGER_MAGNITUDE_ID		"trigger_on_magnitude"
+#define SETTING_LSM6DSx_ACCEL_TRIGGER_ID	"LSM6DSx_accel_trigger_level_mg"
+#define SETTING_LSM6DSx_GYRO_TRIGGER_ID		"LSM6DSx_gyro_trigger_level_dps"
+#define SETTING_IIS3DWB_ACCEL_TRIGGER_ID	"IIS3DWB_accel_trigger_level_mg"
+#define SETTING_ADXL37x_ACCEL_TRIGGER_ID	"ADXL37x_accel_trigger_level_mg"
+#define SETTING_TRIGGER_HYSTERESIS_ID		"trigger_hysteresis_pct"
+#define SETTING_TRIGGER_MIN_DURATION_ID		"trigger_min_duration_us"
+#define SETTING_TRIGGER_ALL_CHANNELS_ID		"trigger_on_all_channels"
+#define SETTING_PRETRIGGER_ID				"pretrigger_ms"
+#define SETTING_AUTO_STOP_EN_ID				"auto_stop_enabled"
+#define SETTING_AUTO_STOP_LEVEL_ID			"auto_stop_level_mg"
+#define SETTING_AUTO_STOP_HOLD_ID			"auto_stop_hold_ms"
+#define SETTING_AUTO_STOP_REARM_ID			"auto_stop_rearm"
+#define SETTING_MULTI_SHOT_EN_ID			"multi_shot_enabled"
+#define SETTING_MULTI_SHOT_EVENTS_ID		"multi_shot_max_events"
+#define SETTING_CARD_WRITE_SPEED_ID			"card_write_speed_kb_s"
+#define SETTING_CARD_WRITE_LATENCY_ID		"card_write_latency_ms"
 
 
 
@@ -63,24 +84,66 @@
  */
 
 #define SETTINGS_FILE "settings.txt"
+#define PROFILE_FILE "profile.txt"  /* name of the profile in use, kept across power cycles */
+#define SETTINGS_BASE_PROFILE_NAME "base"  /* the settings before the first [name] line */
+#define BOOT_LOG_FILE "boot.txt"  /* time stamps of the start up stages */
+#define BUDGET_FILE "budget.txt"  /* predicted throughput of the settings in use, rewritten whenever they change */
+#define SETTINGS_CACHE_ADDRESS 0x080E0000  /* parsed settings are kept in the last flash sector, left out of the linker script */
+#define SETTINGS_CACHE_SECTOR FLASH_SECTOR_11
 
 /*
  * DATALOGGING
  */
 
-#define CD_LOGGER_DATA_BUFFER_LEN 	8192  /* number of data points to store at a time */
+#define CD_LOGGER_DATA_BUFFER_LEN 	8192  /* number of data points to store at a time, each half a whole number of sectors */
 #define DATA_FILE_NAME      		"DATA"
 #define DATA_FILE_EXT				".DAT"
-#define LSM6DSx_ACCEL_FILE  		"LSM_ac%d.csv"
-#define LSM6DSx_GYRO_FILE			"LSM_gy%d.csv"
-#define IIS3DWB_FILE				"IIS_ac%d.csv"
-#define ADXL37x_FILE				"ADX_ac%d.csv"
+#define RECORDING_INDEX_FILE		"DATA.IDX"  /* next recording number, rebuilt from a directory scan if missing */
+#define DATA_SEGMENT_MAX_BYTES		0xFFFFFFFF  /* FAT32 file size limit, longer recordings continue in DATAn.D01, DATAn.D02 and so on */
+#define RAW_LOG_FILE				"RAWLOG.BIN"  /* contiguous region used by the raw logging mode */
+#define FIRMWARE_VERSION			"1.1"  /* stored in the header of each recording */
+#define LSM6DSx_ACCEL_FILE  		"LSMA%lu.csv"  /* 4 letters at most before the number so the names stay 8.3 up to recording 9999 */
+#define LSM6DSx_GYRO_FILE			"LSMG%lu.csv"
+#define IIS3DWB_FILE				"IISA%lu.csv"
+#define ADXL37x_FILE				"ADXA%lu.csv"
+#define LSM6DSx_ACCEL_NAME			"LSMA"  /* channel names in the recording header, also used for the channel files so 4 letters at most */
+#define LSM6DSx_GYRO_NAME			"LSMG"
+#define IIS3DWB_NAME				"IISA"
+#define ADXL37x_NAME				"ADXA"
+#define CHANNEL_FILE_EXT			".BIN"  /* channel files mode, LSMA12.BIN and so on next to a DATA12.DAT that only holds the header */
+#define CHANNEL_FILE_RECORD_SIZE	10  /* uint32 time stamp and 3 int16 values, the data points without the data type tag */
+#define CHANNEL_FILE_RING_LEN		256  /* data points waiting to be read from the sensors, the rest of the buffer goes to the channels */
+#define CHANNEL_FILE_BLOCK_LEN		2560  /* channel buffer halves are a multiple of this, a whole number of both records and sectors */
+#define PRETRIGGER_MARGIN_LEN		64  /* data points left free in the pre-trigger window for the reads that finish while it is found */
+#define AUTO_STOP_AVERAGE_MICROS	200000  /* how far back the running averages of the auto stop reach, the hold time should be longer */
+
+/*
+ * MEMORY
+ */
+
+#define CCMRAM __attribute__((section(".ccmram")))  /* core coupled RAM, only for state the DMA never reads or writes */
+
+/*
+ * SENSORS
+ */
+
+#define SENSOR_CONFIG_TIMEOUT_MICROS 10000  /* the register writes take well under a millisecond */
+
+/*
+ * SD CARD
+ */
+
+#define SD_IDLE_TIMEOUT_MICROS		300000000  /* unmount the card after this long in the idle state, 0 to stay mounted */
+#define CARD_PREP_HOLD_MICROS		3000000  /* hold the button this long at power up to re-format the card for logging */
+#define CARD_PREP_MARKER_FILE		"CARDPREP.TXT"  /* written after formatting, describes the layout */
+#define CONVERT_JOURNAL_FILE		"CONVERT.JNL"  /* progress of the CSV conversion, lets it resume after a new recording or power cycle */
 
 /*
  * BUTTON
  */
 
 #define BUTTON_DEBOUNCE_TIME_MICROS 500000
+#define PROFILE_SWITCH_HOLD_MICROS 1500000  /* hold the button this long in the idle state to switch to the next profile */
 
 /*
  * INDICATOR LED
@@ -95,6 +158,7 @@
 
 #define SUCCESS_BURST_SEQUENCE   {1000000, 100000, 100000, 100000}
 #define ERROR_BURST_SEQUENCE     {1000000, 100000, 100000, 100000, 100000, 100000, 100000, 100000}
+#define BUDGET_BURST_SEQUENCE    {1000000, 1000000, 250000, 1000000}  /* two long blinks, the settings will drop samples */
 
 
 #endif /* INC_CONFIG_H_ */
@@ -0,0 +1,102 @@
+/*
+ * Conversion of binary recordings to CSV files
+ */
+
+#ifndef INC_CONVERTER_H_
+#define INC_CONVERTER_H_
+
+#include <stdint.h>
+#include "fatfs.h"
+#include "csv.h"
+
+#define CSV_CONVERTER_CHANNELS		4
+#define CSV_CONVERTER_RECORD_SIZE	12  /* data points as written by the logger: uint32 time stamp, 6 data bytes, uint16 data type */
+#define CSV_CONVERTER_READ_LEN		24576  /* raw data read per step, a whole number of both records and sectors */
+#define CSV_CONVERTER_CHECKPOINT_STEPS	40  /* steps between journal updates while converting, about 1 MB of raw data */
+#define CSV_CONVERTER_CLMT_LEN		64  /* cluster link map entries for seeking in the raw file, enough for 31 fragments */
+#define CSV_CONVERTER_JOURNAL_MAGIC	0x4A564E43  /* "CNVJ" */
+#define CSV_CONVERTER_ERROR_EXT		".ERR"  /* marker file left next to a recording whose conversion failed */
+
+/*
+ * Each channel builds its CSV text in its own staging buffer, which is written out in fixed power of 2 blocks. Together
+ * with keeping the header line in the buffer this means every write lands on a sector boundary of the CSV file, so FatFs
+ * can write straight from the staging buffer instead of copying through the file's sector buffer.
+ */
+typedef struct
+{
+	uint16_t data_type;  /* tag in the data points that belong to this channel */
+	void (*process_data_raw)(uint8_t* raw_data, int16_t* data_x, int16_t* data_y, int16_t* data_z);
+	uint32_t full_scale;  /* range and bit depth for recordings made before they carried a header */
+	uint8_t resolution;
+	CSVScale scale;  /* for the recording being converted */
+	const char* file_name_format;  /* printf format taking the recording number */
+	const char* header;  /* column names line */
+
+	FIL fil;
+	uint8_t is_open;
+	char* stage;
+	uint32_t stage_fill;
+	uint32_t checkpoint_size;  /* length of the CSV file at the last checkpoint, zero if not created yet */
+
+} CSVConverterChannel;
+
+/*
+ * Progress of the conversion as stored on the card, so a conversion interrupted by a new recording or a power cycle
+ * carries on where it left off. Everything up to raw_offset in the current segment is in the CSV files, which are cut
+ * back to their checkpoint sizes when the conversion resumes.
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t recording_number;
+	uint32_t segment, segment_count;
+	uint32_t raw_offset;
+	uint32_t csv_size[CSV_CONVERTER_CHANNELS];
+	uint32_t check;  /* sum of the fields above */
+
+} CSVConverterJournal;
+
+typedef struct
+{
+	/* work memory, split into the read buffer and one staging buffer per channel */
+	uint8_t* read_buf;  /* with room for one data point in front of it */
+	uint32_t read_skip;  /* padding in front of the data at the start of the next read */
+	uint32_t carry_len;  /* start of a data point cut off at the end of the last read, kept just in front of the read buffer */
+	uint32_t flush_len;  /* size of each write to a CSV file */
+
+	CSVConverterChannel channels[CSV_CONVERTER_CHANNELS];
+
+	/* recording being converted, the job stays active while it is paused */
+	uint8_t active;
+	FIL raw_fil;
+	uint8_t raw_is_open;
+	char* data_file_name;
+	char* data_file_ext;
+	uint32_t recording_number;
+	uint32_t segment, segment_count;
+
+	/* checkpoints */
+	char* journal_file_name;
+	uint32_t raw_offset;  /* position in the current segment at the last checkpoint */
+	uint32_t steps_since_checkpoint;
+
+	/* fast seek table for resuming partway through a segment, kept while the same file is being converted */
+	DWORD clmt[CSV_CONVERTER_CLMT_LEN];
+	DWORD clmt_sclust;  /* first cluster of the file the table belongs to, zero if none */
+
+	FRESULT fresult;
+	uint8_t queue_blocked;  /* the last failed recording couldn't be taken off the queue, so it would come up again */
+
+} CSVConverter;
+
+void CSVConverter_Init(CSVConverter* converter, uint8_t* work, uint32_t work_len, char* journal_file_name);  /* work memory must be 4 byte aligned and is only used while converting */
+void CSVConverter_SetChannel(CSVConverter* converter, uint8_t channel, uint16_t data_type, void (*process_data_raw)(uint8_t*, int16_t*, int16_t*, int16_t*),
+							 uint32_t full_scale, uint8_t resolution, const char* file_name_format, const char* header);
+
+uint8_t CSVConverter_Start(CSVConverter* converter, char* data_file_name, char* data_file_ext, uint32_t recording_number, uint32_t segment_count);  /* begin converting a recording, returns true on success */
+uint8_t CSVConverter_StartNext(CSVConverter* converter, char* data_file_name, char* data_file_ext);  /* begin converting the oldest recording that hasn't been converted yet, returns true while the queue may have more */
+uint8_t CSVConverter_Resume(CSVConverter* converter, char* data_file_name, char* data_file_ext);  /* pick up a conversion left in the journal, returns true if there is one */
+uint8_t CSVConverter_Step(CSVConverter* converter);  /* convert the next block of data points, returns true while there is more to do */
+void CSVConverter_Pause(CSVConverter* converter);  /* checkpoint and close all files, the next step carries on from here */
+
+#endif /* INC_CONVERTER_H_ */
@@ -0,0 +1,27 @@
+/*
+ * Fixed point CSV formatting of sensor data
+ */
+
+#ifndef INC_CSV_H_
+#define INC_CSV_H_
+
+#include <stdint.h>
+
+#define CSV_DECIMALS		6  /* digits after the decimal point, same as the %f format */
+#define CSV_MAX_LINE_LEN	72  /* longest possible line: 10 digit time stamp, 3 signed values and separators */
+
+/*
+ * Conversion from raw counts to millionths of the physical unit, value = (counts * scale) >> shift. The full scale range in
+ * millionths over 2^(resolution - 1) is reduced to lowest terms so the product fits in 64 bits.
+ */
+typedef struct
+{
+	uint32_t scale;
+	uint8_t shift;
+
+} CSVScale;
+
+void CSV_InitScale(CSVScale* scale, uint32_t full_scale, uint8_t resolution);  /* full scale range in physical units (e.g. 16 for +/- 16 g) and sensor bit depth */
+uint32_t CSV_FormatLine(char* buf, uint32_t time_micros, int16_t data_x, int16_t data_y, int16_t data_z, const CSVScale* scale);  /* write "time,x,y,z\n" into buf, returns the number of characters */
+
+#endif /* INC_CSV_H_ */
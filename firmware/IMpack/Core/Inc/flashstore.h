@@ -0,0 +1,27 @@
+/*
+ * Record kept in a spare sector of the internal flash
+ */
+
+#ifndef INC_FLASHSTORE_H_
+#define INC_FLASHSTORE_H_
+
+#include "main.h"
+
+#define FLASH_STORE_MAGIC 0x31535446  /* "FST1" */
+
+/*
+ * One block of data at the start of a flash sector, tagged with a key that says what it was made from. The header is
+ * programmed after the data so a record cut short by a power loss never looks valid.
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t key;  /* chosen by the caller, a load only succeeds if it matches */
+	uint32_t len;
+	uint32_t check;  /* FNV-1a of the data */
+} FlashStoreHeader;
+
+uint8_t FlashStore_Load(uint32_t address, uint32_t key, void* data, uint32_t len);  /* copy out a valid record made with this key and length, returns true on success */
+uint8_t FlashStore_Save(uint32_t address, uint32_t sector, uint32_t key, const void* data, uint32_t len);  /* erase the sector and program a new record, takes around a second */
+
+#endif /* INC_FLASHSTORE_H_ */
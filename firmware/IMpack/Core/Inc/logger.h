@@ -11,7 +11,44 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "fatfs.h"
+#include "diskio.h"
+
+/*
+ * Raw logging mode: recordings are written with plain sector writes into one contiguous preallocated file, the raw region,
+ * so FatFs never has to touch the FAT or directory while recording. The region starts with a superblock, followed by the
+ * recordings back to back, each one a header block and then the data points. All sector numbers are relative to the start
+ * of the region so it can be read either as a file or from the card's block device.
+ */
+#define SD_LOGGER_SECTOR_SIZE 512
+#define SD_LOGGER_MAX_RECORDING_NUMBER 9999  /* largest number that keeps DATA9999.DAT an 8.3 file name */
+#define SD_LOGGER_RAW_SUPERBLOCK_MAGIC "IMPKRAW"
+#define SD_LOGGER_RAW_HEADER_MAGIC "IMPKREC"
+#define SD_LOGGER_RAW_VERSION 1
+#define SD_LOGGER_RAW_HEADER_SECTORS 2
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t region_start;  /* absolute sector of the superblock on the card */
+	uint32_t region_sectors;  /* total size of the region including the superblock */
+	uint32_t next_sector;  /* where the next recording header will go */
+	uint32_t recording_count;
+} SDLoggerRawSuperblock;
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recording_number;
+	uint32_t start_sector;  /* first sector of the data points */
+	uint32_t length;  /* length in bytes of the data, updated at each commit and when the recording stops */
+	uint16_t data_point_size;
+	uint16_t description_len;
+	char description[SD_LOGGER_RAW_HEADER_SECTORS * SD_LOGGER_SECTOR_SIZE - 28];  /* settings used for the recording as text */
+} SDLoggerRawHeader;
 
 typedef struct
 {
@@ -20,6 +57,7 @@ typedef struct
 	uint32_t data_buffer_len;  /* length in bytes of the full buffer */
 	volatile uint32_t data_buffer_index;  /* stored index into the data byte array */
 	uint16_t data_point_size;  /* size in bytes of each data point */
+	volatile uint32_t data_point_count;  /* data points in the current recording so far */
 
 	/* double buffering */
 	volatile uint8_t ready_to_write;
@@ -30,14 +68,58 @@ typedef struct
 	FRESULT fresult;
 	UINT write_count;
 
+	/* periodic commits of the file size and FAT so a recording survives a power loss */
+	volatile uint32_t* time_micros_ptr;
+	uint32_t commit_interval_micros;  /* zero to only commit when the file is closed */
+	uint32_t time_last_commit;
+
+	/* long recordings are split into segment files before they reach the FAT32 file size limit */
+	uint32_t segment_max_bytes;  /* zero to always use a single file */
+	uint32_t segment_count;  /* number of files created for the current recording */
+	char* data_file_name;
+	char* data_file_ext;
+	uint32_t recording_number;
+	uint8_t next_fil_open;  /* holds the spare file object, shared by all of the loggers, with the following segment opened ahead of the rollover */
+
+	/* header written at the start of each recording, a whole number of sectors */
+	const uint8_t* header;
+	uint32_t header_len;
+	uint8_t header_deferred;  /* hold the header back until the first data write, so it can still be changed once the recording is open */
+	uint8_t header_pending;
+	uint32_t header_reserve;  /* bytes skipped after the header for the caller to fill in later, a whole number of sectors */
+	uint32_t preallocate_bytes;  /* free space looked for when a recording is created, so it grows into one contiguous block */
+
+	/* pre-trigger capture, the recording takes over a buffer that was already filling and starts part way through it */
+	uint8_t* write_start;  /* first byte to write, NULL once it has been written */
+
+	/* raw logging mode */
+	uint8_t raw_mode;
+	uint32_t raw_region_start, raw_region_sectors;  /* absolute location of the raw region on the card */
+	uint32_t raw_header_sector, raw_write_sector;  /* relative to the region start */
+	uint32_t raw_length;  /* bytes written in the current recording */
+	uint32_t raw_tail_len;  /* bytes of a partly filled last sector, kept until the rest of it comes in */
+
 } SDLogger;
 
-void SDLogger_Initialize(SDLogger* logger, uint8_t* data_buffer, uint32_t data_buffer_len, uint16_t data_point_size);
+void SDLogger_Initialize(SDLogger* logger, uint8_t* data_buffer, uint32_t data_buffer_len, uint16_t data_point_size, volatile uint32_t* time_micros_ptr);
+void SDLogger_SetCommitInterval(SDLogger* logger, uint32_t commit_interval_micros);
+void SDLogger_SetSegmentSize(SDLogger* logger, uint32_t segment_max_bytes);
+void SDLogger_SetHeader(SDLogger* logger, const void* header, uint32_t header_len);  /* header must stay valid while recording and be 4 byte aligned */
+void SDLogger_DeferHeader(SDLogger* logger, uint8_t deferred);  /* write the header with the first data instead of when the recording starts */
+void SDLogger_ReserveAfterHeader(SDLogger* logger, uint32_t reserve_bytes);  /* leave room after the header, filled in with SDLogger_Rewrite */
+void SDLogger_SetPreallocation(SDLogger* logger, uint32_t preallocate_bytes);  /* expected size of each recording, 0 to not look for a contiguous block */
+uint8_t SDLogger_IsShortName(char* data_file_name, char* data_file_ext);  /* true if every file of a recording, segments included, gets an 8.3 name up to the largest recording number */
+void SDLogger_FormatSegmentName(char* data_file_full, char* data_file_name, char* data_file_ext, uint32_t recording_number, uint32_t segment);  /* DATA12.DAT, then DATA12.D01, DATA12.D02 and so on */
 
 void SDLogger_IncrementDataIndex(SDLogger* logger);  /* call this each time a new data point is added to the buffer */
 
-void SDLogger_StartRecording(SDLogger* logger, char* data_file_name, char* data_file_ext, char* data_file_full, uint16_t* recording_number);  /* open a file to start recording */
+void SDLogger_StartRecording(SDLogger* logger, char* data_file_name, char* data_file_ext, char* index_file_name, char* data_file_full, uint32_t* recording_number);  /* open a file to start recording */
 void SDLogger_Update(SDLogger* logger);  /* write data to the SD card if it is time to do so */
+void SDLogger_StartChannelRecording(SDLogger* logger, char* file_name, char* file_ext, uint32_t recording_number, uint32_t preallocate_bytes);  /* open a file for one channel of a recording, preallocated if possible */
+void SDLogger_StartRawRecording(SDLogger* logger, char* region_file_name, uint32_t region_size_mb, const char* description, uint32_t* recording_number);  /* start a recording in the raw region, creating it if needed */
+void SDLogger_Flush(SDLogger* logger);  /* write all of the data in the buffer and commit it, the recording stays open for more */
 void SDLogger_StopRecording(SDLogger* logger);  /* write remaining data close the file */
+uint32_t SDLogger_JoinBuffer(SDLogger* logger, uint32_t first_byte, uint32_t index, uint8_t align);  /* keep the data already in the buffer from first_byte on, the next data point goes in at index. If aligned, returns the padding in front of first_byte, which the header size has to include, otherwise the data follows on directly from what was written before */
+void SDLogger_Rewrite(SDLogger* logger, uint32_t offset, const void* data, uint32_t len);  /* overwrite part of the first segment of the recording, offset from its start, and commit it */
 
 #endif /* INC_LOGGER_H_ */
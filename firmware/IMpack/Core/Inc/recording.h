@@ -0,0 +1,82 @@
+/*
+ * Self-describing header at the start of each recording
+ */
+
+#ifndef INC_RECORDING_H_
+#define INC_RECORDING_H_
+
+#include <stdint.h>
+
+/*
+ * Every recording starts with this header, followed directly by the data points. It holds everything needed to decode the
+ * data without knowing how the device was configured: a descriptor for each channel with its data type tag, byte order and
+ * scale, and the full settings as text. Its size is a whole number of sectors so the data points that follow stay sector
+ * aligned. All fields are little endian.
+ */
+#define RECORDING_HEADER_MAGIC "IMPK"
+#define RECORDING_HEADER_VERSION 1
+#define RECORDING_HEADER_SIZE 2048
+#define RECORDING_MAX_CHANNELS 4
+#define RECORDING_MAX_EVENTS 256  /* largest event table, 8 sectors */
+
+/* header flags */
+#define RECORDING_SEPARATE_CHANNEL_FILES 0x01  /* the data of each channel is in its own file instead of after the header */
+
+/* channel flags */
+#define RECORDING_CHANNEL_ENABLED 0x01
+#define RECORDING_CHANNEL_BIG_ENDIAN 0x02  /* the 16 bit data values are stored most significant byte first */
+
+typedef struct
+{
+	uint16_t data_type;  /* tag in the data points that belong to this channel */
+	uint8_t flags;
+	uint8_t resolution;  /* bit depth of the sensor, lower resolution values are left justified */
+	uint32_t full_scale;  /* measurement range, +/- this many units */
+	float scale;  /* units per count of the stored 16 bit values */
+	float odr_hz;  /* configured output data rate */
+	char name[8];
+	char unit[8];
+} RecordingChannel;
+
+typedef struct
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;  /* offset of the first data point, can be a little past the end of the header */
+	char firmware_version[16];
+	uint16_t data_point_size;
+	uint8_t channel_count;
+	uint8_t flags;
+	uint16_t settings_offset;  /* settings text, one "id = value" line each */
+	uint16_t settings_len;
+	RecordingChannel channels[RECORDING_MAX_CHANNELS];
+	uint32_t trigger_micros;  /* time stamp of the trigger, data before it is the pre-trigger window. 0 without one */
+	uint32_t trigger_sample;  /* the data point that crossed the threshold, counted from the first one */
+	uint32_t event_count;  /* events in the table, updated in place as each one ends */
+	uint32_t event_capacity;  /* entries reserved for the event table right after the header, 0 if there is none */
+	char settings[RECORDING_HEADER_SIZE - 48 - RECORDING_MAX_CHANNELS * sizeof(RecordingChannel)];
+} RecordingHeader;
+
+/*
+ * Multi-shot recordings hold a series of triggered events back to back, each one from its pre-trigger window to the end of
+ * its recording, with the time stamps all counting from the start of the first window. The table right after the header
+ * has an entry for each event so it can be found without reading through the data. Data point n of the recording is at
+ * header_size + n * data_point_size from the start of the file.
+ */
+typedef struct
+{
+	uint32_t first_point;  /* first data point of the event */
+	uint32_t point_count;
+	uint32_t trigger_micros;  /* time stamp of the trigger */
+	uint32_t trigger_point;  /* the data point that set off the trigger */
+} RecordingEvent;
+
+void RecordingHeader_Init(RecordingHeader* header, uint16_t data_point_size, const char* firmware_version);
+void RecordingHeader_SetChannel(RecordingHeader* header, uint8_t channel, uint16_t data_type, const char* name, const char* unit,
+								uint8_t flags, uint8_t resolution, uint32_t full_scale, float odr_hz);
+void RecordingHeader_SetSettingsLength(RecordingHeader* header, uint32_t settings_len);  /* call after writing the text into the settings field */
+
+uint8_t RecordingHeader_IsValid(const RecordingHeader* header);  /* check a header read back from a recording */
+const RecordingChannel* RecordingHeader_FindChannel(const RecordingHeader* header, uint16_t data_type);  /* returns NULL if there is no such channel */
+
+#endif /* INC_RECORDING_H_ */
@@ -31,6 +31,7 @@ typedef struct
 
 	/* function to convert data to physical units */
 	void (*process_data)(uint8_t* raw_data, float units_per_bit, float* data_x, float* data_y, float* data_z);
+	void (*process_data_raw)(uint8_t* raw_data, int16_t* data_x, int16_t* data_y, int16_t* data_z);  /* signed counts, for integer processing */
 
 	/* registers for enabling and disabling the sensor */
 	uint8_t enable_reg, enable_data;
@@ -38,12 +39,49 @@ typedef struct
 
 } SPISensor;
 
+/*
+ * Register writes queued up for sending in the background. Writes to consecutive registers of a sensor are joined into one
+ * burst under a single chip select (the sensors auto-increment the address), and each burst goes out by DMA. The two SPI
+ * buses work through their own bursts in order at the same time, started from the transmit complete interrupt.
+ */
+#define SPI_SEQUENCE_MAX_BURSTS 32
+#define SPI_SEQUENCE_MAX_BYTES 96
+#define SPI_SEQUENCE_MAX_BUSES 2
+
+typedef struct
+{
+	SPISensor* sensor;
+	uint8_t start;  /* index of the address byte in the sequence bytes */
+	uint8_t len;  /* address byte and the data bytes */
+	uint8_t last_reg;  /* register of the last data byte */
+} SPIBurst;
+
+typedef struct
+{
+	SPIBurst bursts[SPI_SEQUENCE_MAX_BURSTS];
+	uint8_t bytes[SPI_SEQUENCE_MAX_BYTES];
+	uint8_t burst_count;
+	uint8_t byte_count;
+
+	/* progress of each bus while the sequence is sent */
+	SPI_HandleTypeDef* bus[SPI_SEQUENCE_MAX_BUSES];
+	volatile int8_t current[SPI_SEQUENCE_MAX_BUSES];  /* burst being sent, -1 once the bus is done */
+	volatile uint8_t error_count;
+} SPISequence;
+
 uint8_t SPISensor_TestCommunication(SPISensor* sensor, uint8_t reg, uint8_t data);  /* verify communication by reading a register for the expected data (e.g. WHO_AM_I) */
 uint8_t SPISensor_WriteMultiple(SPISensor* sensor, const uint8_t* reg, const uint8_t* data, uint8_t size);  /* write a sequence of data to a sequence of device registers */
 
 HAL_StatusTypeDef SPISensor_ReadRegister(SPISensor* sensor, uint8_t reg, uint8_t* data);
 HAL_StatusTypeDef SPISensor_WriteRegister(SPISensor* sensor, uint8_t reg, uint8_t data);
 
+void SPISequence_Init(SPISequence* sequence);
+uint8_t SPISequence_Add(SPISequence* sequence, SPISensor* sensor, const uint8_t* reg, const uint8_t* data, uint8_t size);  /* returns false if it doesn't fit */
+void SPISequence_Start(SPISequence* sequence);
+void SPISequence_TransmitComplete(SPISequence* sequence, SPI_HandleTypeDef* spi, uint8_t error);  /* call from the SPI transmit complete and error callbacks */
+uint8_t SPISequence_IsDone(SPISequence* sequence);
+uint8_t SPISequence_Wait(SPISequence* sequence, volatile uint32_t* time_micros_ptr, uint32_t timeout_micros);  /* returns the number of errors like SPISensor_WriteMultiple */
+
 HAL_StatusTypeDef SPISensor_Enable(SPISensor* sensor);
 HAL_StatusTypeDef SPISensor_Disable(SPISensor* sensor);
 
@@ -10,8 +10,13 @@
 
 #define CHAR_BUF_LEN 128
 #define SETTING_DELIMITER '='
-#define SETTING_ID_MAX_LEN 64
-#define MAX_ALLOWED_SETTING_VALUES 32
+#define SETTING_MAX_COUNT 64  /* most settings in one schema */
+#define SETTING_HASH_LEN 256  /* slots in the id hash table, a few times the number of settings so a perfect seed is quick to find */
+#define SETTING_HASH_MAX_SEEDS 1024
+#define SETTING_READ_LEN 512  /* settings file is read in blocks of this size */
+#define SETTING_MAX_ERRORS 8  /* bad lines kept in the parse report */
+#define SETTING_MAX_PROFILES 4  /* named profiles after the base settings */
+#define SETTING_PROFILE_NAME_LEN 12  /* including the terminator */
 
 #include <stdint.h>
 #include <stdio.h>
@@ -20,158 +25,495 @@
 
 
 
+typedef enum
+{
+	SETTING_BOOL,  /* 0 or 1 */
+	SETTING_INT,  /* any value from min to max */
+	SETTING_CHOICE  /* one of a list of values */
+} SettingType;
+
+/*
+ * Description of a setting, kept in flash. The current values live in a separate array of int32_t with the same
+ * indices, so the application can read them directly with an enum instead of looking them up by id.
+ */
 typedef struct
 {
-	char id[SETTING_ID_MAX_LEN];
-	int32_t value;
-	int32_t allowed_values[MAX_ALLOWED_SETTING_VALUES];
-	uint32_t allowed_values_count;
-} Setting;
+	const char* id;
+	uint8_t type;  /* SettingType */
+	int32_t default_value;
+	int32_t min, max;
+	const int32_t* choices;
+	uint32_t choice_count;
+} SettingSchema;
+
+#define SETTING_SCHEMA_BOOL(id, default_value) {id, SETTING_BOOL, default_value, 0, 1, NULL, 0}
+#define SETTING_SCHEMA_INT(id, default_value, min, max) {id, SETTING_INT, default_value, min, max, NULL, 0}
+#define SETTING_SCHEMA_CHOICE(id, default_value, ...) {id, SETTING_CHOICE, default_value, 0, 0, (const int32_t[]){__VA_ARGS__}, sizeof((const int32_t[]){__VA_ARGS__}) / sizeof(int32_t)}
+
+/* outcome of parsing a line of the settings file */
+typedef enum
+{
+	SETTING_OK,
+	SETTING_BLANK,  /* empty or comment line */
+	SETTING_ERROR_SYNTAX,  /* not "id = number", or the number doesn't fit in 32 bits */
+	SETTING_ERROR_UNKNOWN_ID,
+	SETTING_ERROR_NOT_ALLOWED,  /* value out of range or not in the list of choices */
+	SETTING_ERROR_DUPLICATE,  /* setting already given on an earlier line */
+	SETTING_ERROR_LINE_TOO_LONG,
+	SETTING_PROFILE,  /* "[name]" line starting a profile */
+	SETTING_ERROR_PROFILE,  /* bad, repeated or one too many profile names */
+	SETTING_ERROR_SKIPPED  /* line in a profile that was skipped */
+} SettingResult;
 
+typedef struct
+{
+	uint32_t line;  /* counting from 1 */
+	uint8_t error;  /* SettingResult */
+} SettingLineError;
 
+typedef struct
+{
+	uint32_t line_count;
+	uint32_t error_count;  /* bad lines, only the first SETTING_MAX_ERRORS are kept */
+	SettingLineError errors[SETTING_MAX_ERRORS];
+	uint32_t missing_count;  /* settings not in the file, these keep their default values */
+} SettingParseReport;
 
-uint8_t Setting_Parse(Setting* setting, char* file_name)
+/*
+ * Profiles are sections of the settings file starting with a "[name]" line. The lines before the first one are the base
+ * settings, and each profile starts from those and changes whichever settings it lists.
+ */
+typedef struct
 {
-	/* open the settings file and check it for the desired setting (might be more efficient ways of doing this) */
-	/* returns true if setting is successfully parsed else false */
-	FIL fil;
-	if (f_open(&fil, file_name, FA_READ) != FR_OK) {return 0;}
+	uint32_t count;
+	char names[SETTING_MAX_PROFILES][SETTING_PROFILE_NAME_LEN];
+	int32_t* values;  /* SETTING_MAX_PROFILES rows of one value per setting, provided by the caller */
+} SettingProfiles;
+
+
 
-	uint8_t setting_parsed = 0;
-	char buf[CHAR_BUF_LEN];
-	while (!f_eof(&fil))
+uint32_t Setting_Hash(const char* id, uint32_t len, uint32_t seed)
+{
+	/* FNV-1a with a seed, plus a final mix so the low bits used for the table slot depend on the whole id */
+	uint32_t hash = 2166136261u ^ seed;
+	for (uint32_t i = 0; i < len; i++)
 	{
-		/* read the next line (until \n reached) */
-		f_gets(buf, CHAR_BUF_LEN, &fil);
+		hash ^= (uint8_t)id[i];
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 15;
+	hash *= 0x2C1B3C6Du;
+	hash ^= hash >> 12;
+	return hash;
+}
+
+uint8_t Setting_BuildHashTable(const SettingSchema* schema, uint32_t count, uint8_t* table, uint32_t* seed)
+{
+	/* find a seed that puts every id in its own slot, the table holds the index into the schema plus one and 0 for an empty slot */
+	/* returns false if there is no such seed, in which case ids have to be looked up one by one */
+	if (count >= 255) {return 0;}
 
-		/* check if the line starts with the setting identifier */
-		if (strncmp(setting->id, buf, strlen(setting->id)) == 0)
+	for (*seed = 0; *seed < SETTING_HASH_MAX_SEEDS; (*seed)++)
+	{
+		memset(table, 0, SETTING_HASH_LEN);
+		uint8_t collision = 0;
+		for (uint32_t i = 0; i < count && !collision; i++)
 		{
-			/* the setting has been found so get the string after the equal sign */
-			char* sep = strchr(buf, SETTING_DELIMITER);
-			if (sep != NULL)
-			{
-				/* sep gives a string starting with the equal sign so increment the pointer when parsing the number */
-				/* atoi will ignore any trailing non-number characters */
-				/* atoi will return zero for an invalid string so we won't be able to distinguish between a setting with 0 value and a formatting error */
-				int32_t value = atoi(sep + 1);
+			uint32_t slot = Setting_Hash(schema[i].id, strlen(schema[i].id), *seed) % SETTING_HASH_LEN;
+			if (table[slot]) {collision = 1;}
+			table[slot] = i + 1;
+		}
+		if (!collision) {return 1;}
+	}
 
-				if (setting->allowed_values_count > 0)
-				{
-					/* check that this value is allowed for the setting */
-					uint8_t value_allowed = 0;
-					for (uint32_t i = 0; i < setting->allowed_values_count; i++)
-					{
-						if (value == setting->allowed_values[i])
-						{
-							value_allowed = 1;
-							break;
-						}
-					}
-
-					if (value_allowed)
-					{
-						setting->value = value;
-						setting_parsed = 1;
-						break;
-					}
-				}
-				else
-				{
-					/* any value is allowed */
-					setting->value = value;
-					setting_parsed = 1;
-					break;
-				}
-			}
+	return 0;
+}
+
+uint8_t Setting_Find(const SettingSchema* schema, uint32_t count, const uint8_t* table, uint32_t seed, const char* id, uint32_t id_len, uint32_t* index)
+{
+	/* look up an id that isn't null terminated, with the hash table if there is one or else one by one */
+	/* returns true and the index into the schema if the id is known */
+	uint32_t first = 0;
+	uint32_t last = count;
+	if (table != NULL)
+	{
+		uint32_t slot = table[Setting_Hash(id, id_len, seed) % SETTING_HASH_LEN];
+		if (slot == 0) {return 0;}
+		first = slot - 1;
+		last = slot;
+	}
+
+	for (uint32_t i = first; i < last; i++)
+	{
+		if (strlen(schema[i].id) == id_len && strncmp(schema[i].id, id, id_len) == 0)
+		{
+			*index = i;
+			return 1;
 		}
 	}
 
-	f_close(&fil);
+	return 0;
+}
+
+uint8_t Setting_IsAllowed(const SettingSchema* setting, int32_t value)
+{
+	if (setting->type != SETTING_CHOICE) {return value >= setting->min && value <= setting->max;}
+
+	for (uint32_t i = 0; i < setting->choice_count; i++)
+	{
+		if (value == setting->choices[i]) {return 1;}
+	}
 
-	return setting_parsed;
+	return 0;
 }
 
-uint8_t Setting_Write(Setting* setting, char* file_name, char* comment , uint8_t newline)
+void Setting_SetDefaults(const SettingSchema* schema, int32_t* values, uint32_t count)
 {
-	/* open the file and append a line for this setting, with preceding or trailing comments */
-	/* returns true if setting is successfully written else false */
-	FIL fil;
-	if (f_open(&fil, file_name, FA_OPEN_APPEND | FA_WRITE) != FR_OK) {return 0;}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		values[i] = schema[i].default_value;
+	}
+}
 
-	char buf[CHAR_BUF_LEN];
+uint32_t Setting_SchemaHash(const SettingSchema* schema, uint32_t count)
+{
+	/* changes whenever a setting is added, removed, renamed or given different limits, so stored values can be checked against it */
+	uint32_t hash = count;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		int32_t limits[4] = {schema[i].type, schema[i].default_value, schema[i].min, schema[i].max};
+		hash = Setting_Hash(schema[i].id, strlen(schema[i].id), hash);
+		hash = Setting_Hash((const char*)limits, sizeof(limits), hash);
+		if (schema[i].choices) {hash = Setting_Hash((const char*)schema[i].choices, schema[i].choice_count * sizeof(int32_t), hash);}
+	}
+	return hash;
+}
 
-	/* write a comment in the previous line */
-	if (comment[0] != '\0')
+uint8_t Setting_ParseLine(char* line, char** id, uint32_t* id_len, int32_t* value)
+{
+	/* split "id = value  # comment" into the id and the number, returns SETTING_OK for a setting line, SETTING_BLANK for a */
+	/* comment or blank line and otherwise the error */
+	char* c = line;
+	while (*c == ' ' || *c == '\t') {c++;}
+	if (*c == '\0' || *c == '#' || *c == '\r') {return SETTING_BLANK;}
+
+	/* "[name]" starts a profile, the name is returned as the id */
+	if (*c == '[')
 	{
-		snprintf(buf, CHAR_BUF_LEN, "# %s\n", comment);
-		f_puts(buf, &fil);
+		*id = ++c;
+		while ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '-') {c++;}
+		*id_len = c - *id;
+		if (*c != ']' || *id_len == 0 || *id_len >= SETTING_PROFILE_NAME_LEN) {return SETTING_ERROR_PROFILE;}
+		c++;
+		while (*c == ' ' || *c == '\t' || *c == '\r') {c++;}
+		return (*c == '\0' || *c == '#') ? SETTING_PROFILE : SETTING_ERROR_SYNTAX;
 	}
 
-	/* write the setting line */
-	snprintf(buf, CHAR_BUF_LEN, "%s = %ld\n", setting->id, setting->value);
-	f_puts(buf, &fil);
+	/* the id runs up to white space or the delimiter */
+	*id = c;
+	while (*c != '\0' && *c != ' ' && *c != '\t' && *c != SETTING_DELIMITER && *c != '#' && *c != '\r') {c++;}
+	*id_len = c - *id;
+
+	while (*c == ' ' || *c == '\t') {c++;}
+	if (*c != SETTING_DELIMITER) {return SETTING_ERROR_SYNTAX;}
+	c++;
+	while (*c == ' ' || *c == '\t') {c++;}
+
+	/* signed decimal number that fits in 32 bits */
+	uint8_t negative = 0;
+	if (*c == '-' || *c == '+') {negative = (*c == '-'); c++;}
+	if (*c < '0' || *c > '9') {return SETTING_ERROR_SYNTAX;}
+	int64_t number = 0;
+	while (*c >= '0' && *c <= '9')
+	{
+		number = 10 * number + (*c - '0');
+		if (number > (int64_t)INT32_MAX + negative) {return SETTING_ERROR_SYNTAX;}
+		c++;
+	}
+	*value = negative ? (int32_t)(-number) : (int32_t)number;
 
-	/* create an extra newline if specified */
-	if (newline) {f_puts("\n", &fil);}
+	/* only white space or a comment may follow */
+	while (*c == ' ' || *c == '\t' || *c == '\r') {c++;}
+	if (*c != '\0' && *c != '#') {return SETTING_ERROR_SYNTAX;}
 
-	/* close the file */
-	f_close(&fil);
+	return SETTING_OK;
+}
 
+int32_t Setting_FindProfile(SettingProfiles* profiles, const char* name, uint32_t name_len)
+{
+	/* returns the index of the profile or -1 if there is none with that name */
+	for (uint32_t i = 0; i < profiles->count; i++)
+	{
+		if (strlen(profiles->names[i]) == name_len && strncmp(profiles->names[i], name, name_len) == 0) {return i;}
+	}
+
+	return -1;
+}
+
+uint8_t Setting_AddProfile(SettingProfiles* profiles, const char* name, uint32_t name_len)
+{
+	/* returns true if the name is new and there is room for it */
+	if (profiles->count >= SETTING_MAX_PROFILES || Setting_FindProfile(profiles, name, name_len) >= 0) {return 0;}
+
+	memcpy(profiles->names[profiles->count], name, name_len);
+	profiles->names[profiles->count][name_len] = '\0';
+	profiles->count++;
 	return 1;
 }
 
+uint8_t Setting_CheckLine(const SettingSchema* schema, uint32_t count, const uint8_t* table, uint32_t seed, uint32_t* found, char* line, uint32_t* index, int32_t* value)
+{
+	/* parse a line and check it against the schema, marking the setting as found if the line is good */
+	/* the table is NULL to look ids up one by one, found has a bit for each setting */
+	/* for a profile line the name is at line + index and value characters long */
+	char* id;
+	uint32_t id_len;
+	uint8_t result = Setting_ParseLine(line, &id, &id_len, value);
+	if (result == SETTING_PROFILE) {*index = id - line; *value = id_len;}  /* where the name is in the line */
+	if (result != SETTING_OK) {return result;}
+
+	/* the table gives the only candidate and the full id is compared so prefixes don't match */
+	if (!Setting_Find(schema, count, table, seed, id, id_len, index)) {return SETTING_ERROR_UNKNOWN_ID;}
+	if (found[*index / 32] & (1u << (*index % 32))) {return SETTING_ERROR_DUPLICATE;}  /* the first one counts */
+	if (!Setting_IsAllowed(&schema[*index], *value)) {return SETTING_ERROR_NOT_ALLOWED;}
+
+	found[*index / 32] |= 1u << (*index % 32);
+	return SETTING_OK;
+}
 
-Setting* Setting_GetById(Setting* setting_array, uint32_t array_size, char* id)
+uint8_t Setting_ParseArray(const SettingSchema* schema, int32_t* values, uint32_t count, char* file_name, SettingParseReport* report, SettingProfiles* profiles)
 {
-	Setting* setting_ptr = NULL;
+	/* read the settings file once, a block at a time, and look up the id of each line in a hash table of the known ids */
+	/* the base settings go in values and any profiles in profiles, which can be NULL to treat them as errors */
+	/* returns true if every setting in the schema was found with an allowed value and there were no bad lines */
+	memset(report, 0, sizeof(SettingParseReport));
+	report->missing_count = count;
+	if (profiles != NULL) {profiles->count = 0;}
+	if (count > SETTING_MAX_COUNT) {return 0;}
 
-	for (uint32_t i = 0; i < array_size; i++)
+	FIL fil;
+	if (f_open(&fil, file_name, FA_READ) != FR_OK) {return 0;}
+
+	uint8_t table[SETTING_HASH_LEN];
+	uint32_t seed;
+	uint8_t use_table = Setting_BuildHashTable(schema, count, table, &seed);
+	uint32_t found[(SETTING_MAX_COUNT + 31) / 32] = {0};
+	uint32_t profile_found[(SETTING_MAX_COUNT + 31) / 32];
+	int32_t* profile_values = NULL;  /* profile the lines go to, NULL for the base settings */
+	uint8_t skipping = 0;  /* in a profile that couldn't be added */
+
+	char block[SETTING_READ_LEN];
+	char line[CHAR_BUF_LEN];
+	uint32_t line_len = 0;
+	uint8_t line_too_long = 0;
+	UINT read_count = 0;
+	uint8_t end_of_file = 0;
+	while (!end_of_file)
 	{
-		if (strcmp(setting_array[i].id, id) == 0)
+		if (f_read(&fil, block, sizeof(block), &read_count) != FR_OK) {read_count = 0;}
+		end_of_file = read_count < sizeof(block);
+		if (end_of_file && (read_count > 0 ? block[read_count - 1] != '\n' : line_len > 0 || line_too_long)) {block[read_count++] = '\n';}  /* last line without a newline */
+
+		for (uint32_t k = 0; k < read_count; k++)
 		{
-			setting_ptr = &setting_array[i];
-			break;
+			/* gather characters until the end of the line */
+			if (block[k] != '\n')
+			{
+				if (line_len < CHAR_BUF_LEN - 1) {line[line_len++] = block[k];}
+				else {line_too_long = 1;}
+				continue;
+			}
+			line[line_len] = '\0';
+			report->line_count++;
+
+			uint32_t index;
+			int32_t value;
+			uint8_t result = line_too_long ? SETTING_ERROR_LINE_TOO_LONG :
+							 Setting_CheckLine(schema, count, use_table ? table : NULL, seed, profile_values ? profile_found : found, line, &index, &value);
+			line_len = 0;
+			line_too_long = 0;
+			if (result == SETTING_BLANK || (skipping && result != SETTING_PROFILE && result != SETTING_ERROR_PROFILE)) {continue;}
+
+			if (result == SETTING_PROFILE)
+			{
+				/* the profile starts from the base settings, which are complete by now */
+				skipping = profiles == NULL || !Setting_AddProfile(profiles, line + index, value);
+				if (skipping) {result = SETTING_ERROR_PROFILE;}
+				else
+				{
+					profile_values = profiles->values + (profiles->count - 1) * count;
+					memcpy(profile_values, values, count * sizeof(int32_t));
+					memset(profile_found, 0, sizeof(profile_found));
+					continue;
+				}
+			}
+			if (result == SETTING_ERROR_PROFILE) {skipping = 1;}
+
+			if (result == SETTING_OK && profile_values != NULL)
+			{
+				profile_values[index] = value;
+			}
+			else if (result == SETTING_OK)
+			{
+				values[index] = value;
+				report->missing_count--;
+			}
+			else
+			{
+				/* keep the first few errors with their line numbers, the default value stays in place */
+				if (report->error_count < SETTING_MAX_ERRORS)
+				{
+					report->errors[report->error_count].line = report->line_count;
+					report->errors[report->error_count].error = result;
+				}
+				report->error_count++;
+			}
 		}
 	}
 
-	return setting_ptr;
+	f_close(&fil);
+
+	return report->error_count == 0 && report->missing_count == 0;
 }
 
-uint8_t Setting_ParseArray(Setting* setting_array, uint32_t array_size, char* file_name)
+uint32_t Setting_FormatArray(const SettingSchema* schema, const int32_t* values, uint32_t count, char* buf, uint32_t buf_len)
 {
-	/* try to parse each setting in the array from the file */
-	/* returns true if all of the settings in the array are successfully parsed */
-	uint8_t settings_parsed = 1;
+	/* write a line for each setting into a text buffer, returns the number of characters written */
+	uint32_t len = 0;
+	buf[0] = '\0';
 
-	for (uint32_t i = 0; i < array_size; i++)
+	for (uint32_t i = 0; i < count; i++)
 	{
-		if (!Setting_Parse(&setting_array[i], file_name))
+		int n = snprintf(buf + len, buf_len - len, "%s = %ld\n", schema[i].id, values[i]);
+		if (n < 0 || len + n >= buf_len)
 		{
-			/* note the error, but continue parsing what we can */
-			settings_parsed = 0;
+			/* out of space, drop the partial line */
+			buf[len] = '\0';
+			break;
 		}
+		len += n;
 	}
 
-	return settings_parsed;
+	return len;
 }
 
-uint8_t Setting_WriteArray(Setting* setting_array, uint32_t array_size, char* file_name)
+uint8_t Setting_FormatMissing(const SettingSchema* schema, const int32_t* values, uint32_t count, const uint32_t* found, char* buf, uint32_t* len, uint32_t buf_len)
 {
-	/* rewrite the settings file from the values in the settings array */
+	/* add a line for each setting that wasn't found, returns false if they don't fit */
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (found[i / 32] & (1u << (i % 32))) {continue;}
+		int n = snprintf(buf + *len, buf_len - *len, "%s = %ld\n", schema[i].id, values[i]);
+		if (n < 0 || *len + n >= buf_len) {return 0;}
+		*len += n;
+	}
+
+	return 1;
+}
+
+uint8_t Setting_RewriteFile(const SettingSchema* schema, const int32_t* values, uint32_t count, char* file_name, char* work, uint32_t work_len)
+{
+	/*
+	 * Fix up the settings file after a parse that found problems, keeping the user's comments and good lines as they are.
+	 * Bad lines are commented out with the reason, and the base settings that are missing are added with their current
+	 * values at the end of the base section, before the first profile. The old file is read into the first half of the
+	 * work memory and the new one is built in the second half, so it goes to the card in a single write. A file too big
+	 * for that is replaced by a plain list of the base settings. Returns true if the file was written.
+	 */
+	static const char* const reasons[] = {"", "", "syntax error", "unknown setting", "value not allowed", "repeated", "line too long",
+										  "", "bad or extra profile", "in a skipped profile"};
+	uint32_t half = work_len / 2;
+	char* old_text = work;
+	char* new_text = work + half;
+	uint32_t old_len = 0;
+	uint32_t new_len = 0;
+	uint32_t found[(SETTING_MAX_COUNT + 31) / 32] = {0};
+	uint32_t profile_found[(SETTING_MAX_COUNT + 31) / 32];
+	SettingProfiles profiles = {0};  /* only the names are needed */
+	uint8_t in_profile = 0;
+	uint8_t skipping = 0;
+	if (count > SETTING_MAX_COUNT) {return 0;}
+
+	/* read the old file, a missing one is just empty */
 	FIL fil;
-	if (f_open(&fil, file_name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {return 0;}  /* overwrite (and clear) the existing settings file */
-	f_close(&fil);
+	if (f_open(&fil, file_name, FA_READ) == FR_OK)
+	{
+		UINT read_count = 0;
+		if (f_size(&fil) >= half || f_read(&fil, old_text, half, &read_count) != FR_OK) {read_count = 0;}
+		old_len = read_count;
+		f_close(&fil);
+	}
 
-	for (uint32_t i = 0; i < array_size; i++)
+	/* go through the old lines, only the bad ones change */
+	char line[CHAR_BUF_LEN];
+	uint32_t start = 0;
+	while (start < old_len)
 	{
-		if (!Setting_Write(&setting_array[i], file_name, "", 0))
+		uint32_t end = start;
+		while (end < old_len && old_text[end] != '\n') {end++;}
+		uint32_t line_len = end - start;
+		if (line_len > 0 && old_text[end - 1] == '\r') {line_len--;}
+
+		uint32_t index;
+		int32_t value;
+		uint8_t result = SETTING_ERROR_LINE_TOO_LONG;
+		if (line_len < CHAR_BUF_LEN)
+		{
+			memcpy(line, old_text + start, line_len);
+			line[line_len] = '\0';
+			result = Setting_CheckLine(schema, count, NULL, 0, in_profile ? profile_found : found, line, &index, &value);
+		}
+
+		/* the base settings end at the first profile, so that is where the missing ones go */
+		uint8_t missing_fit = 1;
+		if ((result == SETTING_PROFILE || result == SETTING_ERROR_PROFILE) && !in_profile)
 		{
-			/* failed to write the settings file */
-			return 0;
+			missing_fit = Setting_FormatMissing(schema, values, count, found, new_text, &new_len, half);
+			in_profile = 1;
 		}
+		if (result == SETTING_PROFILE || result == SETTING_ERROR_PROFILE)
+		{
+			skipping = result == SETTING_ERROR_PROFILE || !Setting_AddProfile(&profiles, line + index, value);
+			if (skipping) {result = SETTING_ERROR_PROFILE;}
+			memset(profile_found, 0, sizeof(profile_found));
+		}
+		else if (skipping && result != SETTING_BLANK)
+		{
+			result = SETTING_ERROR_SKIPPED;
+		}
+
+		int n;
+		if (result == SETTING_OK || result == SETTING_BLANK || result == SETTING_PROFILE)
+		{
+			n = snprintf(new_text + new_len, half - new_len, "%.*s\n", (int)line_len, old_text + start);
+		}
+		else
+		{
+			/* cut it short if needed so the comment still fits on a line */
+			uint32_t keep = CHAR_BUF_LEN - 8 - strlen(reasons[result]);
+			n = snprintf(new_text + new_len, half - new_len, "# %.*s  <- %s\n", (int)(line_len < keep ? line_len : keep), old_text + start, reasons[result]);
+		}
+		if (!missing_fit || n < 0 || new_len + n >= half)
+		{
+			/* out of space, start over with a plain list */
+			memset(found, 0, sizeof(found));
+			new_len = 0;
+			in_profile = 0;
+			break;
+		}
+		new_len += n;
+
+		start = end + 1;
 	}
 
+	/* add what's missing if there were no profiles */
+	if (!in_profile && !Setting_FormatMissing(schema, values, count, found, new_text, &new_len, half)) {return 0;}
+
+	if (f_open(&fil, file_name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {return 0;}
+	UINT write_count = 0;
+	FRESULT fresult = f_write(&fil, new_text, new_len, &write_count);
+	if (f_close(&fil) != FR_OK || fresult != FR_OK || write_count != new_len) {return 0;}
+
 	return 1;
 }
 
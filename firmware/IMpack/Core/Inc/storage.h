@@ -0,0 +1,53 @@
+/*
+ * Persistent file system session on the SD card
+ */
+
+#ifndef INC_STORAGE_H_
+#define INC_STORAGE_H_
+
+#include "main.h"
+#include "fatfs.h"
+
+/* card preparation, the largest cluster size is tried first and halved until the card has enough clusters for FAT32 */
+#define SD_STORAGE_MAX_CLUSTER_SIZE		32768
+#define SD_STORAGE_MIN_CLUSTER_SIZE		4096
+
+/*
+ * Keeps the card mounted between states so the boot sector, FSINFO and FAT window don't have to be re-read each time
+ * we start a recording. The session is only dropped when the card is removed or after a long idle period.
+ */
+typedef struct
+{
+	/* SD card peripheral */
+	SD_HandleTypeDef* hsd;
+
+	/* card detect pin, reads low when a card is inserted */
+	GPIO_TypeDef* detect_port;
+	uint16_t detect_pin;
+
+	/* pointer to microsecond time-keeping variable */
+	volatile uint32_t* time_micros_ptr;
+
+	/* file system session */
+	FATFS fs;
+	uint8_t mounted;
+	FRESULT fresult;
+
+	/* idle timeout, zero to stay mounted indefinitely */
+	uint32_t idle_timeout_micros;
+	uint32_t time_last_access;
+
+} SDStorage;
+
+void SDStorage_Init(SDStorage* storage, SD_HandleTypeDef* hsd, GPIO_TypeDef* detect_port, uint16_t detect_pin, volatile uint32_t* time_micros_ptr, uint32_t idle_timeout_micros);
+
+uint8_t SDStorage_Open(SDStorage* storage);  /* mount the card if needed, returns true if the file system is ready */
+void SDStorage_Close(SDStorage* storage);  /* end the session, all files should be closed first */
+void SDStorage_Update(SDStorage* storage);  /* watch for card removal and the idle timeout, only call this while no files are open */
+
+uint8_t SDStorage_CardDetected(SDStorage* storage);
+
+uint8_t SDStorage_Format(SDStorage* storage, void* work, uint32_t work_len, char* marker_file_name);  /* erase the card with a logging friendly layout, returns true on success */
+uint8_t SDStorage_IsPrepared(SDStorage* storage, char* marker_file_name);  /* true if the mounted card still has the layout written by SDStorage_Format */
+
+#endif /* INC_STORAGE_H_ */
@@ -0,0 +1,54 @@
+/*
+ * Acceleration trigger evaluated on the raw sensor data
+ */
+
+#ifndef INC_TRIGGER_H_
+#define INC_TRIGGER_H_
+
+#include <stdint.h>
+
+#define TRIGGER_MAX_CHANNELS 4
+
+/*
+ * The trigger settings are turned into a small state machine when they are applied. The levels are converted to counts
+ * for each channel, along with the byte order and the shift of lower resolution sensors, so updating it with a data point
+ * is a few integer operations on the bytes as they were read. That is cheap enough to do in the timer interrupt for every
+ * data point at the full data rate.
+ *
+ * Each channel compares either its selected axes (any of them crossing counts) or the vector magnitude with its level. A
+ * channel becomes active when it crosses the level and stays active until it is back past the release level, which is
+ * closer to zero by the hysteresis. Once a channel has been active for the minimum duration it has met its condition, and
+ * the trigger fires when any channel has, or all of the channels that take part have at the same time.
+ */
+typedef struct
+{
+	uint8_t axes;  /* bit mask of the axes compared with the level, 0 if the channel doesn't take part */
+	uint8_t big_endian;  /* 16 bit values stored most significant byte first */
+	uint8_t shift;  /* lower resolution values are left justified, shifted down to counts */
+	uint32_t level;  /* in counts, or counts squared for the magnitude */
+	uint32_t release;  /* level the channel has to be back past to stop being active */
+
+	/* state while armed */
+	uint8_t active;  /* past the level and not yet back past the release level */
+	uint8_t met;  /* active for at least the minimum duration */
+	uint32_t active_since_micros;
+} TriggerChannel;
+
+typedef struct
+{
+	TriggerChannel channels[TRIGGER_MAX_CHANNELS];
+	uint8_t rising;  /* fire when above the level, otherwise below it */
+	uint8_t magnitude;  /* compare the vector magnitude instead of the axes */
+	uint8_t all_channels;  /* every channel that takes part has to meet its condition at once, otherwise any of them */
+	uint8_t hysteresis_percent;  /* of the level */
+	uint32_t min_duration_micros;
+	uint8_t channel_count;  /* channels that take part */
+	uint8_t met_count;  /* channels that have met their condition */
+} Trigger;
+
+void Trigger_Init(Trigger* trigger, uint8_t rising, uint8_t magnitude, uint8_t all_channels, uint8_t hysteresis_percent, uint32_t min_duration_micros);
+void Trigger_SetChannel(Trigger* trigger, uint8_t channel, uint8_t axes, uint32_t level_milli, uint32_t full_scale, uint8_t resolution, uint8_t big_endian);  /* level in thousandths of the unit of the +/- full_scale range */
+void Trigger_Reset(Trigger* trigger);  /* clear the state before arming */
+uint8_t Trigger_Update(Trigger* trigger, uint8_t channel, const uint8_t* raw_data, uint32_t time_micros);  /* true once this data point sets off the trigger */
+
+#endif /* INC_TRIGGER_H_ */
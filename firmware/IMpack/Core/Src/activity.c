@@ -0,0 +1,66 @@
+/*
+ * Motion detector that ends a recording once it has settled
+ */
+
+#include "activity.h"
+#include <string.h>
+
+void Activity_Init(Activity* activity)
+{
+	memset(activity, 0, sizeof(Activity));
+}
+
+void Activity_SetChannel(Activity* activity, uint8_t channel, uint32_t level_milli, uint32_t full_scale, uint8_t resolution, uint8_t big_endian,
+						 float odr_hz, uint32_t average_micros)
+{
+	ActivityChannel* c = &(activity->channels[channel]);
+	c->enabled = 1;
+	c->big_endian = big_endian;
+	c->shift = 16 - resolution;
+
+	/* motion is anything further than the level from the average, rounded down so whole counts compare exactly */
+	uint64_t level = ((uint64_t)level_milli << (resolution - 1)) / (1000 * (uint64_t)full_scale);
+	c->level = level < UINT32_MAX ? (uint32_t)level : UINT32_MAX;
+
+	/* the largest power of two weight that is no more data points than the averaging time */
+	float samples = odr_hz * 0.000001f * (float)average_micros;
+	c->average_shift = 0;
+	while (c->average_shift < 15 && (float)(2 << c->average_shift) <= samples) {c->average_shift++;}
+}
+
+void Activity_Reset(Activity* activity, uint32_t time_micros)
+{
+	for (uint8_t i = 0; i < ACTIVITY_MAX_CHANNELS; i++)
+		activity->channels[i].started = 0;
+	activity->last_motion_micros = time_micros;
+}
+
+void Activity_Update(Activity* activity, uint8_t channel, const uint8_t* raw_data, uint32_t time_micros)
+{
+	ActivityChannel* c = &(activity->channels[channel]);
+	if (!c->enabled) {return;}
+
+	uint8_t motion = 0;
+	for (uint8_t k = 0; k < 3; k++)
+	{
+		uint16_t bytes = c->big_endian ? (raw_data[2 * k] << 8) | raw_data[2 * k + 1] : raw_data[2 * k] | (raw_data[2 * k + 1] << 8);
+		int32_t counts = (int16_t)bytes >> c->shift;
+		int32_t value = counts << ACTIVITY_AVERAGE_BITS;
+		if (!c->started) {c->average[k] = value;}
+
+		int32_t difference = value - c->average[k];
+		uint32_t distance = (difference < 0 ? -difference : difference) >> ACTIVITY_AVERAGE_BITS;
+		if (distance > c->level) {motion = 1;}
+		c->average[k] += difference >> c->average_shift;
+	}
+	c->started = 1;
+
+	if (motion) {activity->last_motion_micros = time_micros;}
+}
+
+uint8_t Activity_IsSettled(const Activity* activity, uint32_t time_micros, uint32_t hold_micros)
+{
+	/* the interrupt can note motion after time_micros was read, which isn't quiet time either */
+	int32_t quiet_micros = (int32_t)(time_micros - activity->last_motion_micros);
+	return quiet_micros > 0 && (uint32_t)quiet_micros > hold_micros;
+}
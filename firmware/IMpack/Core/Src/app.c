@@ -16,72 +16,190 @@
 #include "led.h"
 #include "sensor.h"
 #include "setting.h"
+#include "storage.h"
+#include "csv.h"
+#include "converter.h"
+#include "recording.h"
+#include "budget.h"
+#include "flashstore.h"
+#include "trigger.h"
+#include "activity.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <math.h>
 
 #define NUMEL(arr) (sizeof(arr) / sizeof(arr[0]))
 
-/* user settings */
-Setting settings_array[] =
+/* user settings, the schema is in flash and the current values are indexed by the same enum */
+typedef enum
+{
+	SET_LSM6DSx_ACCEL_EN,
+	SET_LSM6DSx_ACCEL_ODR,
+	SET_LSM6DSx_ACCEL_RANGE,
+	SET_LSM6DSx_ACCEL_LPF,
+	SET_LSM6DSx_ACCEL_OFSX,
+	SET_LSM6DSx_ACCEL_OFSY,
+	SET_LSM6DSx_ACCEL_OFSZ,
+
+	SET_LSM6DSx_GYRO_EN,
+	SET_LSM6DSx_GYRO_ODR,
+	SET_LSM6DSx_GYRO_RANGE,
+	SET_LSM6DSx_GYRO_LPF,
+
+	SET_IIS3DWB_ACCEL_EN,
+	SET_IIS3DWB_ACCEL_RANGE,
+	SET_IIS3DWB_ACCEL_LPF,
+	SET_IIS3DWB_ACCEL_OFSX,
+	SET_IIS3DWB_ACCEL_OFSY,
+	SET_IIS3DWB_ACCEL_OFSZ,
+
+	SET_ADXL37x_ACCEL_EN,
+	SET_ADXL37x_ACCEL_ODR,
+	SET_ADXL37x_ACCEL_LPF,
+	SET_ADXL37x_ACCEL_OFSX,
+	SET_ADXL37x_ACCEL_OFSY,
+	SET_ADXL37x_ACCEL_OFSZ,
+
+	SET_DELAY_BEFORE_ARMED,
+	SET_RECORDING_LENGTH,
+	SET_FORMAT_DATA_EN,
+	SET_COMMIT_INTERVAL,
+	SET_RAW_LOGGING_EN,
+	SET_RAW_REGION_SIZE,
+	SET_CHANNEL_FILES_EN,
+	SET_ACCEL_TRIGGER_EN,
+	SET_ACCEL_TRIGGER_ANY_AXIS,
+	SET_ACCEL_TRIGGER_AXIS,
+	SET_ACCEL_TRIGGER_LEVEL,
+	SET_ACCEL_TRIGGER_EDGE,
+	SET_TRIGGER_MAGNITUDE,
+	SET_LSM6DSx_ACCEL_TRIGGER,
+	SET_LSM6DSx_GYRO_TRIGGER,
+	SET_IIS3DWB_ACCEL_TRIGGER,
+	SET_ADXL37x_ACCEL_TRIGGER,
+	SET_TRIGGER_HYSTERESIS,
+	SET_TRIGGER_MIN_DURATION,
+	SET_TRIGGER_ALL_CHANNELS,
+	SET_PRETRIGGER,
+	SET_AUTO_STOP_EN,
+	SET_AUTO_STOP_LEVEL,
+	SET_AUTO_STOP_HOLD,
+	SET_AUTO_STOP_REARM,
+	SET_MULTI_SHOT_EN,
+	SET_MULTI_SHOT_EVENTS,
+	SET_CARD_WRITE_SPEED,
+	SET_CARD_WRITE_LATENCY,
+	SET_COUNT
+} SettingIndex;
+
+const SettingSchema settings_schema[SET_COUNT] =
 {
-		{SETTING_LSM6DSx_ACCEL_EN_ID, 1, {0, 1}, 2},
-		{SETTING_LSM6DSx_ACCEL_ODR_ID, 6660, {13, 26, 52, 104, 208, 416, 833, 1660, 3330, 6660}, 10},
-		{SETTING_LSM6DSx_ACCEL_RANGE_ID, 32, {4, 8, 16, 32}, 4},
-		{SETTING_LSM6DSx_ACCEL_LPF_ID, 2, {2, 4, 10, 20, 45, 100, 200, 400, 800}, 9},
-		{SETTING_LSM6DSx_ACCEL_OFSX_ID, 0, {}, 0},
-		{SETTING_LSM6DSx_ACCEL_OFSY_ID, 0, {}, 0},
-		{SETTING_LSM6DSx_ACCEL_OFSZ_ID, 0, {}, 0},
-
-		{SETTING_LSM6DSx_GYRO_EN_ID, 1, {0, 1}, 2},
-		{SETTING_LSM6DSx_GYRO_ODR_ID, 6660, {13, 26, 52, 104, 208, 416, 833, 1660, 3330, 6660}, 10},
-		{SETTING_LSM6DSx_GYRO_RANGE_ID, 2000, {125, 250, 500, 1000, 2000}, 5},
-		{SETTING_LSM6DSx_GYRO_LPF_ID, 3, {0, 1, 2, 3, 4, 5, 6, 7}, 8},
-
-		{SETTING_IIS3DWB_ACCEL_EN_ID, 1, {0, 1}, 2},
-		{SETTING_IIS3DWB_ACCEL_RANGE_ID, 16, {2, 4, 8, 16}, 4},
-		{SETTING_IIS3DWB_ACCEL_LPF_ID, 4, {4, 10, 20, 45, 100, 200, 400, 800}, 8},
-		{SETTING_IIS3DWB_ACCEL_OFSX_ID, 0, {}, 0},
-		{SETTING_IIS3DWB_ACCEL_OFSY_ID, 0, {}, 0},
-		{SETTING_IIS3DWB_ACCEL_OFSZ_ID, 0, {}, 0},
-
-		{SETTING_ADXL37x_ACCEL_EN_ID, 1, {0, 1}, 2},
-		{SETTING_ADXL37x_ACCEL_ODR_ID, 5120, {320, 640, 1280, 2560, 5120}, 5},
-		{SETTING_ADXL37x_ACCEL_LPF_ID, 2, {2, 4, 8, 16, 32}, 5},
-		{SETTING_ADXL37x_ACCEL_OFSX_ID, 0, {}, 0},
-		{SETTING_ADXL37x_ACCEL_OFSY_ID, 0, {}, 0},
-		{SETTING_ADXL37x_ACCEL_OFSZ_ID, 0, {}, 0},
-
-		{SETTING_DELAY_BEFORE_ARMED_ID, 0, {}, 0},
-		{SETTING_RECORDING_LENGTH_ID, 5000, {}, 0},
-		{SETTING_FORMAT_DATA_EN_ID, 1, {0, 1}, 2},
-		{SETTING_ACCEL_TRIGGER_EN_ID, 0, {0, 1}, 2},
-		{SETTING_ACCEL_TRIGGER_ANY_AXIS_ID, 0, {0, 1}, 2},
-		{SETTING_ACCEL_TRIGGER_AXIS_ID, 2, {0, 1, 2}, 3},
-		{SETTING_ACCEL_TRIGGER_LEVEL_ID, 500, {}, 0},
-		{SETTING_ACCEL_TRIGGER_EDGE_ID, 0, {0, 1}, 2}
+		[SET_LSM6DSx_ACCEL_EN] = SETTING_SCHEMA_BOOL(SETTING_LSM6DSx_ACCEL_EN_ID, 1),
+		[SET_LSM6DSx_ACCEL_ODR] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_ACCEL_ODR_ID, 6660, 13, 26, 52, 104, 208, 416, 833, 1660, 3330, 6660),
+		[SET_LSM6DSx_ACCEL_RANGE] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_ACCEL_RANGE_ID, 32, 4, 8, 16, 32),
+		[SET_LSM6DSx_ACCEL_LPF] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_ACCEL_LPF_ID, 2, 2, 4, 10, 20, 45, 100, 200, 400, 800),
+		[SET_LSM6DSx_ACCEL_OFSX] = SETTING_SCHEMA_INT(SETTING_LSM6DSx_ACCEL_OFSX_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_LSM6DSx_ACCEL_OFSY] = SETTING_SCHEMA_INT(SETTING_LSM6DSx_ACCEL_OFSY_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_LSM6DSx_ACCEL_OFSZ] = SETTING_SCHEMA_INT(SETTING_LSM6DSx_ACCEL_OFSZ_ID, 0, INT32_MIN, INT32_MAX),
+
+		[SET_LSM6DSx_GYRO_EN] = SETTING_SCHEMA_BOOL(SETTING_LSM6DSx_GYRO_EN_ID, 1),
+		[SET_LSM6DSx_GYRO_ODR] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_GYRO_ODR_ID, 6660, 13, 26, 52, 104, 208, 416, 833, 1660, 3330, 6660),
+		[SET_LSM6DSx_GYRO_RANGE] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_GYRO_RANGE_ID, 2000, 125, 250, 500, 1000, 2000),
+		[SET_LSM6DSx_GYRO_LPF] = SETTING_SCHEMA_CHOICE(SETTING_LSM6DSx_GYRO_LPF_ID, 3, 0, 1, 2, 3, 4, 5, 6, 7),
+
+		[SET_IIS3DWB_ACCEL_EN] = SETTING_SCHEMA_BOOL(SETTING_IIS3DWB_ACCEL_EN_ID, 1),
+		[SET_IIS3DWB_ACCEL_RANGE] = SETTING_SCHEMA_CHOICE(SETTING_IIS3DWB_ACCEL_RANGE_ID, 16, 2, 4, 8, 16),
+		[SET_IIS3DWB_ACCEL_LPF] = SETTING_SCHEMA_CHOICE(SETTING_IIS3DWB_ACCEL_LPF_ID, 4, 4, 10, 20, 45, 100, 200, 400, 800),
+		[SET_IIS3DWB_ACCEL_OFSX] = SETTING_SCHEMA_INT(SETTING_IIS3DWB_ACCEL_OFSX_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_IIS3DWB_ACCEL_OFSY] = SETTING_SCHEMA_INT(SETTING_IIS3DWB_ACCEL_OFSY_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_IIS3DWB_ACCEL_OFSZ] = SETTING_SCHEMA_INT(SETTING_IIS3DWB_ACCEL_OFSZ_ID, 0, INT32_MIN, INT32_MAX),
+
+		[SET_ADXL37x_ACCEL_EN] = SETTING_SCHEMA_BOOL(SETTING_ADXL37x_ACCEL_EN_ID, 1),
+		[SET_ADXL37x_ACCEL_ODR] = SETTING_SCHEMA_CHOICE(SETTING_ADXL37x_ACCEL_ODR_ID, 5120, 320, 640, 1280, 2560, 5120),
+		[SET_ADXL37x_ACCEL_LPF] = SETTING_SCHEMA_CHOICE(SETTING_ADXL37x_ACCEL_LPF_ID, 2, 2, 4, 8, 16, 32),
+		[SET_ADXL37x_ACCEL_OFSX] = SETTING_SCHEMA_INT(SETTING_ADXL37x_ACCEL_OFSX_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_ADXL37x_ACCEL_OFSY] = SETTING_SCHEMA_INT(SETTING_ADXL37x_ACCEL_OFSY_ID, 0, INT32_MIN, INT32_MAX),
+		[SET_ADXL37x_ACCEL_OFSZ] = SETTING_SCHEMA_INT(SETTING_ADXL37x_ACCEL_OFSZ_ID, 0, INT32_MIN, INT32_MAX),
+
+		[SET_DELAY_BEFORE_ARMED] = SETTING_SCHEMA_INT(SETTING_DELAY_BEFORE_ARMED_ID, 0, 0, 4294967),  /* times are kept in microseconds */
+		[SET_RECORDING_LENGTH] = SETTING_SCHEMA_INT(SETTING_RECORDING_LENGTH_ID, 5000, 0, 4294967),
+		[SET_FORMAT_DATA_EN] = SETTING_SCHEMA_BOOL(SETTING_FORMAT_DATA_EN_ID, 1),
+		[SET_COMMIT_INTERVAL] = SETTING_SCHEMA_INT(SETTING_COMMIT_INTERVAL_ID, 1000, 0, 4294967),
+		[SET_RAW_LOGGING_EN] = SETTING_SCHEMA_BOOL(SETTING_RAW_LOGGING_EN_ID, 0),
+		[SET_RAW_REGION_SIZE] = SETTING_SCHEMA_INT(SETTING_RAW_REGION_SIZE_ID, 1024, 1, 4095),  /* FAT32 file size limit */
+		[SET_CHANNEL_FILES_EN] = SETTING_SCHEMA_BOOL(SETTING_CHANNEL_FILES_EN_ID, 0),
+		[SET_ACCEL_TRIGGER_EN] = SETTING_SCHEMA_BOOL(SETTING_ACCEL_TRIGGER_EN_ID, 0),
+		[SET_ACCEL_TRIGGER_ANY_AXIS] = SETTING_SCHEMA_BOOL(SETTING_ACCEL_TRIGGER_ANY_AXIS_ID, 0),
+		[SET_ACCEL_TRIGGER_AXIS] = SETTING_SCHEMA_CHOICE(SETTING_ACCEL_TRIGGER_AXIS_ID, 2, 0, 1, 2),
+		[SET_ACCEL_TRIGGER_LEVEL] = SETTING_SCHEMA_INT(SETTING_ACCEL_TRIGGER_LEVEL_ID, 500, 0, INT32_MAX),
+		[SET_ACCEL_TRIGGER_EDGE] = SETTING_SCHEMA_BOOL(SETTING_ACCEL_TRIGGER_EDGE_ID, 0),
+		[SET_TRIGGER_MAGNITUDE] = SETTING_SCHEMA_BOOL(SETTING_TRIGGER_MAGNITUDE_ID, 0),
+		[SET_LSM6DSx_ACCEL_TRIGGER] = SETTING_SCHEMA_INT(SETTING_LSM6DSx_ACCEL_TRIGGER_ID, 0, -1, INT32_MAX),  /* 0 for the shared level, -1 to leave the channel out */
+		[SET_LSM6DSx_GYRO_TRIGGER] = SETTING_SCHEMA_INT(SETTING_LSM6DSx_GYRO_TRIGGER_ID, 0, 0, 100000),  /* 0 to leave the channel out */
+		[SET_IIS3DWB_ACCEL_TRIGGER] = SETTING_SCHEMA_INT(SETTING_IIS3DWB_ACCEL_TRIGGER_ID, 0, -1, INT32_MAX),
+		[SET_ADXL37x_ACCEL_TRIGGER] = SETTING_SCHEMA_INT(SETTING_ADXL37x_ACCEL_TRIGGER_ID, 0, -1, INT32_MAX),
+		[SET_TRIGGER_HYSTERESIS] = SETTING_SCHEMA_INT(SETTING_TRIGGER_HYSTERESIS_ID, 0, 0, 100),
+		[SET_TRIGGER_MIN_DURATION] = SETTING_SCHEMA_INT(SETTING_TRIGGER_MIN_DURATION_ID, 0, 0, 10000000),
+		[SET_TRIGGER_ALL_CHANNELS] = SETTING_SCHEMA_BOOL(SETTING_TRIGGER_ALL_CHANNELS_ID, 0),
+		[SET_PRETRIGGER] = SETTING_SCHEMA_INT(SETTING_PRETRIGGER_ID, 0, 0, 10000),  /* in practice limited by half the data buffer */
+		[SET_AUTO_STOP_EN] = SETTING_SCHEMA_BOOL(SETTING_AUTO_STOP_EN_ID, 0),
+		[SET_AUTO_STOP_LEVEL] = SETTING_SCHEMA_INT(SETTING_AUTO_STOP_LEVEL_ID, 50, 0, INT32_MAX),
+		[SET_AUTO_STOP_HOLD] = SETTING_SCHEMA_INT(SETTING_AUTO_STOP_HOLD_ID, 1000, 0, 2000000),  /* compared as a signed 32 bit time in microseconds */
+		[SET_AUTO_STOP_REARM] = SETTING_SCHEMA_BOOL(SETTING_AUTO_STOP_REARM_ID, 0),
+		[SET_MULTI_SHOT_EN] = SETTING_SCHEMA_BOOL(SETTING_MULTI_SHOT_EN_ID, 0),
+		[SET_MULTI_SHOT_EVENTS] = SETTING_SCHEMA_INT(SETTING_MULTI_SHOT_EVENTS_ID, 32, 1, RECORDING_MAX_EVENTS),
+		[SET_CARD_WRITE_SPEED] = SETTING_SCHEMA_INT(SETTING_CARD_WRITE_SPEED_ID, 8000, 100, 100000),  /* only used for the throughput budget */
+		[SET_CARD_WRITE_LATENCY] = SETTING_SCHEMA_INT(SETTING_CARD_WRITE_LATENCY_ID, 40, 0, 10000)
 };
+CCMRAM int32_t settings[SET_COUNT];
+
+/* named profiles from the settings file, switched between with a long button press */
+CCMRAM int32_t base_settings[SET_COUNT];
+CCMRAM int32_t profile_values[SETTING_MAX_PROFILES][SET_COUNT];
+SettingProfiles profiles = {0, {{0}}, &profile_values[0][0]};
+int32_t active_profile = -1;  /* -1 for the base settings */
+
+/* parsed settings kept in flash, used instead of the settings file while it is unchanged */
+typedef struct
+{
+	int32_t base[SET_COUNT];
+	uint32_t profile_count;
+	char profile_names[SETTING_MAX_PROFILES][SETTING_PROFILE_NAME_LEN];
+	int32_t profile_values[SETTING_MAX_PROFILES][SET_COUNT];
+} SettingsCache;
+uint8_t settings_cached;  /* settings came from the cache at power up */
 
 /* sensor objects: LSM6DSx accelerometer, LSM6DSx gyroscope, IIS3DWB accelerometer, ADXL37x accelerometer */
 SPISensor sensor_array[] =
 {
-		{NULL, SPI1_NSS_GPIO_Port, SPI1_NSS_Pin, LSM6DSx_INT1_Pin, LSM6DSx_ConvertWriteRegister, LSM6DSx_ConvertReadRegister, 0x00, LSM6DSx_ProcessData},
-		{NULL, SPI1_NSS_GPIO_Port, SPI1_NSS_Pin, LSM6DSx_INT2_Pin, LSM6DSx_ConvertWriteRegister, LSM6DSx_ConvertReadRegister, 0x00, LSM6DSx_ProcessData},
-		{NULL, IIS3DWB_NSS_GPIO_Port, IIS3DWB_NSS_Pin, IIS3DWB_INT1_Pin, IIS3DWB_ConvertWriteRegister, IIS3DWB_ConvertReadRegister, 0x00, IIS3DWB_ProcessData},
-		{NULL, ADXL37x_NSS_GPIO_Port, ADXL37x_NSS_Pin, ADXL37x_INT1_Pin, ADXL37x_ConvertWriteRegister, ADXL37x_ConvertReadRegister, 0x00, ADXL37x_ProcessData}
+		{NULL, SPI1_NSS_GPIO_Port, SPI1_NSS_Pin, LSM6DSx_INT1_Pin, LSM6DSx_ConvertWriteRegister, LSM6DSx_ConvertReadRegister, 0x00, LSM6DSx_ProcessData, LSM6DSx_ProcessDataRaw},
+		{NULL, SPI1_NSS_GPIO_Port, SPI1_NSS_Pin, LSM6DSx_INT2_Pin, LSM6DSx_ConvertWriteRegister, LSM6DSx_ConvertReadRegister, 0x00, LSM6DSx_ProcessData, LSM6DSx_ProcessDataRaw},
+		{NULL, IIS3DWB_NSS_GPIO_Port, IIS3DWB_NSS_Pin, IIS3DWB_INT1_Pin, IIS3DWB_ConvertWriteRegister, IIS3DWB_ConvertReadRegister, 0x00, IIS3DWB_ProcessData, IIS3DWB_ProcessDataRaw},
+		{NULL, ADXL37x_NSS_GPIO_Port, ADXL37x_NSS_Pin, ADXL37x_INT1_Pin, ADXL37x_ConvertWriteRegister, ADXL37x_ConvertReadRegister, 0x00, ADXL37x_ProcessData, ADXL37x_ProcessDataRaw}
 };
 
+/* sensor register writes, sent by DMA while the card is busy */
+SPISequence sensor_sequence;
+
+/* lines of the settings file that couldn't be used */
+CCMRAM SettingParseReport settings_report;
+
 /* pointer to microsecond counter */
 volatile uint32_t* time_micros_ptr;
 
 /* data logger */
 SDLogger logger;
-FATFS fs;
-FIL raw_data_file;
-char raw_data_file_name[16];
-FIL output_file_array[4];  /* output files: LSM6DSx accelerometer, LSM6DSx gyroscope, IIS3DWB accelerometer, ADXL37x accelerometer */
-uint8_t output_file_is_open[] = {0, 0, 0, 0};
-FRESULT fresult;
-UINT write_count;
+SDStorage storage;
+char raw_data_file_name[24];
+
+/* channel files mode: each sensor is logged straight to its own file from its own part of the data buffer */
+SDLogger channel_logger[4];
+char* const channel_name[] = {LSM6DSx_ACCEL_NAME, LSM6DSx_GYRO_NAME, IIS3DWB_NAME, ADXL37x_NAME};
+uint32_t channel_preallocate_bytes[4];
+
+/* conversion of the binary recordings to CSV */
+CSVConverter converter;
+uint8_t convert_queue_check = 1;  /* look for recordings that still need converting */
 
 /* de-bounced button */
 ButtonDebounced button;
@@ -96,6 +214,8 @@ const uint32_t saving_blink_sequence[] = SAVING_BLINK_SEQUENCE;
 const uint32_t error_blink_sequence[] = ERROR_BLINK_SEQUENCE;
 const uint32_t success_burst_sequence[] = SUCCESS_BURST_SEQUENCE;
 const uint32_t error_burst_sequence[] = ERROR_BURST_SEQUENCE;
+const uint32_t budget_burst_sequence[] = BUDGET_BURST_SEQUENCE;
+uint32_t profile_burst_sequence[2 * (SETTING_MAX_PROFILES + 1)];  /* one blink for the base settings, two for the first profile... */
 
 /* storage type for gathered data */
 typedef struct
@@ -109,6 +229,8 @@ typedef struct
 volatile DataPoint data_buffer[CD_LOGGER_DATA_BUFFER_LEN];
 volatile uint32_t data_pending_index = 0;  /* increments as each sensor data ready pin triggers */
 volatile uint32_t data_read_index = 0;  /* increments once the data at this index has been read from the sensor */
+volatile uint8_t data_ring_wrapped = 0;  /* the whole ring holds data taken since arming */
+uint32_t data_ring_len = CD_LOGGER_DATA_BUFFER_LEN;  /* data points used by the sensor interrupts, less in channel files mode */
 
 /* IMU state control */
 typedef enum
@@ -121,7 +243,6 @@ typedef enum
 	ARMED_ENTRY,
 	RECORDING,
 	RECORDING_ENTRY,
-	SAVING,
 	SAVING_ENTRY,
 	IMU_ERROR,
 	IMU_ERROR_ENTRY
@@ -131,16 +252,53 @@ IMUState state = IDLE_ENTRY;
 /* recording variables */
 uint32_t time_staging, time_recording_started;
 uint32_t delay_before_armed, max_recording_length;
-uint16_t recording_number;
+uint32_t recording_number;
 uint32_t data_formatting_enabled;
+uint32_t raw_logging_enabled, raw_region_size_mb;
+uint32_t channel_files_enabled;
+RecordingHeader recording_header __attribute__((aligned(4)));  /* channel descriptions and settings written at the start of each recording */
+uint8_t card_prepared;  /* card was formatted by the IMpack and still has that layout */
 uint8_t sensor_enabled[] = {0, 0, 0, 0};
-float sensor_units_per_bit[4];
+
+/* time stamps of the start up stages, to see where the boot time goes */
+typedef enum
+{
+	BOOT_SENSORS_FOUND,
+	BOOT_CARD_READY,
+	BOOT_SETTINGS_PARSED,
+	BOOT_SENSOR_CONFIG_STARTED,
+	BOOT_FILES_UPDATED,
+	BOOT_SENSORS_CONFIGURED,
+	BOOT_STAGE_COUNT
+} BootStage;
+const char* const boot_stage_names[BOOT_STAGE_COUNT] = {"sensors_found", "card_ready", "settings_parsed", "sensor_config_started", "files_updated", "sensors_configured"};
+uint32_t boot_stage_micros[BOOT_STAGE_COUNT];  /* since the start of App_Setup */
+uint32_t boot_reset_millis;  /* from reset to the start of App_Setup */
 
 /* triggering based on acceleration */
-float accel_threshold_g;
+CCMRAM Trigger trigger;  /* levels in counts for each channel, updated by the timer interrupt as the data is read */
 uint32_t trigger_enabled = 0;
-uint32_t trigger_on_axis[] = {0, 0, 0};  /* which axes to consider for triggering a recording */
-uint32_t trigger_on_rising_edge;
+volatile uint8_t trigger_armed;  /* the timer interrupt compares each data point it reads with the threshold */
+volatile uint8_t trigger_fired;  /* a data point crossed the threshold, it's at trigger_index */
+uint8_t trigger_joins_buffer;  /* the recording keeps the data point that set off the trigger and those after it */
+uint32_t pretrigger_micros;  /* how much of the data from before the trigger is kept as well */
+volatile uint32_t trigger_index;  /* data point that set off the trigger */
+
+/* ending the recording once the motion has settled */
+CCMRAM Activity activity;  /* running averages of the accelerometers, updated by the timer interrupt */
+uint32_t auto_stop_enabled;
+uint32_t auto_stop_hold_micros;  /* no motion for this long ends the recording */
+uint32_t auto_stop_rearm;  /* go back to the armed state for the next event after a recording that settled */
+uint8_t rearm_after_saving;
+
+/* multi-shot: the triggered events of a series go one after the other into the same recording */
+uint32_t multi_shot_enabled;
+uint32_t multi_shot_max_events;  /* size of the event table, the series carries on in a new recording once it is full */
+uint8_t series_open;  /* the recording stays open for the next event */
+uint8_t event_open;  /* an event of the series is being recorded */
+uint32_t series_started;  /* start of the first pre-trigger window, the time stamps of every event count from here */
+uint32_t event_trigger_micros;  /* time stamp of the trigger of the recording or event in progress */
+RecordingEvent recording_event;  /* table entry of the event in progress */
 
 
 
@@ -149,8 +307,9 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DSx, SPI_Handl
 	/* disable interrupts */
 	App_DisableAccelerometerInterrupts();
 
-	/* pointer to time keeping variable */
+	/* pointer to time keeping variable, the timer was started just before */
 	time_micros_ptr = micros_timer;
+	boot_reset_millis = HAL_GetTick();
 
 	/* store the SPI handles and data register addresses in the sensor objects */
 	sensor_array[0].spi = hspi_LSM6DSx;
@@ -166,13 +325,18 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DSx, SPI_Handl
 	if (SPISensor_TestCommunication(&sensor_array[0], LSM6DSx_REG_WHO_AM_I, LSM6DSx_DEVICE_ID)) {state = IMU_ERROR_ENTRY;}
 	if (SPISensor_TestCommunication(&sensor_array[2], IIS3DWB_REG_WHO_AM_I, IIS3DWB_DEVICE_ID)) {state = IMU_ERROR_ENTRY;}
 	if (SPISensor_TestCommunication(&sensor_array[3], ADXL37x_REG_PARTID, ADXL37x_DEVID_PRODUCT)) {state = IMU_ERROR_ENTRY;}
+	boot_stage_micros[BOOT_SENSORS_FOUND] = *time_micros_ptr;
 
 	/* initialize the SDIO peripheral in 4 bit mode (bug: cube always generates code for 1 bit regardless of setting) */
 	if (HAL_SD_Init(hsd) != HAL_OK) {state = IMU_ERROR_ENTRY;}
 	if (HAL_SD_ConfigWideBusOperation(hsd, SDIO_BUS_WIDE_4B) != HAL_OK) {state = IMU_ERROR_ENTRY;}
+	boot_stage_micros[BOOT_CARD_READY] = *time_micros_ptr;
+
+	/* the file system session stays mounted across states */
+	SDStorage_Init(&storage, hsd, SD_CARD_DETECT_GPIO_Port, SD_CARD_DETECT_Pin, time_micros_ptr, SD_IDLE_TIMEOUT_MICROS);
 
 	/* initialize the data logger */
-	SDLogger_Initialize(&logger, (uint8_t*)data_buffer, sizeof(data_buffer), sizeof(DataPoint));
+	SDLogger_Initialize(&logger, (uint8_t*)data_buffer, sizeof(data_buffer), sizeof(DataPoint), time_micros_ptr);
 
 	/* initialize the user button */
 	ButtonDebounced_Init(&button, BUTTON_GPIO_Port, BUTTON_Pin, time_micros_ptr, BUTTON_DEBOUNCE_TIME_MICROS);
@@ -180,11 +344,29 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DSx, SPI_Handl
 	/* initialize the indicator LED */
 	LEDSequence_Init(&led, LED_STATUS_GPIO_Port, LED_STATUS_Pin, time_micros_ptr);
 
-	/* try to parse the user settings file */
+	/* holding the button through power up asks for the card to be prepared for logging */
+	uint8_t card_prep_requested = 0;
+	uint32_t time_button_check = *time_micros_ptr;
+	while (HAL_GPIO_ReadPin(BUTTON_GPIO_Port, BUTTON_Pin) == GPIO_PIN_SET)
+	{
+		if (*time_micros_ptr - time_button_check > CARD_PREP_HOLD_MICROS)
+		{
+			card_prep_requested = 1;
+			HAL_GPIO_WritePin(LED_STATUS_GPIO_Port, LED_STATUS_Pin, GPIO_PIN_SET);  /* solid LED while the card is formatted */
+			break;
+		}
+	}
+
+	/* try to parse the user settings file, anything it doesn't set keeps its default */
+	Setting_SetDefaults(settings_schema, settings, SET_COUNT);
+	uint8_t settings_parsed = 1;
 	if (state == IDLE_ENTRY)
 	{
-		fresult = f_mount(&fs, "/", 1);
-		if (Setting_ParseArray(settings_array, NUMEL(settings_array), SETTINGS_FILE))
+		/* a settings file that hasn't changed since the last power up doesn't need parsing again */
+		(void)SDStorage_Open(&storage);
+		settings_cached = App_LoadSettingsCache(App_SettingsFileKey());
+		if (!settings_cached) {settings_parsed = Setting_ParseArray(settings_schema, settings, SET_COUNT, SETTINGS_FILE, &settings_report, &profiles);}
+		if (settings_parsed)
 		{
 			/* successfully parsed all settings */
 			LEDSequence_SetBurstSequence(&led, success_burst_sequence, NUMEL(success_burst_sequence));
@@ -195,53 +377,102 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DSx, SPI_Handl
 			LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));
 		}
 
-		/* rewrite the settings file so it will be correct for next time */
-		if (!Setting_WriteArray(settings_array, NUMEL(settings_array), SETTINGS_FILE)) {state = IMU_ERROR_ENTRY;}
-		fresult = f_mount(NULL, "/", 1);
+		/* re-format the card, the settings file is copied back afterwards */
+		if (card_prep_requested)
+		{
+			if (!App_PrepareCard())
+				LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));
+
+			/* don't let the held button start a recording */
+			while (HAL_GPIO_ReadPin(BUTTON_GPIO_Port, BUTTON_Pin) == GPIO_PIN_SET);
+			button.time_last_press_micros = *time_micros_ptr;
+		}
+
+		card_prepared = SDStorage_IsPrepared(&storage, CARD_PREP_MARKER_FILE);
+	}
+	HAL_GPIO_WritePin(LED_STATUS_GPIO_Port, LED_STATUS_Pin, GPIO_PIN_RESET);
+	boot_stage_micros[BOOT_SETTINGS_PARSED] = *time_micros_ptr;
+
+	/* the converter works in the sample buffer while idle, and pauses before a new recording takes it back */
+	CSVConverter_Init(&converter, (uint8_t*)data_buffer, sizeof(data_buffer), CONVERT_JOURNAL_FILE);
+
+	/* start with the profile that was in use before the power cycle, the sensor registers are written in the background */
+	memcpy(base_settings, settings, sizeof(settings));
+	App_SelectProfile(state == IDLE_ENTRY ? App_ReadProfileFile() : -1);
+	boot_stage_micros[BOOT_SENSOR_CONFIG_STARTED] = *time_micros_ptr;
+
+	if (state == IDLE_ENTRY)
+	{
+		/* fix the settings file so it will be correct for next time, a good one is left alone */
+		if (!settings_parsed && !Setting_RewriteFile(settings_schema, base_settings, SET_COUNT, SETTINGS_FILE, (char*)data_buffer, sizeof(data_buffer))) {state = IMU_ERROR_ENTRY;}
+
+		/* warn if the settings will drop samples, a settings file error takes priority and the numbers are in the budget file either way */
+		if (!App_CheckBudget() && led.burst_sequence_array == success_burst_sequence)
+			LEDSequence_SetBurstSequence(&led, budget_burst_sequence, NUMEL(budget_burst_sequence));
 	}
+	if (data_formatting_enabled) {(void)CSVConverter_Resume(&converter, DATA_FILE_NAME, DATA_FILE_EXT);}  /* finish a conversion cut short by a power cycle */
+	boot_stage_micros[BOOT_FILES_UPDATED] = *time_micros_ptr;
+
+	if (SPISequence_Wait(&sensor_sequence, time_micros_ptr, SENSOR_CONFIG_TIMEOUT_MICROS)) {state = IMU_ERROR_ENTRY;}
+	boot_stage_micros[BOOT_SENSORS_CONFIGURED] = *time_micros_ptr;
+	if (state == IDLE_ENTRY) {App_WriteBootLog();}
+
+	/* keep the parsed settings for next time, last since erasing the flash sector takes around a second */
+	if (state == IDLE_ENTRY && !settings_cached) {(void)App_SaveSettingsCache(App_SettingsFileKey());}
+}
+
+
 
+void App_ApplySettings()
+{
+	/*
+	 * Turn the current settings into sensor register writes and the recording plan, at power up or on a profile change.
+	 * The register writes are only started here, SPISequence_Wait has to be called before the sensors are used.
+	 */
 	/* configure the sensors */
 	uint8_t* config_reg;
 	uint8_t* config_data;
 	uint8_t config_size;
-	LSM6DSx_GetConfiguration(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_LPF_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_GYRO_LPF_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_OFSX_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_OFSY_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_OFSZ_ID)->value,
+	SPISequence_Init(&sensor_sequence);
+	LSM6DSx_GetConfiguration(settings[SET_LSM6DSx_ACCEL_LPF],
+							 settings[SET_LSM6DSx_GYRO_LPF],
+							 settings[SET_LSM6DSx_ACCEL_OFSX],
+							 settings[SET_LSM6DSx_ACCEL_OFSY],
+							 settings[SET_LSM6DSx_ACCEL_OFSZ],
 							 &config_reg, &config_data, &config_size);
-	if (SPISensor_WriteMultiple(&sensor_array[0], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
+	if (!SPISequence_Add(&sensor_sequence, &sensor_array[0], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
 
-	IIS3DWB_GetConfiguration(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_LPF_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_OFSX_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_OFSY_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_OFSZ_ID)->value,
+	IIS3DWB_GetConfiguration(settings[SET_IIS3DWB_ACCEL_LPF],
+							 settings[SET_IIS3DWB_ACCEL_OFSX],
+							 settings[SET_IIS3DWB_ACCEL_OFSY],
+							 settings[SET_IIS3DWB_ACCEL_OFSZ],
 							 &config_reg, &config_data, &config_size);
-	if (SPISensor_WriteMultiple(&sensor_array[2], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
+	if (!SPISequence_Add(&sensor_sequence, &sensor_array[2], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
 
-	ADXL37x_GetConfiguration(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_LPF_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_ODR_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_OFSX_ID)->value,
-			 	 	 	 	 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_OFSY_ID)->value,
-							 Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_OFSZ_ID)->value,
+	ADXL37x_GetConfiguration(settings[SET_ADXL37x_ACCEL_LPF],
+							 settings[SET_ADXL37x_ACCEL_ODR],
+							 settings[SET_ADXL37x_ACCEL_OFSX],
+			 	 	 	 	 settings[SET_ADXL37x_ACCEL_OFSY],
+							 settings[SET_ADXL37x_ACCEL_OFSZ],
 							 &config_reg, &config_data, &config_size);
-	if (SPISensor_WriteMultiple(&sensor_array[3], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
+	if (!SPISequence_Add(&sensor_sequence, &sensor_array[3], config_reg, config_data, config_size)) {state = IMU_ERROR_ENTRY;}
+	SPISequence_Start(&sensor_sequence);
 
 	/* configure the sensor enable registers */
-	LSM6DSx_GetAccelEnable(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_LPF_ID)->value,
-						   Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_ODR_ID)->value,
-						   Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_RANGE_ID)->value,
+	LSM6DSx_GetAccelEnable(settings[SET_LSM6DSx_ACCEL_LPF],
+						   settings[SET_LSM6DSx_ACCEL_ODR],
+						   settings[SET_LSM6DSx_ACCEL_RANGE],
 						   &(sensor_array[0].enable_reg), &(sensor_array[0].enable_data));
 	sensor_array[0].disable_reg = LSM6DSx_REG_CTRL1_XL;
 	sensor_array[0].disable_data = LSM6DSx_ACCEL_ODR_DISABLE;
 
-	LSM6DSx_GetGyroEnable(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_GYRO_ODR_ID)->value,
-					      Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_GYRO_RANGE_ID)->value,
+	LSM6DSx_GetGyroEnable(settings[SET_LSM6DSx_GYRO_ODR],
+					      settings[SET_LSM6DSx_GYRO_RANGE],
 						  &(sensor_array[1].enable_reg), &(sensor_array[1].enable_data));
 	sensor_array[1].disable_reg = LSM6DSx_REG_CTRL2_G;
 	sensor_array[1].disable_data = LSM6DSx_GYRO_ODR_DISABLE;
 
-	IIS3DWB_GetEnable(Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_RANGE_ID)->value,
+	IIS3DWB_GetEnable(settings[SET_IIS3DWB_ACCEL_RANGE],
 					  &(sensor_array[2].enable_reg), &(sensor_array[2].enable_data));
 	sensor_array[2].disable_reg = IIS3DWB_REG_CTRL1_XL;
 	sensor_array[2].disable_data = IIS3DWB_ODR_DISABLE;
@@ -253,38 +484,309 @@ void App_Setup(SD_HandleTypeDef* hsd, SPI_HandleTypeDef* hspi_LSM6DSx, SPI_Handl
 
 
 	/* configure the recording control variables */
-	sensor_enabled[0] = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_EN_ID)->value;
-	sensor_enabled[1] = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_GYRO_EN_ID)->value;
-	sensor_enabled[2] = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_EN_ID)->value;
-	sensor_enabled[3] = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ADXL37x_ACCEL_EN_ID)->value;
-	sensor_units_per_bit[0] = (float)Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_ACCEL_RANGE_ID)->value / (float)(1 << (LSM6DSx_RESOLUTION - 1));
-	sensor_units_per_bit[1] = (float)Setting_GetById(settings_array, NUMEL(settings_array), SETTING_LSM6DSx_GYRO_RANGE_ID)->value / (float)(1 << (LSM6DSx_RESOLUTION - 1));
-	sensor_units_per_bit[2] = (float)Setting_GetById(settings_array, NUMEL(settings_array), SETTING_IIS3DWB_ACCEL_RANGE_ID)->value / (float)(1 << (IIS3DWB_RESOLUTION - 1));
-	sensor_units_per_bit[3] = (float)ADXL37x_RANGE / (float)(1 << (ADXL37x_RESOLUTION - 1));
+	sensor_enabled[0] = settings[SET_LSM6DSx_ACCEL_EN];
+	sensor_enabled[1] = settings[SET_LSM6DSx_GYRO_EN];
+	sensor_enabled[2] = settings[SET_IIS3DWB_ACCEL_EN];
+	sensor_enabled[3] = settings[SET_ADXL37x_ACCEL_EN];
+	uint32_t sensor_range[4];
+	sensor_range[0] = settings[SET_LSM6DSx_ACCEL_RANGE];
+	sensor_range[1] = settings[SET_LSM6DSx_GYRO_RANGE];
+	sensor_range[2] = settings[SET_IIS3DWB_ACCEL_RANGE];
+	sensor_range[3] = ADXL37x_RANGE;
+
+	CSVConverter_SetChannel(&converter, 0, sensor_array[0].int_pin, sensor_array[0].process_data_raw, sensor_range[0], LSM6DSx_RESOLUTION, LSM6DSx_ACCEL_FILE, "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
+	CSVConverter_SetChannel(&converter, 1, sensor_array[1].int_pin, sensor_array[1].process_data_raw, sensor_range[1], LSM6DSx_RESOLUTION, LSM6DSx_GYRO_FILE, "Time (us),Rate_x (dps),Rate_y (dps),Rate_z (dps)\n");
+	CSVConverter_SetChannel(&converter, 2, sensor_array[2].int_pin, sensor_array[2].process_data_raw, sensor_range[2], IIS3DWB_RESOLUTION, IIS3DWB_FILE, "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
+	CSVConverter_SetChannel(&converter, 3, sensor_array[3].int_pin, sensor_array[3].process_data_raw, sensor_range[3], ADXL37x_RESOLUTION, ADXL37x_FILE, "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
+
+
+	delay_before_armed = 1000 * settings[SET_DELAY_BEFORE_ARMED];
+	max_recording_length = 1000 * settings[SET_RECORDING_LENGTH];
+	data_formatting_enabled = settings[SET_FORMAT_DATA_EN];
+	SDLogger_SetCommitInterval(&logger, 1000 * settings[SET_COMMIT_INTERVAL]);
+	SDLogger_SetSegmentSize(&logger, DATA_SEGMENT_MAX_BYTES);
+	raw_logging_enabled = settings[SET_RAW_LOGGING_EN];
+	raw_region_size_mb = settings[SET_RAW_REGION_SIZE];
+
+	/* describe the channels and settings in the header of each recording so the data can be decoded on its own */
+	RecordingHeader_Init(&recording_header, sizeof(DataPoint), FIRMWARE_VERSION);
+	RecordingHeader_SetChannel(&recording_header, 0, sensor_array[0].int_pin, LSM6DSx_ACCEL_NAME, "g", sensor_enabled[0] ? RECORDING_CHANNEL_ENABLED : 0, LSM6DSx_RESOLUTION,
+							   sensor_range[0], settings[SET_LSM6DSx_ACCEL_ODR]);
+	RecordingHeader_SetChannel(&recording_header, 1, sensor_array[1].int_pin, LSM6DSx_GYRO_NAME, "dps", sensor_enabled[1] ? RECORDING_CHANNEL_ENABLED : 0, LSM6DSx_RESOLUTION,
+							   sensor_range[1], settings[SET_LSM6DSx_GYRO_ODR]);
+	RecordingHeader_SetChannel(&recording_header, 2, sensor_array[2].int_pin, IIS3DWB_NAME, "g", sensor_enabled[2] ? RECORDING_CHANNEL_ENABLED : 0, IIS3DWB_RESOLUTION,
+							   sensor_range[2], IIS3DWB_ODR);
+	RecordingHeader_SetChannel(&recording_header, 3, sensor_array[3].int_pin, ADXL37x_NAME, "g", (sensor_enabled[3] ? RECORDING_CHANNEL_ENABLED : 0) | RECORDING_CHANNEL_BIG_ENDIAN, ADXL37x_RESOLUTION,
+							   sensor_range[3], settings[SET_ADXL37x_ACCEL_ODR]);
+	uint32_t summary_len = Setting_FormatArray(settings_schema, settings, SET_COUNT, recording_header.settings, sizeof(recording_header.settings));
+	snprintf(recording_header.settings + summary_len, sizeof(recording_header.settings) - summary_len, "card_prepared = %u\n# profile: %s\n", card_prepared,
+			 active_profile < 0 ? SETTINGS_BASE_PROFILE_NAME : profiles.names[active_profile]);
+	RecordingHeader_SetSettingsLength(&recording_header, strlen(recording_header.settings));
+	SDLogger_SetHeader(&logger, &recording_header, sizeof(recording_header));
+
+	/*
+	 * In channel files mode the sensor interrupts only need a short ring of data points, the rest of the buffer is split
+	 * into a double buffer per channel in proportion to the data rates. The data file of each recording then only holds the
+	 * header, and the data points without their data type tag go to LSMA12.BIN and so on, ready for the host to map.
+	 */
+	channel_files_enabled = settings[SET_CHANNEL_FILES_EN] && !raw_logging_enabled;
+	data_ring_len = CD_LOGGER_DATA_BUFFER_LEN;
+	if (channel_files_enabled)
+	{
+		data_ring_len = CHANNEL_FILE_RING_LEN;
+		recording_header.flags |= RECORDING_SEPARATE_CHANNEL_FILES;
 
+		uint32_t channel_count = 0;
+		float total_odr_hz = 0.0f;
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			if (!sensor_enabled[i]) {continue;}
+			channel_count++;
+			total_odr_hz += recording_header.channels[i].odr_hz;
+		}
+
+		uint8_t* channel_buffer = (uint8_t*)&data_buffer[CHANNEL_FILE_RING_LEN];
+		uint32_t block_count = (sizeof(data_buffer) - CHANNEL_FILE_RING_LEN * sizeof(DataPoint)) / (2 * CHANNEL_FILE_BLOCK_LEN);
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			if (!sensor_enabled[i]) {continue;}
+
+			/* every channel gets at least one block per half, the rest go by data rate */
+			float odr_hz = recording_header.channels[i].odr_hz;
+			uint32_t channel_blocks = 1 + (uint32_t)((float)(block_count - channel_count) * odr_hz / total_odr_hz);
+			SDLogger_Initialize(&channel_logger[i], channel_buffer, 2 * CHANNEL_FILE_BLOCK_LEN * channel_blocks, CHANNEL_FILE_RECORD_SIZE, time_micros_ptr);
+			SDLogger_SetCommitInterval(&channel_logger[i], logger.commit_interval_micros);
+			SDLogger_SetSegmentSize(&channel_logger[i], DATA_SEGMENT_MAX_BYTES);
+			channel_buffer += 2 * CHANNEL_FILE_BLOCK_LEN * channel_blocks;
+
+			/* preallocate for the longest recording with a little extra for the sensor clock running fast */
+			float expected_bytes = 1.05f * odr_hz * CHANNEL_FILE_RECORD_SIZE * (0.000001f * (float)max_recording_length);
+			channel_preallocate_bytes[i] = expected_bytes < (float)DATA_SEGMENT_MAX_BYTES ? (uint32_t)expected_bytes : DATA_SEGMENT_MAX_BYTES;
+		}
+	}
 
-	delay_before_armed = 1000 * Setting_GetById(settings_array, NUMEL(settings_array), SETTING_DELAY_BEFORE_ARMED_ID)->value;
-	max_recording_length = 1000 * Setting_GetById(settings_array, NUMEL(settings_array), SETTING_RECORDING_LENGTH_ID)->value;
-	data_formatting_enabled = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_FORMAT_DATA_EN_ID)->value;
 
+	/* the level of each channel in counts, from the same range and byte order the header describes */
+	trigger_enabled = settings[SET_ACCEL_TRIGGER_EN];
+	Trigger_Init(&trigger, settings[SET_ACCEL_TRIGGER_EDGE], settings[SET_TRIGGER_MAGNITUDE], settings[SET_TRIGGER_ALL_CHANNELS],
+				 settings[SET_TRIGGER_HYSTERESIS], settings[SET_TRIGGER_MIN_DURATION]);
+	uint8_t trigger_axes = settings[SET_ACCEL_TRIGGER_ANY_AXIS] ? 0x07 : 1 << settings[SET_ACCEL_TRIGGER_AXIS];
+	int32_t trigger_level[4];
+	trigger_level[0] = settings[SET_LSM6DSx_ACCEL_TRIGGER];
+	trigger_level[1] = settings[SET_LSM6DSx_GYRO_TRIGGER] ? 1000 * settings[SET_LSM6DSx_GYRO_TRIGGER] : -1;  /* no shared level for the gyro */
+	trigger_level[2] = settings[SET_IIS3DWB_ACCEL_TRIGGER];
+	trigger_level[3] = settings[SET_ADXL37x_ACCEL_TRIGGER];
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		if (trigger_level[i] == 0) {trigger_level[i] = settings[SET_ACCEL_TRIGGER_LEVEL];}
+		if (trigger_level[i] < 0 || !sensor_enabled[i]) {continue;}
+		const RecordingChannel* channel = &recording_header.channels[i];
+		Trigger_SetChannel(&trigger, i, trigger_axes, trigger_level[i], channel->full_scale, channel->resolution,
+						   (channel->flags & RECORDING_CHANNEL_BIG_ENDIAN) != 0);
+	}
 
-	accel_threshold_g = 0.001f * (float)Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ACCEL_TRIGGER_LEVEL_ID)->value;
-	if (Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ACCEL_TRIGGER_EN_ID)->value)
+	/* triggered recordings start from the armed data in the shared buffer, which channel files mode doesn't keep */
+	trigger_joins_buffer = trigger_enabled && !channel_files_enabled;
+	pretrigger_micros = trigger_joins_buffer ? 1000 * settings[SET_PRETRIGGER] : 0;
+	SDLogger_DeferHeader(&logger, trigger_joins_buffer);
+
+	/* a multi-shot recording keeps its event table after the header, and looks for space for all of its events up front */
+	multi_shot_enabled = settings[SET_MULTI_SHOT_EN] && trigger_joins_buffer;
+	multi_shot_max_events = settings[SET_MULTI_SHOT_EVENTS];
+	SDLogger_ReserveAfterHeader(&logger, multi_shot_enabled ? multi_shot_max_events * sizeof(RecordingEvent) : 0);
+	float total_odr_hz = 0.0f;
+	for (uint8_t i = 0; i < 4; i++)
+		if (sensor_enabled[i])
+			total_odr_hz += recording_header.channels[i].odr_hz;
+	float series_bytes = sizeof(recording_header) + logger.header_reserve + 1.05f * total_odr_hz * sizeof(DataPoint) * (0.000001f * (float)(pretrigger_micros + max_recording_length)) * (float)multi_shot_max_events;
+	SDLogger_SetPreallocation(&logger, !multi_shot_enabled ? 0 : series_bytes < (float)DATA_SEGMENT_MAX_BYTES ? (uint32_t)series_bytes : DATA_SEGMENT_MAX_BYTES);
+
+	/* the auto stop watches the accelerometers, the averages take out gravity so only the level above it counts */
+	auto_stop_enabled = settings[SET_AUTO_STOP_EN];
+	auto_stop_hold_micros = 1000 * settings[SET_AUTO_STOP_HOLD];
+	auto_stop_rearm = settings[SET_AUTO_STOP_REARM] && trigger_enabled;
+	Activity_Init(&activity);
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		if (i == 1 || !sensor_enabled[i]) {continue;}
+		const RecordingChannel* channel = &recording_header.channels[i];
+		Activity_SetChannel(&activity, i, settings[SET_AUTO_STOP_LEVEL], channel->full_scale, channel->resolution, (channel->flags & RECORDING_CHANNEL_BIG_ENDIAN) != 0,
+							channel->odr_hz, AUTO_STOP_AVERAGE_MICROS);
+	}
+
+}
+
+
+
+void App_SelectProfile(int32_t profile)
+{
+	/* -1 selects the base settings, the profile values were all worked out when the settings file was parsed */
+	if (profile < 0 || profile >= (int32_t)profiles.count) {profile = -1;}
+	memcpy(settings, profile < 0 ? base_settings : profile_values[profile], sizeof(settings));
+	active_profile = profile;
+	App_ApplySettings();
+}
+
+
+
+int32_t App_ReadProfileFile()
+{
+	/* the profile file holds the name of the profile to use, and can be edited along with the settings file */
+	FIL fil;
+	char name[SETTING_PROFILE_NAME_LEN + 2];
+	UINT bytes_read = 0;
+	if (f_open(&fil, PROFILE_FILE, FA_READ) != FR_OK) {return -1;}
+	(void)f_read(&fil, name, sizeof(name) - 1, &bytes_read);
+	(void)f_close(&fil);
+
+	uint32_t name_len = 0;
+	while (name_len < bytes_read && name[name_len] != '\r' && name[name_len] != '\n' && name[name_len] != ' ') {name_len++;}
+	return Setting_FindProfile(&profiles, name, name_len);
+}
+
+
+
+uint8_t App_CheckBudget()
+{
+	/* predict whether the sensors, the SPI buses and the card can keep up with the settings in use */
+	ThroughputBudget budget;
+	ThroughputBudget_Init(&budget);
+	for (uint8_t i = 0; i < 4; i++)
 	{
-		trigger_enabled = 1;
-		if (Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ACCEL_TRIGGER_ANY_AXIS_ID)->value)
+		SPI_HandleTypeDef* spi = sensor_array[i].spi;
+		uint8_t bus = spi->Instance == SPI1 ? 0 : 1;
+		uint32_t pclk_hz = spi->Instance == SPI1 ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+		ThroughputBudget_SetBus(&budget, bus, (float)pclk_hz / (float)(2 << (spi->Init.BaudRatePrescaler >> SPI_CR1_BR_Pos)));
+
+		/* the address byte and 6 data bytes are read for each sample */
+		float odr_hz = sensor_enabled[i] ? recording_header.channels[i].odr_hz : 0.0f;
+		if (channel_files_enabled)
 		{
-			trigger_on_axis[0] = 1;
-			trigger_on_axis[1] = 1;
-			trigger_on_axis[2] = 1;
+			ThroughputBudget_SetChannel(&budget, i, odr_hz, bus, 7, CHANNEL_FILE_RECORD_SIZE, i);
+			ThroughputBudget_SetStream(&budget, i, channel_logger[i].data_buffer_len / 2);
 		}
 		else
 		{
-			trigger_on_axis[Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ACCEL_TRIGGER_AXIS_ID)->value] = 1;
+			ThroughputBudget_SetChannel(&budget, i, odr_hz, bus, 7, sizeof(DataPoint), 0);
 		}
 	}
-	trigger_on_rising_edge = Setting_GetById(settings_array, NUMEL(settings_array), SETTING_ACCEL_TRIGGER_EDGE_ID)->value;
+	if (!channel_files_enabled) {ThroughputBudget_SetStream(&budget, 0, sizeof(data_buffer) / 2);}
+	uint8_t budget_ok = ThroughputBudget_Evaluate(&budget, 1000.0f * (float)settings[SET_CARD_WRITE_SPEED], 1000.0f * (float)settings[SET_CARD_WRITE_LATENCY]);
 
+	/* leave the numbers on the card for the user */
+	if (SDStorage_Open(&storage))
+	{
+		FIL fil;
+		char report[512];
+		UINT bytes_written;
+		uint32_t len = snprintf(report, sizeof(report), "# predicted throughput of the %s settings\n", active_profile < 0 ? SETTINGS_BASE_PROFILE_NAME : profiles.names[active_profile]);
+		len += ThroughputBudget_Format(&budget, report + len, sizeof(report) - len);
+		if (f_open(&fil, BUDGET_FILE, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK)
+		{
+			(void)f_write(&fil, report, len, &bytes_written);
+			(void)f_close(&fil);
+		}
+	}
+
+	return budget_ok;
+}
+
+
+
+void App_WriteBootLog()
+{
+	/* one "stage_us = time" line for each stage, counted from the start of App_Setup */
+	FIL fil;
+	char log[320];
+	UINT bytes_written;
+	uint32_t len = snprintf(log, sizeof(log), "reset_to_setup_ms = %lu\n", boot_reset_millis);
+	for (uint8_t i = 0; i < BOOT_STAGE_COUNT && len < sizeof(log); i++)
+		len += snprintf(log + len, sizeof(log) - len, "%s_us = %lu\n", boot_stage_names[i], boot_stage_micros[i]);
+	if (len < sizeof(log)) {len += snprintf(log + len, sizeof(log) - len, "settings_cached = %u\n", settings_cached);}
+	if (len >= sizeof(log)) {len = sizeof(log) - 1;}
+
+	if (f_open(&fil, BOOT_LOG_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {return;}
+	(void)f_write(&fil, log, len, &bytes_written);
+	(void)f_close(&fil);
+}
+
+
+
+uint32_t App_SettingsFileKey()
+{
+	/* the settings file is recognised by its size and time stamp, along with the settings this firmware has */
+	FILINFO info;
+	if (f_stat(SETTINGS_FILE, &info) != FR_OK) {return 0;}
+
+	uint32_t stamp[2] = {info.fsize, ((uint32_t)info.fdate << 16) | info.ftime};
+	uint32_t key = Setting_Hash((const char*)stamp, sizeof(stamp), Setting_SchemaHash(settings_schema, SET_COUNT));
+	return key != 0 ? key : 1;  /* zero means there is no file */
+}
+
+
+
+uint8_t App_LoadSettingsCache(uint32_t key)
+{
+	SettingsCache cache;
+	if (key == 0 || !FlashStore_Load(SETTINGS_CACHE_ADDRESS, key, &cache, sizeof(cache))) {return 0;}
+	if (cache.profile_count > SETTING_MAX_PROFILES) {return 0;}
+
+	memcpy(settings, cache.base, sizeof(settings));
+	profiles.count = cache.profile_count;
+	memcpy(profiles.names, cache.profile_names, sizeof(profiles.names));
+	memcpy(profile_values, cache.profile_values, sizeof(profile_values));
+	return 1;
+}
+
+
+
+uint8_t App_SaveSettingsCache(uint32_t key)
+{
+	SettingsCache cache;
+	if (key == 0) {return 0;}
+
+	memcpy(cache.base, base_settings, sizeof(cache.base));
+	cache.profile_count = profiles.count;
+	memcpy(cache.profile_names, profiles.names, sizeof(cache.profile_names));
+	memcpy(cache.profile_values, profile_values, sizeof(cache.profile_values));
+	return FlashStore_Save(SETTINGS_CACHE_ADDRESS, SETTINGS_CACHE_SECTOR, key, &cache, sizeof(cache));
+}
+
+
+
+uint8_t App_PrepareCard()
+{
+	/* the settings file waits in the second half of the data buffer while the first half is the formatting work area */
+	FIL fil;
+	char* settings_text = (char*)data_buffer + sizeof(data_buffer) / 2;
+	UINT settings_len = 0, bytes_written = 0;
+	if (f_open(&fil, SETTINGS_FILE, FA_READ) == FR_OK)
+	{
+		if (f_size(&fil) > sizeof(data_buffer) / 2 || f_read(&fil, settings_text, sizeof(data_buffer) / 2, &settings_len) != FR_OK) {settings_len = 0;}
+		(void)f_close(&fil);
+	}
+
+	if (!SDStorage_Format(&storage, (void*)data_buffer, sizeof(data_buffer) / 2, CARD_PREP_MARKER_FILE)) {return 0;}
+
+	/* without a copy a new file is written from the values in use */
+	if (settings_len == 0) {return Setting_RewriteFile(settings_schema, settings, SET_COUNT, SETTINGS_FILE, (char*)data_buffer, sizeof(data_buffer));}
+
+	if (f_open(&fil, SETTINGS_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {return 0;}
+	uint8_t result = f_write(&fil, settings_text, settings_len, &bytes_written) == FR_OK && bytes_written == settings_len;
+	return f_close(&fil) == FR_OK && result;
+}
+
+
+
+uint8_t App_WriteProfileFile()
+{
+	FIL fil;
+	char name[SETTING_PROFILE_NAME_LEN + 1];
+	UINT bytes_written;
+	uint32_t name_len = snprintf(name, sizeof(name), "%s\n", active_profile < 0 ? SETTINGS_BASE_PROFILE_NAME : profiles.names[active_profile]);
+	if (f_open(&fil, PROFILE_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {return 0;}
+	FRESULT fresult = f_write(&fil, name, name_len, &bytes_written);
+	return f_close(&fil) == FR_OK && fresult == FR_OK && bytes_written == name_len;
 }
 
 
@@ -295,8 +797,15 @@ void App_Loop()
 	{
 		case IDLE_ENTRY:
 		{
-			/* set the idle LED sequence */
-			LEDSequence_SetBlinkSequence(&led, idle_blink_sequence, NUMEL(idle_blink_sequence));
+			/* set the idle LED sequence, or the saving one while a recording is still being converted */
+			if (converter.active)
+			{
+				LEDSequence_SetBlinkSequence(&led, saving_blink_sequence, NUMEL(saving_blink_sequence));
+			}
+			else
+			{
+				LEDSequence_SetBlinkSequence(&led, idle_blink_sequence, NUMEL(idle_blink_sequence));
+			}
 
 			/* go to idle state */
 			state = IDLE;
@@ -306,9 +815,65 @@ void App_Loop()
 
 		case IDLE:
 		{
-			/* check the button */
-			if (ButtonDebounced_GetPressed(&button))
+			/* pick up the oldest recording that hasn't been converted yet */
+			if (!converter.active && convert_queue_check && data_formatting_enabled && SDStorage_Open(&storage))
+			{
+				convert_queue_check = CSVConverter_StartNext(&converter, DATA_FILE_NAME, DATA_FILE_EXT);
+				if (converter.active)
+				{
+					LEDSequence_SetBlinkSequence(&led, saving_blink_sequence, NUMEL(saving_blink_sequence));
+				}
+				else
+				{
+					if (converter.fresult != FR_OK) {LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));}  /* dropped, try the next one */
+					LEDSequence_SetBlinkSequence(&led, idle_blink_sequence, NUMEL(idle_blink_sequence));  /* queue is empty */
+				}
+			}
+
+			if (converter.active)
+			{
+				/* convert the binary data files to CSV a block at a time in the background */
+				if (!SDStorage_Open(&storage))
+				{
+					CSVConverter_Pause(&converter);  /* card removed, carry on once it is back */
+				}
+				else if (!CSVConverter_Step(&converter) && converter.fresult != FR_OK)
+				{
+					/* the conversion failed and the recording was dropped, carry on with the rest of the queue unless it couldn't be taken off */
+					LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));
+					convert_queue_check = !converter.queue_blocked;
+				}
+
+				if (!converter.active && !convert_queue_check) {LEDSequence_SetBlinkSequence(&led, idle_blink_sequence, NUMEL(idle_blink_sequence));}
+			}
+			else
+			{
+				/* release the card if it is removed or has been idle for a long time */
+				SDStorage_Update(&storage);
+			}
+
+			/* check the button, a long press moves on to the next profile and a short one starts a recording */
+			uint8_t gesture = ButtonDebounced_GetGesture(&button, PROFILE_SWITCH_HOLD_MICROS);
+			if (gesture == BUTTON_LONG_PRESS)
+			{
+				App_SelectProfile(active_profile + 1);
+				uint8_t saved = SDStorage_Open(&storage) && App_WriteProfileFile();
+				uint8_t budget_ok = App_CheckBudget();
+				if (SPISequence_Wait(&sensor_sequence, time_micros_ptr, SENSOR_CONFIG_TIMEOUT_MICROS)) {state = IMU_ERROR_ENTRY;}
+
+				/* blink the profile number, base settings once, or the error burst if it couldn't be kept for next time */
+				uint32_t blinks = active_profile + 2;
+				profile_burst_sequence[0] = 1000000;
+				for (uint32_t i = 1; i < 2 * blinks; i++) {profile_burst_sequence[i] = 100000;}
+				if (!saved) {LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));}
+				else if (!budget_ok) {LEDSequence_SetBurstSequence(&led, budget_burst_sequence, NUMEL(budget_burst_sequence));}
+				else {LEDSequence_SetBurstSequence(&led, profile_burst_sequence, 2 * blinks);}
+			}
+			else if (gesture == BUTTON_SHORT_PRESS)
 			{
+				/* a new recording takes priority, the conversion picks up again once it is saved */
+				CSVConverter_Pause(&converter);
+
 				if (delay_before_armed > 0)
 				{
 					state = STAGING_ENTRY;
@@ -356,19 +921,53 @@ void App_Loop()
 			/* set the armed LED sequence */
 			LEDSequence_SetBlinkSequence(&led, armed_blink_sequence, NUMEL(armed_blink_sequence));
 
-			/* get the recording file ready so we can start recording immediately once we see the threshold */
-			fresult = f_mount(&fs, "/", 1);
-			SDLogger_StartRecording(&logger, DATA_FILE_NAME, DATA_FILE_EXT, raw_data_file_name, &recording_number);
-
+			/* get the recording file ready so we can start recording immediately once we see the threshold, the next event of a multi-shot series goes in the same one */
+			if (!series_open)
+			{
+				if (!SDStorage_Open(&storage))
+				{
+					/* no usable card so alert the user and stay idle */
+					LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));
+					state = IDLE_ENTRY;
+					break;
+				}
+				recording_header.header_size = sizeof(recording_header) + logger.header_reserve;
+				recording_header.trigger_micros = 0;
+				recording_header.trigger_sample = 0;
+				recording_header.event_count = 0;
+				recording_header.event_capacity = multi_shot_enabled ? multi_shot_max_events : 0;
+				if (raw_logging_enabled)
+					SDLogger_StartRawRecording(&logger, RAW_LOG_FILE, raw_region_size_mb, recording_header.settings, &recording_number);
+				else if (channel_files_enabled && !App_ChannelNamesAreShort())
+					logger.fresult = FR_INVALID_NAME;  /* checked before the data file is created so it isn't left with only a header */
+				else
+					SDLogger_StartRecording(&logger, DATA_FILE_NAME, DATA_FILE_EXT, RECORDING_INDEX_FILE, raw_data_file_name, &recording_number);
+				if (channel_files_enabled && logger.fresult == FR_OK) {App_StartChannelRecordings();}
+				if (logger.fresult != FR_OK)
+				{
+					/* couldn't create the recording (e.g. the raw region is full or the recording numbers have run out) */
+					LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));
+					state = IDLE_ENTRY;
+					break;
+				}
+				series_open = multi_shot_enabled;
+			}
+			event_trigger_micros = 0;
 
 			/* Enable the accelerometers to look for the acceleration threshold but don't record data yet */
 			for (uint8_t i = 0; i < 4; i++)
 				if (sensor_enabled[i])
 					SPISensor_Enable(&sensor_array[i]);
 
-			/* reset the data buffer indices */
+			/* reset the data buffer indices, the time stamps count from arming until the recording starts */
+			time_recording_started = *time_micros_ptr;
 			data_pending_index = 0;
 			data_read_index = 0;
+			data_ring_wrapped = 0;
+			trigger_fired = 0;
+			Trigger_Reset(&trigger);
+			trigger_armed = trigger_enabled;
+			Activity_Reset(&activity, *time_micros_ptr);  /* the averages follow the sensors while armed, ready for the recording */
 
 			/* enable accelerometer interrupts */
 			App_EnableAccelerometerInterrupts();
@@ -384,58 +983,15 @@ void App_Loop()
 		case ARMED:
 		{
 
-			/* wait until we see the acceleration threshold from any of the enabled sensors */
-			if (data_read_index > 0)
-			{
-				uint32_t i = data_read_index - 1;  /* this will be the data point we most recently acquired */
-				float accel[3];
-				uint32_t has_accel_data = 0;
-				switch (data_buffer[i].data_type)  /* need to figure out how to convert the raw data to g based on which sensor it came from */
-				{
-					case LSM6DSx_INT1_Pin:
-					{
-						has_accel_data = 1;
-						sensor_array[0].process_data((uint8_t*)data_buffer[i].data, sensor_units_per_bit[0], &accel[0], &accel[1], &accel[2]);
-						break;
-					}
-					case IIS3DWB_INT1_Pin:
-					{
-						has_accel_data = 1;
-						sensor_array[2].process_data((uint8_t*)data_buffer[i].data, sensor_units_per_bit[2], &accel[0], &accel[1], &accel[2]);
-						break;
-					}
-					case ADXL37x_INT1_Pin:
-					{
-						has_accel_data = 1;
-						sensor_array[3].process_data((uint8_t*)data_buffer[i].data, sensor_units_per_bit[3], &accel[0], &accel[1], &accel[2]);
-						break;
-					}
-				}
-
-				if (has_accel_data)
-				{
-					for (uint32_t i = 0; i < 3; i++)
-					{
-						if (trigger_on_rising_edge)
-						{
-							if (trigger_on_axis[i] && fabs(accel[i]) > accel_threshold_g)
-							{
-								state = RECORDING_ENTRY;
-								break;
-							}
-						}
-						else
-						{
-							if (trigger_on_axis[i] && fabs(accel[i]) < accel_threshold_g)
-							{
-								state = RECORDING_ENTRY;
-								break;
-							}
-						}
-					}
-				}
-
+			/* wait until the timer interrupt sees the acceleration threshold from any of the enabled sensors */
+			if (trigger_fired)
+				state = RECORDING_ENTRY;
 
+			/* press the button to stop waiting, the recording is saved without data */
+			if (ButtonDebounced_GetPressed(&button))
+			{
+				App_StopSensors();
+				state = SAVING_ENTRY;
 			}
 
 			break;
@@ -446,6 +1002,17 @@ void App_Loop()
 			/* set the recording LED sequence */
 			LEDSequence_SetBlinkSequence(&led, recording_blink_sequence, NUMEL(recording_blink_sequence));
 
+			/* the auto stop hold time counts from the start of the recording */
+			activity.last_motion_micros = *time_micros_ptr;
+			rearm_after_saving = 0;
+
+			/* keep the data from the trigger (and the window before it) on, the state moves on as the logger joins the buffer */
+			if (trigger_joins_buffer)
+			{
+				App_JoinPretrigger(trigger_index);
+				break;
+			}
+
 			/* store the starting time stamp and reset data buffer indices */
 			time_recording_started = *time_micros_ptr;
 			data_pending_index = 0;
@@ -461,19 +1028,24 @@ void App_Loop()
 		{
 			/* update the SD card data logger */
 			SDLogger_Update(&logger);
-
-			/* stop the recording if button pressed or max time exceeded */
-			if (ButtonDebounced_GetPressed(&button) || *time_micros_ptr - time_recording_started > max_recording_length)
+			uint8_t write_failed = logger.fresult != FR_OK;
+			for (uint8_t i = 0; i < 4; i++)
 			{
-				/* disable accelerometer interrupts */
-				App_DisableAccelerometerInterrupts();
+				if (!channel_files_enabled || !sensor_enabled[i]) {continue;}
+				SDLogger_Update(&channel_logger[i]);
+				if (channel_logger[i].fresult != FR_OK) {write_failed = 1;}
+			}
 
-				/* put the accelerometer in standby mode */
-				for (uint8_t i = 0; i < 4; i++)
-				{
-					SPISensor_Disable(&sensor_array[i]);
-				}
+			/* stop the recording if button pressed, max time exceeded or the motion has settled, or if the card stopped taking data */
+			uint8_t pressed = ButtonDebounced_GetPressed(&button);
+			uint8_t settled = auto_stop_enabled && Activity_IsSettled(&activity, *time_micros_ptr, auto_stop_hold_micros);
+			if (write_failed || pressed || settled || *time_micros_ptr - time_recording_started > max_recording_length + event_trigger_micros)
+			{
+				if (write_failed) {LEDSequence_SetBurstSequence(&led, error_burst_sequence, NUMEL(error_burst_sequence));}
 
+				/* be ready for the next event in a multi-shot series, or after a recording that settled if set to re-arm, until the button is pressed */
+				rearm_after_saving = !write_failed && !pressed && (series_open || (settled && auto_stop_rearm));
+				App_StopSensors();
 				state = SAVING_ENTRY;
 			}
 
@@ -482,129 +1054,29 @@ void App_Loop()
 
 		case SAVING_ENTRY:
 		{
-			/* set the saving LED sequence */
-			LEDSequence_SetBlinkSequence(&led, saving_blink_sequence, NUMEL(saving_blink_sequence));
-
-			/* write the remaining data in the buffer and close the file */
-			SDLogger_StopRecording(&logger);
-			fresult = f_mount(NULL, "/", 1);
-
-			if (data_formatting_enabled)
+			/* an event of a multi-shot series goes in the table, and the recording stays open for the next one until the table is full */
+			if (event_open) {App_EndEvent();}
+			if (series_open && rearm_after_saving && logger.fresult == FR_OK && recording_header.event_count < recording_header.event_capacity)
 			{
-				/* open the binary data file for reading and converting to CSV */
-				fresult = f_mount(&fs, "/", 1);
-				fresult = f_open(&raw_data_file, raw_data_file_name, FA_READ);
-
-				state = SAVING;
-			}
-			else
-			{
-				state = IDLE_ENTRY;
+				rearm_after_saving = 0;
+				state = ARMED_ENTRY;
+				break;
 			}
+			series_open = 0;
 
-			break;
-		}
-
-		case SAVING:
-		{
-			/* convert the binary data files to CSV */
-			if (!f_eof(&raw_data_file))
-			{
-				/* read the next data from the file */
-				DataPoint data_point;
-				fresult = f_read(&raw_data_file, &data_point, sizeof(data_point), &write_count);
-
-				/* convert the data to physical units and save to the appropriate file based on which channel it came from */
-				float data_x, data_y, data_z;
-				char formatted_data[100];
-				uint8_t formatted_bytes;
-				if (data_point.data_type == LSM6DSx_INT1_Pin)
-				{
-					/* LSM6DSx accelerometer */
-					sensor_array[0].process_data(data_point.data, sensor_units_per_bit[0], &data_x, &data_y, &data_z);
-
-					if (!output_file_is_open[0])  /* open the file and write the header */
-					{
-						char buf[16];
-						snprintf(buf, 16, LSM6DSx_ACCEL_FILE, recording_number);
-						fresult = f_open(&output_file_array[0], buf, FA_CREATE_ALWAYS|FA_WRITE);
-						f_printf(&output_file_array[0], "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
-						output_file_is_open[0] = 1;
-					}
-
-					formatted_bytes = snprintf(formatted_data, 100, "%lu,%f,%f,%f\n", data_point.time_micros, data_x, data_y, data_z);
-					fresult = f_write(&output_file_array[0], formatted_data, formatted_bytes, &write_count);
-				}
-				else if (data_point.data_type == LSM6DSx_INT2_Pin)
-				{
-					/* LSM6DSx gyroscope */
-					sensor_array[1].process_data(data_point.data, sensor_units_per_bit[1], &data_x, &data_y, &data_z);
-
-					if (!output_file_is_open[1])  /* open the file and write the header */
-					{
-						char buf[16];
-						snprintf(buf, 16, LSM6DSx_GYRO_FILE, recording_number);
-						fresult = f_open(&output_file_array[1], buf, FA_CREATE_ALWAYS|FA_WRITE);
-						f_printf(&output_file_array[1], "Time (us),Rate_x (dps),Rate_y (dps),Rate_z (dps)\n");
-						output_file_is_open[1] = 1;
-					}
-
-					formatted_bytes = snprintf(formatted_data, 100, "%lu,%f,%f,%f\n", data_point.time_micros, data_x, data_y, data_z);
-					fresult = f_write(&output_file_array[1], formatted_data, formatted_bytes, &write_count);
-				}
-				else if (data_point.data_type == IIS3DWB_INT1_Pin)
-				{
-					/* IIS3DWB accelerometer */
-					sensor_array[2].process_data(data_point.data, sensor_units_per_bit[2], &data_x, &data_y, &data_z);
-
-					if (!output_file_is_open[2])  /* open the file and write the header */
-					{
-						char buf[16];
-						snprintf(buf, 16, IIS3DWB_FILE, recording_number);
-						fresult = f_open(&output_file_array[2], buf, FA_CREATE_ALWAYS|FA_WRITE);
-						f_printf(&output_file_array[2], "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
-						output_file_is_open[2] = 1;
-					}
-
-					formatted_bytes = snprintf(formatted_data, 100, "%lu,%f,%f,%f\n", data_point.time_micros, data_x, data_y, data_z);
-					fresult = f_write(&output_file_array[2], formatted_data, formatted_bytes, &write_count);
-				}
-				else if (data_point.data_type == ADXL37x_INT1_Pin)
-				{
-					/* ADXL37x accelerometer */
-					sensor_array[3].process_data(data_point.data, sensor_units_per_bit[3], &data_x, &data_y, &data_z);
-
-					if (!output_file_is_open[3])  /* open the file and write the header */
-					{
-						char buf[16];
-						snprintf(buf, 16, ADXL37x_FILE, recording_number);
-						fresult = f_open(&output_file_array[3], buf, FA_CREATE_ALWAYS|FA_WRITE);
-						f_printf(&output_file_array[3], "Time (us),Accel_x (g),Accel_y (g),Accel_z (g)\n");
-						output_file_is_open[3] = 1;
-					}
-
-					formatted_bytes = snprintf(formatted_data, 100, "%lu,%f,%f,%f\n", data_point.time_micros, data_x, data_y, data_z);
-					fresult = f_write(&output_file_array[3], formatted_data, formatted_bytes, &write_count);
-				}
-
-			}
-			else
-			{
-				/* we have reached the end of the raw data file */
-				for (uint8_t i = 0; i < 4; i++)
-				{
-					if (output_file_is_open[i])
-					{
-						fresult = f_close(&output_file_array[i]);
-						output_file_is_open[i] = 0;
-					}
-				}
+			/* write the remaining data in the buffer and close the file */
+			SDLogger_StopRecording(&logger);
+			for (uint8_t i = 0; i < 4; i++)
+				if (channel_files_enabled && sensor_enabled[i])
+					SDLogger_StopRecording(&channel_logger[i]);
+			(void)SDStorage_Open(&storage);
 
-				fresult = f_close(&raw_data_file);
-				fresult = f_mount(NULL, "/", 1);
+			/* the new recording joins the conversion queue, raw recordings are extracted on the host */
+			convert_queue_check = 1;
 
-				state = IDLE_ENTRY;
-			}
+			/* the queue is converted once back in the idle state, after the last event when re-arming */
+			state = rearm_after_saving && logger.fresult == FR_OK ? ARMED_ENTRY : IDLE_ENTRY;
+			rearm_after_saving = 0;
 
 			break;
 		}
@@ -642,7 +1114,11 @@ void App_PinInterrupt(uint16_t GPIO_Pin)
 	data_buffer[data_pending_index].data_type = GPIO_Pin;
 
 	/* increment the global data buffer index */
-	if (++data_pending_index == CD_LOGGER_DATA_BUFFER_LEN) {data_pending_index = 0;}
+	if (++data_pending_index == data_ring_len)
+	{
+		data_pending_index = 0;
+		data_ring_wrapped = 1;
+	}
 }
 
 
@@ -659,9 +1135,10 @@ void App_TimerInterrupt()
 	{
 		/* figure out which sensor has data pending */
 		SPISensor* sensor;
-		for (uint8_t i = 0; i < 4; i++)
+		uint8_t k;
+		for (k = 0; k < 4; k++)
 		{
-			sensor = &sensor_array[i];
+			sensor = &sensor_array[k];
 			if (sensor->int_pin == data_buffer[data_read_index].data_type)
 			{
 				break;
@@ -692,11 +1169,30 @@ void App_TimerInterrupt()
 		/* chip select high */
 		sensor->cs_port->BSRR = (uint32_t)sensor->cs_pin;
 
+		/* the auto stop follows the accelerometers while armed and recording */
+		if (auto_stop_enabled && k < 4) {Activity_Update(&activity, k, (const uint8_t*)data_buffer[data_read_index].data, *time_micros_ptr);}
+
+		/* while armed run every data point through the trigger as it comes in, the counts straight from the sensor bytes */
+		if (trigger_armed && k < 4 && Trigger_Update(&trigger, k, (const uint8_t*)data_buffer[data_read_index].data, data_buffer[data_read_index].time_micros))
+		{
+			trigger_index = data_read_index;
+			trigger_armed = 0;
+			trigger_fired = 1;
+		}
+
+		/* in channel files mode copy the data point into the buffer of its channel, leaving out the data type */
+		if (state == RECORDING && channel_files_enabled && k < 4)
+		{
+			SDLogger* channel = &channel_logger[k];
+			memcpy(channel->data_buffer + channel->data_buffer_index, (const void*)&data_buffer[data_read_index], CHANNEL_FILE_RECORD_SIZE);
+			SDLogger_IncrementDataIndex(channel);
+		}
+
 		/* increment the data read index */
-		if (++data_read_index == CD_LOGGER_DATA_BUFFER_LEN) {data_read_index = 0;}
+		if (++data_read_index == data_ring_len) {data_read_index = 0;}
 
 		/* also increment the logger index if we are recording */
-		if (state == RECORDING)
+		if (state == RECORDING && !channel_files_enabled)
 			SDLogger_IncrementDataIndex(&logger);
 
 	}
@@ -706,6 +1202,131 @@ void App_TimerInterrupt()
 }
 
 
+/*
+ * Hand the SPI transmit complete interrupts to the sensor configuration in progress
+ */
+void App_SPITransmitComplete(SPI_HandleTypeDef* hspi, uint8_t error)
+{
+	SPISequence_TransmitComplete(&sensor_sequence, hspi, error);
+}
+
+
+/*
+ * Start the recording pretrigger_micros before the data point that set off the trigger (or with it, without a pre-trigger
+ * window) from the data already in the buffer, so the trigger is always at that time stamp however late it was noticed.
+ * Everything after the window start is kept, up to half the buffer since the half that holds the start has to be written
+ * out before the sensor interrupts come round to it again.
+ */
+void App_JoinPretrigger(uint32_t trigger_index)
+{
+	uint32_t trigger_stamp = data_buffer[trigger_index].time_micros;
+	uint32_t origin = trigger_stamp - pretrigger_micros;  /* since arming, wraps if the trigger came sooner */
+
+	/* the first event of a recording starts its time stamps, the later ones of a multi-shot series carry on from there */
+	uint8_t first_event = !series_open || recording_header.event_count == 0;
+	uint32_t shift = first_event ? origin : series_started - time_recording_started;
+
+	/* look back from the last read for the first data point in the window, the time stamps only ever increase */
+	uint32_t first = data_read_index;
+	uint32_t half_len = CD_LOGGER_DATA_BUFFER_LEN / 2;
+	for (uint32_t count = 0; count < half_len - PRETRIGGER_MARGIN_LEN; count++)
+	{
+		if (first == 0 && !data_ring_wrapped) {break;}
+		uint32_t previous = first == 0 ? CD_LOGGER_DATA_BUFFER_LEN - 1 : first - 1;
+		if ((int32_t)(data_buffer[previous].time_micros - origin) < 0) {break;}
+		first = previous;
+	}
+
+	/* new data points are stamped from the window start, and the logger follows the reads from here on */
+	__disable_irq();
+	time_recording_started += shift;
+	uint32_t pending = data_pending_index;
+	uint32_t read = data_read_index;
+	if ((read + CD_LOGGER_DATA_BUFFER_LEN - first) % CD_LOGGER_DATA_BUFFER_LEN > half_len) {first = (read + CD_LOGGER_DATA_BUFFER_LEN - half_len) % CD_LOGGER_DATA_BUFFER_LEN;}
+	uint32_t first_point = logger.data_point_count;
+	uint32_t padding = SDLogger_JoinBuffer(&logger, first * sizeof(DataPoint), read * sizeof(DataPoint), first_event);
+	state = RECORDING;
+	__enable_irq();
+
+	/* the data points already stamped were timed from arming, the ones being read now are left alone by the interrupts */
+	for (uint32_t i = first; i != pending; i = i + 1 == CD_LOGGER_DATA_BUFFER_LEN ? 0 : i + 1)
+		data_buffer[i].time_micros -= shift;
+	event_trigger_micros = trigger_stamp - shift;
+	uint32_t trigger_point = (trigger_index + CD_LOGGER_DATA_BUFFER_LEN - first) % CD_LOGGER_DATA_BUFFER_LEN;
+
+	/* the header goes out with the first data, it skips the event table and the part of the first sector from before the window */
+	if (first_event)
+	{
+		recording_header.header_size = sizeof(recording_header) + logger.header_reserve + padding;
+		recording_header.trigger_micros = event_trigger_micros;
+		recording_header.trigger_sample = trigger_point;
+		series_started = time_recording_started;
+	}
+
+	/* the event's table entry is written once it ends */
+	if (series_open)
+	{
+		recording_event.first_point = first_point;
+		recording_event.point_count = 0;
+		recording_event.trigger_micros = event_trigger_micros;
+		recording_event.trigger_point = first_point + trigger_point;
+		event_open = 1;
+	}
+}
+
+
+
+/*
+ * Close off the event in progress of a multi-shot series, its data goes out first and then its table entry and the new
+ * event count, so the table never lists data that isn't on the card.
+ */
+void App_EndEvent()
+{
+	event_open = 0;
+	SDLogger_Flush(&logger);
+	recording_event.point_count = logger.data_point_count - recording_event.first_point;
+	uint32_t n = recording_header.event_count;
+	if (logger.fresult == FR_OK) {SDLogger_Rewrite(&logger, sizeof(recording_header) + n * sizeof(RecordingEvent), &recording_event, sizeof(RecordingEvent));}
+	recording_header.event_count = n + 1;
+	if (logger.fresult == FR_OK) {SDLogger_Rewrite(&logger, offsetof(RecordingHeader, event_count), &recording_header.event_count, sizeof(recording_header.event_count));}
+}
+
+
+
+/*
+ * Check that the channel file names stay 8.3 for every recording number, the card can't hold longer ones
+ */
+uint8_t App_ChannelNamesAreShort()
+{
+	for (uint8_t i = 0; i < 4; i++)
+		if (sensor_enabled[i] && !SDLogger_IsShortName(channel_name[i], CHANNEL_FILE_EXT))
+			return 0;
+	return 1;
+}
+
+/*
+ * Open the channel files of a new recording, numbered after the data file that was just created
+ */
+void App_StartChannelRecordings()
+{
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		if (!sensor_enabled[i]) {continue;}
+		SDLogger_StartChannelRecording(&channel_logger[i], channel_name[i], CHANNEL_FILE_EXT, recording_number, channel_preallocate_bytes[i]);
+		if (channel_logger[i].fresult == FR_OK) {continue;}
+
+		/* close everything opened so far and report the failure through the main logger */
+		FRESULT fresult = channel_logger[i].fresult;
+		while (i-- > 0)
+			if (sensor_enabled[i])
+				SDLogger_StopRecording(&channel_logger[i]);
+		SDLogger_StopRecording(&logger);
+		logger.fresult = fresult;
+		return;
+	}
+}
+
+
 void App_EnableAccelerometerInterrupts()
 {
 	HAL_NVIC_EnableIRQ(TIM3_IRQn);
@@ -722,3 +1343,16 @@ void App_DisableAccelerometerInterrupts()
 	HAL_NVIC_DisableIRQ(EXTI9_5_IRQn);
 	HAL_NVIC_DisableIRQ(EXTI15_10_IRQn);
 }
+
+
+void App_StopSensors()
+{
+	/* disable accelerometer interrupts */
+	App_DisableAccelerometerInterrupts();
+
+	/* put the accelerometer in standby mode */
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		SPISensor_Disable(&sensor_array[i]);
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Throughput budget of the configured channel mix
+ */
+
+#include "budget.h"
+#include <stdio.h>
+#include <string.h>
+
+void ThroughputBudget_Init(ThroughputBudget* budget)
+{
+	memset(budget, 0, sizeof(ThroughputBudget));
+}
+
+void ThroughputBudget_SetBus(ThroughputBudget* budget, uint8_t bus, float clock_hz)
+{
+	/* bus 0 is reported as SPI1 and so on */
+	budget->bus_clock_hz[bus] = clock_hz;
+}
+
+void ThroughputBudget_SetStream(ThroughputBudget* budget, uint8_t stream, uint32_t half_bytes)
+{
+	budget->stream_half_bytes[stream] = half_bytes;
+}
+
+void ThroughputBudget_SetChannel(ThroughputBudget* budget, uint8_t channel, float odr_hz, uint8_t bus, uint32_t read_bytes, uint32_t record_bytes, uint8_t stream)
+{
+	budget->odr_hz[channel] = odr_hz;
+	budget->bus[channel] = bus;
+	budget->read_bytes[channel] = read_bytes;
+	budget->record_bytes[channel] = record_bytes;
+	budget->stream[channel] = stream;
+}
+
+uint8_t ThroughputBudget_Evaluate(ThroughputBudget* budget, float card_bytes_per_sec, float card_latency_micros)
+{
+	float stream_bytes_per_sec[BUDGET_MAX_CHANNELS] = {0};
+	budget->sample_rate_hz = 0.0f;
+	budget->cpu_load = 0.0f;
+	budget->card_bytes_per_sec = 0.0f;
+	memset(budget->bus_load, 0, sizeof(budget->bus_load));
+
+	/* the reads are polled, so the CPU is busy for as long as the bus is */
+	for (uint8_t i = 0; i < BUDGET_MAX_CHANNELS; i++)
+	{
+		float odr_hz = budget->odr_hz[i];
+		if (odr_hz <= 0.0f || budget->bus_clock_hz[budget->bus[i]] <= 0.0f) {continue;}
+
+		float read_micros = budget->read_bytes[i] * (8000000.0f / budget->bus_clock_hz[budget->bus[i]] + BUDGET_BYTE_GAP_MICROS) + BUDGET_READ_OVERHEAD_MICROS;
+		budget->sample_rate_hz += odr_hz;
+		budget->bus_load[budget->bus[i]] += 0.000001f * odr_hz * read_micros;
+		budget->cpu_load += 0.000001f * odr_hz * (read_micros + BUDGET_PIN_INTERRUPT_MICROS);
+		budget->card_bytes_per_sec += odr_hz * budget->record_bytes[i];
+		stream_bytes_per_sec[budget->stream[i]] += odr_hz * budget->record_bytes[i];
+	}
+
+	/* every stream with data has to get a half out to the card before its quickest one fills up again */
+	budget->fill_micros = 0.0f;
+	budget->write_micros = 0.0f;
+	for (uint8_t i = 0; i < BUDGET_MAX_CHANNELS; i++)
+	{
+		if (stream_bytes_per_sec[i] <= 0.0f) {continue;}
+
+		float fill_micros = 1000000.0f * budget->stream_half_bytes[i] / stream_bytes_per_sec[i];
+		if (budget->fill_micros == 0.0f || fill_micros < budget->fill_micros) {budget->fill_micros = fill_micros;}
+		budget->write_micros += card_latency_micros + 1000000.0f * budget->stream_half_bytes[i] / card_bytes_per_sec;
+	}
+	if (budget->cpu_load < 1.0f) {budget->write_micros /= 1.0f - budget->cpu_load;}  /* the interrupts take their share first */
+
+	budget->overloads = 0;
+	for (uint8_t i = 0; i < BUDGET_MAX_BUSES; i++)
+		if (budget->bus_load[i] > 1.0f)
+			budget->overloads |= BUDGET_BUS_OVERLOAD;
+	if (budget->cpu_load > BUDGET_MAX_CPU_LOAD) {budget->overloads |= BUDGET_CPU_OVERLOAD;}
+	if (budget->card_bytes_per_sec > card_bytes_per_sec) {budget->overloads |= BUDGET_CARD_OVERLOAD;}
+	if (budget->write_micros > budget->fill_micros) {budget->overloads |= BUDGET_BUFFER_OVERRUN;}
+
+	return budget->overloads == 0;
+}
+
+uint32_t ThroughputBudget_Format(ThroughputBudget* budget, char* buf, uint32_t buf_len)
+{
+	/* one "id = value" line each like the settings file, percentages and milliseconds are easier to read */
+	uint32_t len = snprintf(buf, buf_len, "sample_rate_hz = %.0f\n", budget->sample_rate_hz);
+	for (uint8_t i = 0; i < BUDGET_MAX_BUSES && len < buf_len; i++)
+		len += snprintf(buf + len, buf_len - len, "spi%u_load_pct = %.1f\n", i + 1, 100.0f * budget->bus_load[i]);
+	if (len < buf_len)
+	{
+		len += snprintf(buf + len, buf_len - len, "cpu_load_pct = %.1f  # limit %.0f\ncard_write_kb_s = %.0f\nbuffer_fill_ms = %.1f\nbuffer_write_ms = %.1f  # must be less than the fill time\n",
+						100.0f * budget->cpu_load, 100.0f * BUDGET_MAX_CPU_LOAD, 0.001f * budget->card_bytes_per_sec, 0.001f * budget->fill_micros, 0.001f * budget->write_micros);
+	}
+	if (len < buf_len)
+	{
+		len += snprintf(buf + len, buf_len - len, "result = %s%s%s%s%s\n", budget->overloads ? "samples will be dropped:" : "ok",
+						budget->overloads & BUDGET_BUS_OVERLOAD ? " spi" : "", budget->overloads & BUDGET_CPU_OVERLOAD ? " cpu" : "",
+						budget->overloads & BUDGET_CARD_OVERLOAD ? " card" : "", budget->overloads & BUDGET_BUFFER_OVERRUN ? " buffer" : "");
+	}
+
+	return len < buf_len ? len : buf_len - 1;
+}
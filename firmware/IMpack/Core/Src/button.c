@@ -14,6 +14,8 @@ void ButtonDebounced_Init(ButtonDebounced* button, GPIO_TypeDef* GPIO_Port, uint
 	button->time_micros_ptr = time_micros_ptr;
 	button->time_debounce_micros = time_debounce_micros;
 	button->time_last_press_micros = 0;
+	button->is_held = 0;
+	button->long_press_reported = 0;
 }
 
 uint8_t ButtonDebounced_GetPressed(ButtonDebounced* button)
@@ -29,3 +31,36 @@ uint8_t ButtonDebounced_GetPressed(ButtonDebounced* button)
 	}
 }
 
+uint8_t ButtonDebounced_GetGesture(ButtonDebounced* button, uint32_t long_press_micros)
+{
+	uint32_t time_micros = *(button->time_micros_ptr);
+	uint8_t pin_set = HAL_GPIO_ReadPin(button->GPIO_Port, button->GPIO_Pin) == GPIO_PIN_SET;
+
+	if (!button->is_held)
+	{
+		/* a new press starts the hold timer */
+		if (pin_set && time_micros - button->time_last_press_micros > button->time_debounce_micros)
+		{
+			button->is_held = 1;
+			button->long_press_reported = 0;
+			button->time_hold_started_micros = time_micros;
+		}
+		return BUTTON_NONE;
+	}
+
+	if (!pin_set)
+	{
+		/* released, the de-bounce time counts from here so the release can't look like a new press */
+		button->is_held = 0;
+		button->time_last_press_micros = time_micros;
+		return button->long_press_reported ? BUTTON_NONE : BUTTON_SHORT_PRESS;
+	}
+
+	if (!button->long_press_reported && time_micros - button->time_hold_started_micros > long_press_micros)
+	{
+		button->long_press_reported = 1;
+		return BUTTON_LONG_PRESS;
+	}
+
+	return BUTTON_NONE;
+}
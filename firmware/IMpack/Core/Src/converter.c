@@ -0,0 +1,474 @@
+/*
+ * Conversion of binary recordings to CSV files
+ */
+
+#include "converter.h"
+#include "logger.h"
+#include "recording.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void CSVConverter_Init(CSVConverter* converter, uint8_t* work, uint32_t work_len, char* journal_file_name)
+{
+	/* the read buffer comes first after room for a data point that crosses two reads, the rest is shared evenly by the staging buffers */
+	uint32_t stage_len = (work_len - CSV_CONVERTER_RECORD_SIZE - CSV_CONVERTER_READ_LEN) / CSV_CONVERTER_CHANNELS;
+	converter->read_buf = work + CSV_CONVERTER_RECORD_SIZE;
+
+	/* largest power of 2 block that still leaves room for the line that crosses it */
+	converter->flush_len = SD_LOGGER_SECTOR_SIZE;
+	while (2 * converter->flush_len + CSV_MAX_LINE_LEN <= stage_len) {converter->flush_len *= 2;}
+
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+	{
+		converter->channels[i].data_type = 0;
+		converter->channels[i].is_open = 0;
+		converter->channels[i].stage = (char*)(converter->read_buf + CSV_CONVERTER_READ_LEN + i * stage_len);
+		converter->channels[i].stage_fill = 0;
+		converter->channels[i].checkpoint_size = 0;
+	}
+
+	converter->active = 0;
+	converter->raw_is_open = 0;
+	converter->journal_file_name = journal_file_name;
+	converter->clmt_sclust = 0;
+	converter->fresult = FR_OK;
+	converter->queue_blocked = 0;
+}
+
+void CSVConverter_SetChannel(CSVConverter* converter, uint8_t channel, uint16_t data_type, void (*process_data_raw)(uint8_t*, int16_t*, int16_t*, int16_t*),
+							 uint32_t full_scale, uint8_t resolution, const char* file_name_format, const char* header)
+{
+	converter->channels[channel].data_type = data_type;
+	converter->channels[channel].process_data_raw = process_data_raw;
+	converter->channels[channel].full_scale = full_scale;
+	converter->channels[channel].resolution = resolution;
+	converter->channels[channel].file_name_format = file_name_format;
+	converter->channels[channel].header = header;
+}
+
+static void CSVConverter_Flush(CSVConverter* converter, CSVConverterChannel* channel, uint32_t len)
+{
+	UINT count;
+	FRESULT fresult = f_write(&(channel->fil), channel->stage, len, &count);
+	if (fresult == FR_OK && count != len) {fresult = FR_DENIED;}  /* card full */
+	if (fresult != FR_OK) {converter->fresult = fresult;}
+
+	/* keep the end of the line that went past the block */
+	channel->stage_fill -= len;
+	memmove(channel->stage, channel->stage + len, channel->stage_fill);
+}
+
+static void CSVConverter_FormatChannelName(CSVConverter* converter, CSVConverterChannel* channel, char* name)
+{
+	snprintf(name, 24, channel->file_name_format, converter->recording_number);
+}
+
+static void CSVConverter_OpenChannel(CSVConverter* converter, CSVConverterChannel* channel)
+{
+	char name[24];
+	CSVConverter_FormatChannelName(converter, channel, name);
+	converter->fresult = f_open(&(channel->fil), name, FA_CREATE_ALWAYS|FA_WRITE);
+	if (converter->fresult != FR_OK) {return;}
+	channel->is_open = 1;
+
+	/* the header goes through the staging buffer too so the data blocks stay sector aligned in the file */
+	strcpy(channel->stage, channel->header);
+	channel->stage_fill = strlen(channel->header);
+}
+
+static uint32_t CSVConverter_JournalCheck(CSVConverterJournal* journal)
+{
+	uint32_t check = 0;
+	for (uint32_t* word = (uint32_t*)journal; word < &(journal->check); word++) {check += *word;}
+	return check;
+}
+
+static void CSVConverter_WriteJournal(CSVConverter* converter)
+{
+	CSVConverterJournal journal;
+	journal.magic = CSV_CONVERTER_JOURNAL_MAGIC;
+	journal.recording_number = converter->recording_number;
+	journal.segment = converter->segment;
+	journal.segment_count = converter->segment_count;
+	journal.raw_offset = converter->raw_offset;
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++) {journal.csv_size[i] = converter->channels[i].checkpoint_size;}
+	journal.check = CSVConverter_JournalCheck(&journal);
+
+	FIL fil;
+	UINT count;
+	if (f_open(&fil, converter->journal_file_name, FA_OPEN_ALWAYS|FA_WRITE) != FR_OK) {return;}
+	(void)f_write(&fil, &journal, sizeof(journal), &count);
+	(void)f_close(&fil);
+}
+
+static void CSVConverter_CloseFiles(CSVConverter* converter)
+{
+	/* write out everything that has been converted and close the files, the first error is kept in fresult */
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+	{
+		CSVConverterChannel* channel = &(converter->channels[i]);
+		if (!channel->is_open) {continue;}
+
+		if (channel->stage_fill > 0) {CSVConverter_Flush(converter, channel, channel->stage_fill);}
+		channel->checkpoint_size = f_size(&(channel->fil));
+		FRESULT fresult = f_close(&(channel->fil));
+		if (converter->fresult == FR_OK) {converter->fresult = fresult;}
+		channel->is_open = 0;
+	}
+
+	if (converter->raw_is_open)
+	{
+		converter->raw_offset = f_tell(&(converter->raw_fil));
+		(void)f_close(&(converter->raw_fil));
+		converter->raw_is_open = 0;
+	}
+}
+
+static void CSVConverter_Checkpoint(CSVConverter* converter)
+{
+	/* make the CSV files consistent with the position in the raw file and record both */
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+	{
+		CSVConverterChannel* channel = &(converter->channels[i]);
+		if (!channel->is_open) {continue;}
+
+		if (channel->stage_fill > 0) {CSVConverter_Flush(converter, channel, channel->stage_fill);}
+		FRESULT fresult = f_sync(&(channel->fil));
+		if (converter->fresult == FR_OK) {converter->fresult = fresult;}
+		channel->checkpoint_size = f_size(&(channel->fil));
+	}
+	converter->raw_offset = f_tell(&(converter->raw_fil));
+	converter->steps_since_checkpoint = 0;
+
+	if (converter->fresult == FR_OK) {CSVConverter_WriteJournal(converter);}
+}
+
+static void CSVConverter_End(CSVConverter* converter)
+{
+	/* the job is finished, or failed and is dropped so it isn't retried forever */
+	CSVConverter_CloseFiles(converter);
+
+	/* a failed recording is left unconverted with a marker file saying why, so the rest of the queue isn't held up behind it */
+	char name[24];
+	if (converter->fresult != FR_OK)
+	{
+		FIL fil;
+		sprintf(name, "%s%lu%s", converter->data_file_name, converter->recording_number, CSV_CONVERTER_ERROR_EXT);
+		if (f_open(&fil, name, FA_CREATE_ALWAYS|FA_WRITE) == FR_OK)
+		{
+			(void)f_printf(&fil, "conversion failed in segment %lu, FRESULT %d\n", converter->segment, (int)converter->fresult);
+			(void)f_close(&fil);
+		}
+	}
+
+	/* clear the archive attribute that was set as the logger wrote the raw files, this takes them out of the queue */
+	converter->queue_blocked = 0;
+	for (uint32_t segment = 0; segment < converter->segment_count; segment++)
+	{
+		SDLogger_FormatSegmentName(name, converter->data_file_name, converter->data_file_ext, converter->recording_number, segment);
+		FRESULT fresult = f_chmod(name, 0, AM_ARC);
+		if (segment == 0 && fresult != FR_OK && fresult != FR_NO_FILE) {converter->queue_blocked = 1;}  /* the queue only looks at first segments */
+	}
+
+	(void)f_unlink(converter->journal_file_name);
+	converter->active = 0;
+}
+
+static uint8_t CSVConverter_Open(CSVConverter* converter)
+{
+	/* the recording header in the first segment gives the scales the data was recorded with */
+	char name[24];
+	UINT count = 0;
+	SDLogger_FormatSegmentName(name, converter->data_file_name, converter->data_file_ext, converter->recording_number, 0);
+	converter->fresult = f_open(&(converter->raw_fil), name, FA_READ);
+	if (converter->fresult != FR_OK) {return 0;}
+	converter->raw_is_open = 1;
+	converter->fresult = f_read(&(converter->raw_fil), converter->read_buf, sizeof(RecordingHeader), &count);
+	if (converter->fresult != FR_OK) {return 0;}
+
+	RecordingHeader* header = (RecordingHeader*)converter->read_buf;
+	uint8_t has_header = count == sizeof(RecordingHeader) && RecordingHeader_IsValid(header);
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+	{
+		CSVConverterChannel* channel = &(converter->channels[i]);
+		const RecordingChannel* descriptor = has_header ? RecordingHeader_FindChannel(header, channel->data_type) : NULL;
+		if (descriptor != NULL)
+			CSV_InitScale(&(channel->scale), descriptor->full_scale, descriptor->resolution);
+		else
+			CSV_InitScale(&(channel->scale), channel->full_scale, channel->resolution);  /* older recording, assume the current settings */
+	}
+
+	/* then open the current segment and the CSV files at the last checkpoint */
+	uint32_t data_start = has_header ? header->header_size : 0;
+	if (converter->segment > 0)
+	{
+		(void)f_close(&(converter->raw_fil));
+		converter->raw_is_open = 0;
+		SDLogger_FormatSegmentName(name, converter->data_file_name, converter->data_file_ext, converter->recording_number, converter->segment);
+		converter->fresult = f_open(&(converter->raw_fil), name, FA_READ);
+		if (converter->fresult != FR_OK) {return 0;}
+		converter->raw_is_open = 1;
+		data_start = 0;
+	}
+
+	converter->read_skip = 0;
+	converter->carry_len = 0;
+	if (converter->raw_offset == 0)
+	{
+		/*
+		 * Start of the data, just past the header so the seek barely touches the cluster chain. The header size includes
+		 * the padding of a pre-trigger join, so the read starts from the sector the data begins in and the padding is
+		 * skipped in the buffer, which keeps every read on sector boundaries.
+		 */
+		converter->read_skip = data_start % SD_LOGGER_SECTOR_SIZE;
+		converter->fresult = f_lseek(&(converter->raw_fil), data_start - converter->read_skip);
+		if (converter->fresult != FR_OK) {return 0;}
+	}
+	else
+	{
+		/*
+		 * Seeking in a big file means following its cluster chain through the FAT. The first time we resume in a file the
+		 * chain is walked once into a link map, after that the seek is a lookup. The raw files don't change once they are
+		 * recorded so the map stays valid until we move on to another file.
+		 */
+		if (converter->clmt_sclust != converter->raw_fil.obj.sclust)
+		{
+			converter->clmt[0] = CSV_CONVERTER_CLMT_LEN;
+			converter->raw_fil.cltbl = converter->clmt;
+			converter->clmt_sclust = f_lseek(&(converter->raw_fil), CREATE_LINKMAP) == FR_OK ? converter->raw_fil.obj.sclust : 0;
+		}
+		converter->raw_fil.cltbl = converter->clmt_sclust ? converter->clmt : NULL;  /* too fragmented for the map, seek the slow way */
+
+		/* the data point the last read cut off goes back in front of the read buffer, then the reads carry on from the sector boundary */
+		converter->carry_len = converter->raw_offset > data_start ? (converter->raw_offset - data_start) % CSV_CONVERTER_RECORD_SIZE : 0;
+		converter->fresult = f_lseek(&(converter->raw_fil), converter->raw_offset - converter->carry_len);
+		if (converter->fresult == FR_OK) {converter->fresult = f_read(&(converter->raw_fil), converter->read_buf - converter->carry_len, converter->carry_len, &count);}
+		if (converter->fresult == FR_OK && count != converter->carry_len) {converter->fresult = FR_INT_ERR;}
+		if (converter->fresult != FR_OK) {return 0;}
+	}
+
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+	{
+		CSVConverterChannel* channel = &(converter->channels[i]);
+		channel->stage_fill = 0;
+		if (channel->checkpoint_size == 0) {continue;}  /* created when its first data point comes up */
+
+		/* anything past the checkpoint size was written after the last journal update and is converted again */
+		CSVConverter_FormatChannelName(converter, channel, name);
+		converter->fresult = f_open(&(channel->fil), name, FA_OPEN_EXISTING|FA_WRITE);
+		if (converter->fresult != FR_OK) {return 0;}
+		channel->is_open = 1;
+		if (f_size(&(channel->fil)) < channel->checkpoint_size) {converter->fresult = FR_INT_ERR;}  /* file shorter than the journal says */
+		if (converter->fresult == FR_OK) {converter->fresult = f_lseek(&(channel->fil), channel->checkpoint_size);}
+		if (converter->fresult == FR_OK) {converter->fresult = f_truncate(&(channel->fil));}
+		if (converter->fresult != FR_OK) {return 0;}
+	}
+
+	converter->steps_since_checkpoint = 0;
+	return 1;
+}
+
+uint8_t CSVConverter_Start(CSVConverter* converter, char* data_file_name, char* data_file_ext, uint32_t recording_number, uint32_t segment_count)
+{
+	converter->data_file_name = data_file_name;
+	converter->data_file_ext = data_file_ext;
+	converter->recording_number = recording_number;
+	converter->segment = 0;
+	converter->segment_count = segment_count;
+	converter->raw_offset = 0;
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++) {converter->channels[i].checkpoint_size = 0;}
+
+	converter->active = 1;
+	if (!CSVConverter_Open(converter))
+	{
+		CSVConverter_End(converter);
+		return 0;
+	}
+
+	CSVConverter_WriteJournal(converter);
+	return 1;
+}
+
+uint8_t CSVConverter_StartNext(CSVConverter* converter, char* data_file_name, char* data_file_ext)
+{
+	/*
+	 * Raw data files still have the archive attribute FatFs sets when a file is written, until their conversion finishes.
+	 * Walk the directory for the lowest recording number with it set so recordings are converted in the order they were made.
+	 */
+	DIR dir;
+	FILINFO fno;
+	uint32_t oldest = 0;
+	uint8_t found = 0;
+
+	converter->fresult = FR_OK;
+
+	uint32_t nlen = strlen(data_file_name);
+	uint32_t elen = strlen(data_file_ext);
+
+	if (f_opendir(&dir, "/") != FR_OK) {return 0;}
+	while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0])
+	{
+		uint32_t flen = strlen(fno.fname);
+		if (!(fno.fattrib & AM_ARC) || flen <= nlen + elen) {continue;}
+		if (strncmp(data_file_name, fno.fname, nlen) || strcmp(data_file_ext, fno.fname + flen - elen)) {continue;}  /* first segments only */
+
+		char* end;
+		uint32_t k = strtoul(fno.fname + nlen, &end, 10);
+		if (end != fno.fname + flen - elen) {continue;}  /* not just a number between the name and extension */
+
+		if (!found || k < oldest)
+		{
+			oldest = k;
+			found = 1;
+		}
+	}
+	(void)f_closedir(&dir);
+
+	if (!found) {return 0;}
+
+	/* the recording continues in numbered segment files if it was split */
+	char name[24];
+	uint32_t segment_count = 1;
+	while (segment_count < 100)
+	{
+		SDLogger_FormatSegmentName(name, data_file_name, data_file_ext, oldest, segment_count);
+		if (f_stat(name, &fno) != FR_OK) {break;}
+		segment_count++;
+	}
+
+	/* a recording that fails to start has been dropped from the queue by now, so the next one can be tried straight away */
+	(void)CSVConverter_Start(converter, data_file_name, data_file_ext, oldest, segment_count);
+	return converter->active || !converter->queue_blocked;
+}
+
+uint8_t CSVConverter_Resume(CSVConverter* converter, char* data_file_name, char* data_file_ext)
+{
+	/* load the job from the journal, the files are opened by the next step */
+	CSVConverterJournal journal;
+	FIL fil;
+	UINT count = 0;
+
+	if (f_open(&fil, converter->journal_file_name, FA_READ) != FR_OK) {return 0;}
+	if (f_read(&fil, &journal, sizeof(journal), &count) != FR_OK) {count = 0;}
+	(void)f_close(&fil);
+
+	if (count != sizeof(journal) || journal.magic != CSV_CONVERTER_JOURNAL_MAGIC || journal.check != CSVConverter_JournalCheck(&journal) ||
+		journal.segment >= journal.segment_count)
+	{
+		(void)f_unlink(converter->journal_file_name);
+		return 0;
+	}
+
+	converter->data_file_name = data_file_name;
+	converter->data_file_ext = data_file_ext;
+	converter->recording_number = journal.recording_number;
+	converter->segment = journal.segment;
+	converter->segment_count = journal.segment_count;
+	converter->raw_offset = journal.raw_offset;
+	for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++) {converter->channels[i].checkpoint_size = journal.csv_size[i];}
+
+	converter->active = 1;
+	return 1;
+}
+
+uint8_t CSVConverter_Step(CSVConverter* converter)
+{
+	if (!converter->active) {return 0;}
+
+	if (!converter->raw_is_open && !CSVConverter_Open(converter))
+	{
+		CSVConverter_End(converter);
+		return 0;
+	}
+
+	/* read a large block of data points at once, the reads stay on sector boundaries so they go straight into the buffer */
+	UINT count = 0;
+	converter->fresult = f_read(&(converter->raw_fil), converter->read_buf, CSV_CONVERTER_READ_LEN, &count);
+	if (converter->fresult != FR_OK)
+	{
+		CSVConverter_End(converter);
+		return 0;
+	}
+
+	if (count == 0)
+	{
+		/* end of this segment, carry on with the next one if the recording was split */
+		if (converter->segment + 1 >= converter->segment_count)
+		{
+			CSVConverter_End(converter);
+			return 0;
+		}
+
+		CSVConverter_CloseFiles(converter);
+		converter->segment++;
+		converter->raw_offset = 0;
+		if (!CSVConverter_Open(converter))
+		{
+			CSVConverter_End(converter);
+			return 0;
+		}
+		CSVConverter_WriteJournal(converter);
+		return 1;
+	}
+
+	/* the data points start past the padding on the first read, and with the one the last read cut off after that */
+	uint8_t* record = converter->read_buf + converter->read_skip - converter->carry_len;
+	converter->read_skip = 0;
+	for (; record + CSV_CONVERTER_RECORD_SIZE <= converter->read_buf + count; record += CSV_CONVERTER_RECORD_SIZE)
+	{
+		/* find the channel from the data type tag */
+		uint16_t data_type = record[10] | (record[11] << 8);
+		CSVConverterChannel* channel = NULL;
+		for (uint8_t i = 0; i < CSV_CONVERTER_CHANNELS; i++)
+		{
+			if (converter->channels[i].data_type == data_type)
+			{
+				channel = &(converter->channels[i]);
+				break;
+			}
+		}
+		if (channel == NULL) {continue;}
+
+		if (!channel->is_open)
+		{
+			CSVConverter_OpenChannel(converter, channel);
+			if (!channel->is_open) {break;}
+		}
+
+		/* format the line into the staging buffer and write out a block once it is full */
+		uint32_t time_micros = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+		int16_t data_x, data_y, data_z;
+		channel->process_data_raw(&record[4], &data_x, &data_y, &data_z);
+		channel->stage_fill += CSV_FormatLine(channel->stage + channel->stage_fill, time_micros, data_x, data_y, data_z, &(channel->scale));
+
+		/* a checkpoint leaves the file partway into a sector, the block after it is shorter so the rest line up again */
+		uint32_t flush_len = converter->flush_len - f_tell(&(channel->fil)) % SD_LOGGER_SECTOR_SIZE;
+		if (channel->stage_fill >= flush_len) {CSVConverter_Flush(converter, channel, flush_len);}
+	}
+
+	if (converter->fresult != FR_OK)
+	{
+		CSVConverter_End(converter);
+		return 0;
+	}
+
+	/* the start of a data point left at the end goes in front of the buffer, where the next read continues it */
+	converter->carry_len = record < converter->read_buf + count ? converter->read_buf + count - record : 0;
+	memmove(converter->read_buf - converter->carry_len, record, converter->carry_len);
+
+	/* bound how much work a power cut can lose */
+	if (++converter->steps_since_checkpoint >= CSV_CONVERTER_CHECKPOINT_STEPS) {CSVConverter_Checkpoint(converter);}
+
+	return 1;
+}
+
+void CSVConverter_Pause(CSVConverter* converter)
+{
+	if (!converter->raw_is_open) {return;}
+
+	/* the sample buffer is about to be reused so everything staged goes out now */
+	CSVConverter_Checkpoint(converter);
+	CSVConverter_CloseFiles(converter);
+	if (converter->fresult != FR_OK) {converter->active = 0;}  /* the journal is left for the next power up to retry */
+}
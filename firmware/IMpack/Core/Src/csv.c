@@ -0,0 +1,112 @@
+/*
+ * Fixed point CSV formatting of sensor data
+ */
+
+#include "csv.h"
+
+/* two digit lookup table so each division by 100 produces two characters */
+static const char csv_digit_pairs[] =
+		"0001020304050607080910111213141516171819"
+		"2021222324252627282930313233343536373839"
+		"4041424344454647484950515253545556575859"
+		"6061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+void CSV_InitScale(CSVScale* scale, uint32_t full_scale, uint8_t resolution)
+{
+	/* full_scale * 10^6 / 2^(resolution - 1) with 10^6 = 15625 * 2^6, then cancel the common powers of 2 */
+	uint32_t s = full_scale * 15625;
+	int32_t shift = (int32_t)resolution - 1 - 6;
+
+	while (shift < 0)
+	{
+		s <<= 1;
+		shift++;
+	}
+	while (shift > 0 && !(s & 1))
+	{
+		s >>= 1;
+		shift--;
+	}
+
+	scale->scale = s;
+	scale->shift = shift;
+}
+
+static char* CSV_WriteUnsigned(char* p, uint32_t value)
+{
+	/* digits come out from the right in pairs, so build them in a scratch buffer and copy */
+	char digits[10];
+	char* d = digits + sizeof(digits);
+
+	while (value >= 100)
+	{
+		uint32_t q = value / 100;
+		uint32_t r = 2 * (value - 100 * q);
+		d -= 2;
+		d[0] = csv_digit_pairs[r];
+		d[1] = csv_digit_pairs[r + 1];
+		value = q;
+	}
+	if (value >= 10)
+	{
+		d -= 2;
+		d[0] = csv_digit_pairs[2 * value];
+		d[1] = csv_digit_pairs[2 * value + 1];
+	}
+	else
+	{
+		*--d = '0' + value;
+	}
+
+	while (d < digits + sizeof(digits)) {*p++ = *d++;}
+	return p;
+}
+
+static char* CSV_WriteValue(char* p, int16_t counts, const CSVScale* scale)
+{
+	/* millionths of the unit, rounded half to even so the result matches printf("%.6f") of the exact value */
+	uint32_t magnitude = counts < 0 ? -(int32_t)counts : counts;
+	uint64_t product = (uint64_t)magnitude * scale->scale;
+	uint32_t micro = (uint32_t)(product >> scale->shift);
+	if (scale->shift > 0)
+	{
+		uint64_t remainder = product & ((1ULL << scale->shift) - 1);
+		uint64_t half = 1ULL << (scale->shift - 1);
+		if (remainder > half || (remainder == half && (micro & 1))) {micro++;}
+	}
+
+	uint32_t units = micro / 1000000;
+	uint32_t fraction = micro - 1000000 * units;
+
+	if (counts < 0) {*p++ = '-';}
+	p = CSV_WriteUnsigned(p, units);
+	*p++ = '.';
+
+	/* always CSV_DECIMALS digits after the point */
+	uint32_t hi = fraction / 10000;
+	uint32_t mid = fraction / 100 - 100 * hi;
+	uint32_t lo = fraction - 100 * (fraction / 100);
+	p[0] = csv_digit_pairs[2 * hi];
+	p[1] = csv_digit_pairs[2 * hi + 1];
+	p[2] = csv_digit_pairs[2 * mid];
+	p[3] = csv_digit_pairs[2 * mid + 1];
+	p[4] = csv_digit_pairs[2 * lo];
+	p[5] = csv_digit_pairs[2 * lo + 1];
+
+	return p + CSV_DECIMALS;
+}
+
+uint32_t CSV_FormatLine(char* buf, uint32_t time_micros, int16_t data_x, int16_t data_y, int16_t data_z, const CSVScale* scale)
+{
+	char* p = CSV_WriteUnsigned(buf, time_micros);
+	*p++ = ',';
+	p = CSV_WriteValue(p, data_x, scale);
+	*p++ = ',';
+	p = CSV_WriteValue(p, data_y, scale);
+	*p++ = ',';
+	p = CSV_WriteValue(p, data_z, scale);
+	*p++ = '\n';
+
+	return p - buf;
+}
@@ -0,0 +1,64 @@
+/*
+ * Record kept in a spare sector of the internal flash
+ */
+
+#include "flashstore.h"
+#include <string.h>
+
+static uint32_t FlashStore_Check(const uint8_t* data, uint32_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint8_t FlashStore_Load(uint32_t address, uint32_t key, void* data, uint32_t len)
+{
+	const FlashStoreHeader* header = (const FlashStoreHeader*)address;
+	const uint8_t* stored = (const uint8_t*)(address + sizeof(FlashStoreHeader));
+
+	/* an erased sector reads as all ones, so it fails the magic number check */
+	if (header->magic != FLASH_STORE_MAGIC || header->key != key || header->len != len) {return 0;}
+	if (FlashStore_Check(stored, len) != header->check) {return 0;}
+
+	memcpy(data, stored, len);
+	return 1;
+}
+
+uint8_t FlashStore_Save(uint32_t address, uint32_t sector, uint32_t key, const void* data, uint32_t len)
+{
+	FlashStoreHeader header = {FLASH_STORE_MAGIC, key, len, FlashStore_Check(data, len)};
+	FLASH_EraseInitTypeDef erase = {0};
+	uint32_t sector_error;
+	uint8_t result = 1;
+
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Sector = sector;
+	erase.NbSectors = 1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;  /* 32 bit programming, the board runs at 3.3 V */
+
+	if (HAL_FLASH_Unlock() != HAL_OK) {return 0;}
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+	if (HAL_FLASHEx_Erase(&erase, &sector_error) != HAL_OK) {result = 0;}
+
+	/* data first, a partial last word is padded with the erased value */
+	for (uint32_t i = 0; result && i < len; i += 4)
+	{
+		uint32_t word = 0xFFFFFFFF;
+		memcpy(&word, (const uint8_t*)data + i, len - i < 4 ? len - i : 4);
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + sizeof(header) + i, word) != HAL_OK) {result = 0;}
+	}
+
+	/* then the header, magic number last */
+	for (int32_t i = sizeof(header) - 4; result && i >= 0; i -= 4)
+	{
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i, ((const uint32_t*)&header)[i / 4]) != HAL_OK) {result = 0;}
+	}
+
+	(void)HAL_FLASH_Lock();
+	return result;
+}
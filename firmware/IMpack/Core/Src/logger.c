@@ -7,7 +7,30 @@
 
 #include "logger.h"
 
-void SDLogger_Initialize(SDLogger* logger, uint8_t* data_buffer, uint32_t data_buffer_len, uint16_t data_point_size)
+/* sector buffer for the raw region superblock and recording headers */
+static union
+{
+	uint8_t bytes[SD_LOGGER_RAW_HEADER_SECTORS * SD_LOGGER_SECTOR_SIZE];
+	SDLoggerRawSuperblock superblock;
+	SDLoggerRawHeader header;
+} raw_block __attribute__((aligned(4)));
+
+/* the partly filled last sector of a raw recording, once more data follows a flush the sector is finished here */
+static uint8_t raw_tail[SD_LOGGER_SECTOR_SIZE] __attribute__((aligned(4)));
+
+/* the next segment is opened ahead of the rollover in a file object shared by all of the loggers, whichever needs it first */
+static FIL next_fil;
+static SDLogger* next_fil_owner;
+
+static void SDLogger_Write(SDLogger* logger, uint8_t* data_ptr, uint32_t num_bytes);
+static void SDLogger_Commit(SDLogger* logger);
+static uint8_t SDLogger_OpenNextSegment(SDLogger* logger, FIL* fil);
+static void SDLogger_OpenSpareSegment(SDLogger* logger);
+static void SDLogger_WriteData(SDLogger* logger, uint8_t* data_ptr, uint32_t num_bytes);
+static void SDLogger_WriteRemaining(SDLogger* logger);
+static void SDLogger_WriteRawTail(SDLogger* logger);
+
+void SDLogger_Initialize(SDLogger* logger, uint8_t* data_buffer, uint32_t data_buffer_len, uint16_t data_point_size, volatile uint32_t* time_micros_ptr)
 {
 	/* initialize the member variables */
 	logger->data_buffer = data_buffer;
@@ -17,6 +40,61 @@ void SDLogger_Initialize(SDLogger* logger, uint8_t* data_buffer, uint32_t data_b
 
 	logger->ready_to_write = 0;
 	logger->write_ptr = NULL;
+
+	logger->time_micros_ptr = time_micros_ptr;
+	logger->commit_interval_micros = 0;
+	logger->time_last_commit = 0;
+
+	logger->segment_max_bytes = 0;
+	logger->segment_count = 0;
+	logger->next_fil_open = 0;
+
+	logger->header = NULL;
+	logger->header_len = 0;
+	logger->header_deferred = 0;
+	logger->header_pending = 0;
+	logger->header_reserve = 0;
+	logger->preallocate_bytes = 0;
+	logger->write_start = NULL;
+
+	logger->raw_mode = 0;
+	logger->raw_region_start = 0;
+	logger->raw_region_sectors = 0;
+}
+
+void SDLogger_SetCommitInterval(SDLogger* logger, uint32_t commit_interval_micros)
+{
+	logger->commit_interval_micros = commit_interval_micros;
+}
+
+void SDLogger_SetSegmentSize(SDLogger* logger, uint32_t segment_max_bytes)
+{
+	/* segments hold a whole number of half buffer writes so a data point is never split across two files */
+	uint32_t half = logger->data_buffer_len / 2;
+	if (segment_max_bytes > 0 && segment_max_bytes < half) {segment_max_bytes = half;}
+	logger->segment_max_bytes = segment_max_bytes - segment_max_bytes % half;
+}
+
+void SDLogger_SetHeader(SDLogger* logger, const void* header, uint32_t header_len)
+{
+	logger->header = header;
+	logger->header_len = header_len;
+}
+
+void SDLogger_DeferHeader(SDLogger* logger, uint8_t deferred)
+{
+	logger->header_deferred = deferred;
+}
+
+void SDLogger_ReserveAfterHeader(SDLogger* logger, uint32_t reserve_bytes)
+{
+	/* whole sectors so the data that follows stays aligned */
+	logger->header_reserve = (reserve_bytes + SD_LOGGER_SECTOR_SIZE - 1) / SD_LOGGER_SECTOR_SIZE * SD_LOGGER_SECTOR_SIZE;
+}
+
+void SDLogger_SetPreallocation(SDLogger* logger, uint32_t preallocate_bytes)
+{
+	logger->preallocate_bytes = preallocate_bytes;
 }
 
 void SDLogger_IncrementDataIndex(SDLogger* logger)
@@ -24,6 +102,7 @@ void SDLogger_IncrementDataIndex(SDLogger* logger)
 	/* increment the data buffer index */
 	/* call this each time a new data point is added to the data buffer */
 	logger->data_buffer_index += logger->data_point_size;
+	logger->data_point_count++;
 
 	if (logger->data_buffer_index == logger->data_buffer_len / 2)
 	{
@@ -42,60 +121,484 @@ void SDLogger_IncrementDataIndex(SDLogger* logger)
 	}
 }
 
-void SDLogger_StartRecording(SDLogger* logger, char* data_file_name, char* data_file_ext, char* data_file_full, uint16_t* recording_number)
+static uint32_t SDLogger_ScanRecordingNumber(char* data_file_name, char* data_file_ext)
 {
-
-	logger->data_buffer_index = 0;  /* reset the data buffer */
-	logger->ready_to_write = 0;
-
-
 	/*
-	 * Determine the correct full file name for the new data file. It should start with the data file name, followed by
-	 * a number that increments with each new recording, and then the file extension. This function will return the recording
-	 * number by pointer. The resulting data file will be written in the location pointed by data file full.
+	 * Find the largest recording number among the data files in the root directory. This walks the whole directory
+	 * so it is only used to rebuild the recording index when it is missing or inconsistent.
 	 */
-
-
-	/* get all the file names in the root directory and check if they match the pattern */
 	DIR dir;
 	FILINFO fno;
-	uint8_t n = 0;
+	uint32_t n = 0;
 
 	uint32_t nlen = strlen(data_file_name);
 	uint32_t elen = strlen(data_file_ext);
 
-	(void)f_opendir(&dir, "/");
+	if (f_opendir(&dir, "/") != FR_OK) {return 0;}
 	do
 	{
-		(void)f_readdir(&dir, &fno);
+		if (f_readdir(&dir, &fno) != FR_OK) {break;}
 		if (fno.fname[0])
 		{
 			/* we found a file, check the name */
 			uint32_t flen = strlen(fno.fname);
 
-			if (!strncmp(data_file_name, fno.fname, nlen) && !strncmp(data_file_ext, fno.fname + flen - elen, elen))  /* check name and extension matches */
+			if (flen > nlen + elen && !strncmp(data_file_name, fno.fname, nlen) && !strncmp(data_file_ext, fno.fname + flen - elen, elen))  /* check name and extension matches */
 			{
-				char num[8];  /* allow up to 8 digits */
-				strncpy(num, fno.fname + nlen, flen - nlen - elen);  /* extract numeric substring (this assumes that the substring is numeric which isn't guaranteed in general but who cares it'll work) */
-				num[flen - nlen - elen] = '\0';  /* add terminator */
-				if (atoi(num) > n)
+				char num[16];
+				uint32_t dlen = flen - nlen - elen;
+				if (dlen >= sizeof(num)) {continue;}
+				strncpy(num, fno.fname + nlen, dlen);  /* extract numeric substring */
+				num[dlen] = '\0';  /* add terminator */
+				uint32_t k = strtoul(num, NULL, 10);
+				if (k > n && k <= SD_LOGGER_MAX_RECORDING_NUMBER)
 				{
-					n = atoi(num);  /* keep track of the largest trial number found */
+					n = k;  /* keep track of the largest trial number found */
 				}
 			}
 		}
 	} while (fno.fname[0]);
 	(void)f_closedir(&dir);
 
-	/* now that we know how many data files are already in the directory, open the new file with correctly incremented file name */
-	strncpy(data_file_full, data_file_name, nlen);
-	uint32_t ilen = snprintf(NULL, 0, "%d", ++n);  /* figure out the length of the trial number string */
-	snprintf(data_file_full + nlen, ilen + 1, "%d", n);  /* write the trial number */
-	strncpy(data_file_full + nlen + ilen, data_file_ext, elen);  /* add the extension */
-	data_file_full[nlen + ilen + elen] = '\0';  /* add the null terminator */
+	return n;
+}
+
+static void SDLogger_FormatFileName(char* data_file_full, char* data_file_name, char* data_file_ext, uint32_t n)
+{
+	/* the full file name is the data file name, followed by the recording number, and then the file extension */
+	sprintf(data_file_full, "%s%lu%s", data_file_name, n, data_file_ext);
+}
+
+uint8_t SDLogger_IsShortName(char* data_file_name, char* data_file_ext)
+{
+	/* the longest name a recording can get, at the largest number, has to have at most 8 letters and then a dot and 3 more */
+	char name[32];
+	uint32_t name_len = snprintf(name, sizeof(name), "%s%lu", data_file_name, (uint32_t)SD_LOGGER_MAX_RECORDING_NUMBER);
+	uint32_t ext_len = strlen(data_file_ext);
+	return name_len <= 8 && strchr(data_file_name, '.') == NULL && ext_len >= 2 && ext_len <= 4 && data_file_ext[0] == '.';
+}
+
+void SDLogger_FormatSegmentName(char* data_file_full, char* data_file_name, char* data_file_ext, uint32_t recording_number, uint32_t segment)
+{
+	/* the first segment has the normal file name, later ones keep the first letter of the extension and add the segment number */
+	if (segment == 0)
+		SDLogger_FormatFileName(data_file_full, data_file_name, data_file_ext, recording_number);
+	else
+		sprintf(data_file_full, "%s%lu%.2s%02lu", data_file_name, recording_number, data_file_ext, segment);
+}
+
+void SDLogger_StartRecording(SDLogger* logger, char* data_file_name, char* data_file_ext, char* index_file_name, char* data_file_full, uint32_t* recording_number)
+{
+
+	logger->data_buffer_index = 0;  /* reset the data buffer */
+	logger->ready_to_write = 0;
+	logger->data_point_count = 0;
+
+	if (!SDLogger_IsShortName(data_file_name, data_file_ext)) {logger->fresult = FR_INVALID_NAME; return;}
+
+	/*
+	 * Determine the correct full file name for the new data file. It should start with the data file name, followed by
+	 * a number that increments with each new recording, and then the file extension. This function will return the recording
+	 * number by pointer. The resulting data file will be written in the location pointed by data file full.
+	 *
+	 * The next recording number is kept in a small index file so we don't have to walk the root directory each time. The
+	 * index stores the number along with its complement, and it is only trusted if that check passes and the data file it
+	 * points to doesn't exist yet. Otherwise the directory is scanned once to rebuild it.
+	 */
+	FIL index_fil;
+	uint32_t index[2];
+	uint32_t n = 0;
+	UINT count = 0;
+
+	if (f_open(&index_fil, index_file_name, FA_READ) == FR_OK)
+	{
+		if (f_read(&index_fil, index, sizeof(index), &count) != FR_OK) {count = 0;}
+		(void)f_close(&index_fil);
+	}
+
+	if (count == sizeof(index) && index[0] == ~index[1] && index[0] > 0)
+	{
+		n = index[0];
+		SDLogger_FormatFileName(data_file_full, data_file_name, data_file_ext, n);
+		if (f_stat(data_file_full, NULL) != FR_NO_FILE) {n = 0;}  /* the index is stale */
+	}
+
+	if (n == 0)
+	{
+		/* missing or inconsistent index so rebuild it from the directory */
+		n = SDLogger_ScanRecordingNumber(data_file_name, data_file_ext) + 1;
+		SDLogger_FormatFileName(data_file_full, data_file_name, data_file_ext, n);
+	}
+
+	if (n > SD_LOGGER_MAX_RECORDING_NUMBER)
+	{
+		/* no file names left, the recordings have to come off the card before the next one */
+		logger->fresult = FR_DENIED;
+		return;
+	}
+
+	/* store the number for the recording after this one */
+	index[0] = n + 1;
+	index[1] = ~index[0];
+	if (f_open(&index_fil, index_file_name, FA_OPEN_ALWAYS|FA_WRITE) == FR_OK)
+	{
+		(void)f_write(&index_fil, index, sizeof(index), &count);
+		(void)f_close(&index_fil);
+	}
 
 	*recording_number = n;
+	logger->raw_mode = 0;
+	logger->write_start = NULL;
 	logger->fresult = f_open(&(logger->fil), data_file_full, FA_CREATE_ALWAYS|FA_WRITE);  /* open the file for writing */
+
+	logger->data_file_name = data_file_name;
+	logger->data_file_ext = data_file_ext;
+	logger->recording_number = n;
+	logger->segment_count = 1;
+	logger->next_fil_open = 0;
+	if (next_fil_owner == logger) {next_fil_owner = NULL;}
+	logger->time_last_commit = *(logger->time_micros_ptr);
+
+	/*
+	 * Look for a contiguous block of free clusters for the recording to grow into, so writing it never has to search the FAT.
+	 * Nothing is allocated to the file yet, so after a power loss it still ends with the last data that was committed.
+	 */
+	if (logger->fresult == FR_OK && logger->preallocate_bytes > 0)
+	{
+		uint32_t preallocate_bytes = logger->preallocate_bytes;
+		if (logger->segment_max_bytes > 0 && preallocate_bytes > logger->segment_max_bytes) {preallocate_bytes = logger->segment_max_bytes;}
+		(void)f_expand(&(logger->fil), preallocate_bytes, 0);
+	}
+
+	/* the recording starts with its header, only the first segment has one */
+	logger->header_pending = logger->header_len > 0;
+	if (logger->fresult == FR_OK && !logger->header_deferred) {SDLogger_WriteData(logger, NULL, 0);}
+}
+
+void SDLogger_StartChannelRecording(SDLogger* logger, char* file_name, char* file_ext, uint32_t recording_number, uint32_t preallocate_bytes)
+{
+	logger->data_buffer_index = 0;  /* reset the data buffer */
+	logger->ready_to_write = 0;
+	logger->data_point_count = 0;
+	logger->raw_mode = 0;
+
+	/* the recording number comes from the main data file so all files of a recording share it */
+	char name[24];
+	SDLogger_FormatSegmentName(name, file_name, file_ext, recording_number, 0);
+	logger->fresult = f_open(&(logger->fil), name, FA_CREATE_ALWAYS|FA_WRITE);
+
+	logger->data_file_name = file_name;
+	logger->data_file_ext = file_ext;
+	logger->recording_number = recording_number;
+	logger->segment_count = 1;
+	logger->next_fil_open = 0;
+	if (next_fil_owner == logger) {next_fil_owner = NULL;}
+	logger->time_last_commit = *(logger->time_micros_ptr);
+
+	/*
+	 * Reserve one contiguous block for the expected length of the recording, so writing it never has to search the FAT for
+	 * free clusters. If the card has no free block that big the file just grows as it is written. Whatever is left over is
+	 * cut off when the recording stops.
+	 */
+	if (logger->fresult == FR_OK && preallocate_bytes > 0)
+	{
+		if (logger->segment_max_bytes > 0 && preallocate_bytes > logger->segment_max_bytes) {preallocate_bytes = logger->segment_max_bytes;}
+		(void)f_expand(&(logger->fil), preallocate_bytes, 1);
+	}
+}
+
+static uint8_t SDLogger_OpenRawRegion(SDLogger* logger, char* region_file_name, uint32_t region_size_mb)
+{
+	/*
+	 * Find the raw region file, or create it as one contiguous block of clusters. An existing file is only trusted if its
+	 * superblock matches where the file actually is, anything else might be fragmented so it is recreated from scratch.
+	 */
+	for (uint8_t attempt = 0; attempt < 2; attempt++)
+	{
+		logger->fresult = f_open(&(logger->fil), region_file_name, attempt ? (FA_CREATE_ALWAYS|FA_WRITE) : (FA_OPEN_ALWAYS|FA_WRITE));
+		if (logger->fresult != FR_OK) {return 0;}
+
+		uint8_t created = 0;
+		if (f_size(&(logger->fil)) == 0)
+		{
+			logger->fresult = f_expand(&(logger->fil), (FSIZE_t)region_size_mb << 20, 1);
+			created = 1;
+		}
+
+		FATFS* fs = logger->fil.obj.fs;
+		logger->raw_region_start = fs->database + (logger->fil.obj.sclust - 2) * fs->csize;
+		logger->raw_region_sectors = f_size(&(logger->fil)) / SD_LOGGER_SECTOR_SIZE;
+		if (f_close(&(logger->fil)) != FR_OK || logger->fresult != FR_OK || logger->raw_region_sectors <= 1 + SD_LOGGER_RAW_HEADER_SECTORS) {return 0;}
+
+		if (created)
+		{
+			/* fresh region with no recordings yet */
+			memset(raw_block.bytes, 0, SD_LOGGER_SECTOR_SIZE);
+			strcpy(raw_block.superblock.magic, SD_LOGGER_RAW_SUPERBLOCK_MAGIC);
+			raw_block.superblock.version = SD_LOGGER_RAW_VERSION;
+			raw_block.superblock.region_start = logger->raw_region_start;
+			raw_block.superblock.region_sectors = logger->raw_region_sectors;
+			raw_block.superblock.next_sector = 1;
+			raw_block.superblock.recording_count = 0;
+			return disk_write(0, raw_block.bytes, logger->raw_region_start, 1) == RES_OK;
+		}
+
+		if (disk_read(0, raw_block.bytes, logger->raw_region_start, 1) == RES_OK &&
+			!strcmp(raw_block.superblock.magic, SD_LOGGER_RAW_SUPERBLOCK_MAGIC) &&
+			raw_block.superblock.region_start == logger->raw_region_start &&
+			raw_block.superblock.region_sectors == logger->raw_region_sectors)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void SDLogger_StartRawRecording(SDLogger* logger, char* region_file_name, uint32_t region_size_mb, const char* description, uint32_t* recording_number)
+{
+	logger->data_buffer_index = 0;  /* reset the data buffer */
+	logger->ready_to_write = 0;
+	logger->data_point_count = 0;
+	logger->raw_mode = 1;
+	logger->write_start = NULL;
+	logger->header_pending = 0;
+
+	/* the superblock is checked each time in case the card was swapped, which costs one sector read */
+	uint8_t region_ok = logger->raw_region_sectors > 0 && disk_read(0, raw_block.bytes, logger->raw_region_start, 1) == RES_OK &&
+			!strcmp(raw_block.superblock.magic, SD_LOGGER_RAW_SUPERBLOCK_MAGIC) && raw_block.superblock.region_start == logger->raw_region_start;
+	if (!region_ok && !SDLogger_OpenRawRegion(logger, region_file_name, region_size_mb))
+	{
+		logger->raw_region_sectors = 0;
+		logger->raw_write_sector = logger->raw_header_sector = 0;
+		logger->fresult = FR_NO_FILE;
+		return;
+	}
+
+	/* reserve the recording number and header position */
+	logger->raw_header_sector = raw_block.superblock.next_sector;
+	logger->raw_write_sector = logger->raw_header_sector + SD_LOGGER_RAW_HEADER_SECTORS;
+	logger->raw_length = 0;
+	logger->raw_tail_len = 0;
+	*recording_number = ++raw_block.superblock.recording_count;
+	raw_block.superblock.next_sector = logger->raw_write_sector;
+	if (logger->raw_write_sector >= logger->raw_region_sectors || disk_write(0, raw_block.bytes, logger->raw_region_start, 1) != RES_OK)
+	{
+		/* the region is full */
+		logger->raw_write_sector = logger->raw_region_sectors;
+		logger->fresult = FR_DENIED;
+		return;
+	}
+
+	/* write the recording header */
+	memset(raw_block.bytes, 0, sizeof(raw_block.bytes));
+	strcpy(raw_block.header.magic, SD_LOGGER_RAW_HEADER_MAGIC);
+	raw_block.header.version = SD_LOGGER_RAW_VERSION;
+	raw_block.header.recording_number = *recording_number;
+	raw_block.header.start_sector = logger->raw_write_sector;
+	raw_block.header.length = 0;
+	raw_block.header.data_point_size = logger->data_point_size;
+	strncpy(raw_block.header.description, description, sizeof(raw_block.header.description) - 1);
+	raw_block.header.description_len = strlen(raw_block.header.description);
+	logger->fresult = disk_write(0, raw_block.bytes, logger->raw_region_start + logger->raw_header_sector, SD_LOGGER_RAW_HEADER_SECTORS) == RES_OK ? FR_OK : FR_DISK_ERR;
+
+	logger->time_last_commit = *(logger->time_micros_ptr);
+
+	/* the data starts with the same header as a data file so an extracted recording reads the same way */
+	logger->header_pending = logger->header_len > 0;
+	if (logger->fresult == FR_OK && !logger->header_deferred) {SDLogger_WriteData(logger, NULL, 0);}
+}
+
+uint32_t SDLogger_JoinBuffer(SDLogger* logger, uint32_t first_byte, uint32_t index, uint8_t align)
+{
+	/* the halves are whole sectors, so starting the first write on a sector boundary keeps every write to the card aligned */
+	uint32_t half = logger->data_buffer_len / 2;
+	uint32_t padding = align ? first_byte % SD_LOGGER_SECTOR_SIZE : 0;
+	logger->data_buffer_index = index;
+	logger->data_point_count += ((index + logger->data_buffer_len - first_byte) % logger->data_buffer_len) / logger->data_point_size;
+	logger->write_start = &(logger->data_buffer[first_byte - padding]);
+
+	/* data kept from the other half is complete and can go out straight away */
+	if ((first_byte < half) != (index < half))
+	{
+		logger->ready_to_write = 1;
+		logger->write_ptr = &(logger->data_buffer[first_byte < half ? 0 : half]);
+	}
+
+	return padding;
+}
+
+static void SDLogger_Write(SDLogger* logger, uint8_t* data_ptr, uint32_t num_bytes)
+{
+	if (!logger->raw_mode)
+	{
+		if (logger->segment_max_bytes > 0 && num_bytes > logger->segment_max_bytes - f_tell(&(logger->fil)))
+		{
+			/* this write would go past the end of the segment, normally the next one is already open */
+			if (!logger->next_fil_open) {SDLogger_OpenSpareSegment(logger);}
+			if (logger->fresult != FR_OK) {return;}
+
+			if (logger->next_fil_open)
+			{
+				/* write to the new segment first and only then close the finished one, without any unused preallocated space */
+				logger->fresult = f_write(&next_fil, data_ptr, num_bytes, &(logger->write_count));
+				FRESULT close_result = f_truncate(&(logger->fil));
+				if (close_result == FR_OK) {close_result = f_close(&(logger->fil));}
+				logger->fil = next_fil;
+				logger->next_fil_open = 0;
+				next_fil_owner = NULL;
+				if (logger->fresult == FR_OK) {logger->fresult = close_result;}
+			}
+			else
+			{
+				/* another logger has the spare, so close this segment first and open the next one in its place */
+				logger->fresult = f_truncate(&(logger->fil));
+				if (logger->fresult == FR_OK) {logger->fresult = f_close(&(logger->fil));}
+				if (logger->fresult != FR_OK || !SDLogger_OpenNextSegment(logger, &(logger->fil))) {return;}
+				logger->fresult = f_write(&(logger->fil), data_ptr, num_bytes, &(logger->write_count));
+			}
+		}
+		else
+		{
+			logger->fresult = f_write(&(logger->fil), data_ptr, num_bytes, &(logger->write_count));
+		}
+
+		/* a short write means the card is full or the file hit the size limit */
+		if (logger->fresult == FR_OK && logger->write_count != num_bytes) {logger->fresult = FR_DENIED;}
+		return;
+	}
+
+	/* raw sector writes, whole sectors go straight from the buffer and the rest is gathered in the tail */
+	while (num_bytes > 0)
+	{
+		uint8_t* block = data_ptr;
+		uint32_t num_sectors = num_bytes / SD_LOGGER_SECTOR_SIZE;
+		uint32_t used = num_sectors * SD_LOGGER_SECTOR_SIZE;
+		if (logger->raw_tail_len > 0 || num_sectors == 0)
+		{
+			used = SD_LOGGER_SECTOR_SIZE - logger->raw_tail_len < num_bytes ? SD_LOGGER_SECTOR_SIZE - logger->raw_tail_len : num_bytes;
+			memcpy(raw_tail + logger->raw_tail_len, data_ptr, used);
+			logger->raw_tail_len += used;
+			block = raw_tail;
+			num_sectors = logger->raw_tail_len / SD_LOGGER_SECTOR_SIZE;
+		}
+
+		if (num_sectors > 0)
+		{
+			if (logger->raw_write_sector + num_sectors > logger->raw_region_sectors)
+			{
+				logger->fresult = FR_DENIED;  /* out of space in the region */
+				return;
+			}
+			if (disk_write(0, block, logger->raw_region_start + logger->raw_write_sector, num_sectors) != RES_OK)
+			{
+				logger->fresult = FR_DISK_ERR;
+				return;
+			}
+			logger->raw_write_sector += num_sectors;
+			if (block == raw_tail) {logger->raw_tail_len = 0;}
+		}
+
+		data_ptr += used;
+		num_bytes -= used;
+		logger->raw_length += used;
+	}
+}
+
+
+
+static void SDLogger_WriteRawTail(SDLogger* logger)
+{
+	/* the partial sector goes out padded, and is written again once it fills up */
+	if (logger->raw_tail_len == 0) {return;}
+	if (logger->raw_write_sector >= logger->raw_region_sectors) {logger->fresult = FR_DENIED; return;}
+	memset(raw_tail + logger->raw_tail_len, 0, SD_LOGGER_SECTOR_SIZE - logger->raw_tail_len);
+	if (disk_write(0, raw_tail, logger->raw_region_start + logger->raw_write_sector, 1) != RES_OK) {logger->fresult = FR_DISK_ERR;}
+}
+
+static void SDLogger_WriteData(SDLogger* logger, uint8_t* data_ptr, uint32_t num_bytes)
+{
+	/* a held back header goes out first */
+	if (logger->header_pending)
+	{
+		logger->header_pending = 0;
+		SDLogger_Write(logger, (uint8_t*)logger->header, logger->header_len);
+		if (logger->fresult != FR_OK) {return;}
+
+		/* skip the reserved space, it's written later */
+		if (logger->header_reserve > 0 && logger->raw_mode)
+		{
+			logger->raw_write_sector += logger->header_reserve / SD_LOGGER_SECTOR_SIZE;
+			logger->raw_length += logger->header_reserve;
+		}
+		else if (logger->header_reserve > 0)
+		{
+			logger->fresult = f_lseek(&(logger->fil), f_tell(&(logger->fil)) + logger->header_reserve);
+			if (logger->fresult == FR_OK && f_tell(&(logger->fil)) != logger->header_len + logger->header_reserve) {logger->fresult = FR_DENIED;}  /* card full */
+			if (logger->fresult != FR_OK) {return;}
+		}
+	}
+
+	/* the first write after joining a filling buffer leaves out the data from before the start */
+	if (logger->write_start != NULL && logger->write_start >= data_ptr && logger->write_start <= data_ptr + num_bytes)
+	{
+		num_bytes -= logger->write_start - data_ptr;
+		data_ptr = logger->write_start;
+		logger->write_start = NULL;
+	}
+
+	if (num_bytes > 0) {SDLogger_Write(logger, data_ptr, num_bytes);}
+}
+
+static uint8_t SDLogger_OpenNextSegment(SDLogger* logger, FIL* fil)
+{
+	char name[24];
+
+	if (logger->segment_count > 99)
+	{
+		logger->fresult = FR_DENIED;  /* out of segment names */
+		return 0;
+	}
+
+	SDLogger_FormatSegmentName(name, logger->data_file_name, logger->data_file_ext, logger->recording_number, logger->segment_count);
+	logger->fresult = f_open(fil, name, FA_CREATE_ALWAYS|FA_WRITE);
+	if (logger->fresult != FR_OK) {return 0;}
+	logger->segment_count++;
+	return 1;
+}
+
+static void SDLogger_OpenSpareSegment(SDLogger* logger)
+{
+	/* leaves next_fil_open clear without an error if another logger has the spare */
+	if (next_fil_owner != NULL) {return;}
+	if (SDLogger_OpenNextSegment(logger, &next_fil))
+	{
+		logger->next_fil_open = 1;
+		next_fil_owner = logger;
+	}
+}
+
+static void SDLogger_Commit(SDLogger* logger)
+{
+	if (!logger->raw_mode)
+	{
+		logger->fresult = f_sync(&(logger->fil));
+		return;
+	}
+
+	if (logger->raw_write_sector <= logger->raw_header_sector) {return;}  /* recording never started */
+	SDLogger_WriteRawTail(logger);
+	if (logger->fresult != FR_OK) {return;}
+
+	/* update the length in the recording header */
+	if (disk_read(0, raw_block.bytes, logger->raw_region_start + logger->raw_header_sector, 1) != RES_OK) {return;}
+	raw_block.header.length = logger->raw_length;
+	if (disk_write(0, raw_block.bytes, logger->raw_region_start + logger->raw_header_sector, 1) != RES_OK) {return;}
+
+	/* move the start of the next recording past the data written so far */
+	if (disk_read(0, raw_block.bytes, logger->raw_region_start, 1) != RES_OK) {return;}
+	raw_block.superblock.next_sector = logger->raw_write_sector + (logger->raw_tail_len > 0);
+	(void)disk_write(0, raw_block.bytes, logger->raw_region_start, 1);
 }
 
 void SDLogger_Update(SDLogger* logger)
@@ -103,43 +606,154 @@ void SDLogger_Update(SDLogger* logger)
 	/* write data to the SD card if it is time to do so */
 	if (logger->ready_to_write)
 	{
-		logger->fresult = f_write(&(logger->fil), logger->write_ptr, logger->data_buffer_len / 2, &(logger->write_count));
+		SDLogger_WriteData(logger, logger->write_ptr, logger->data_buffer_len / 2);
 
 		/* reset the flag */
 		logger->ready_to_write = 0;
+
+		/*
+		 * Commit the directory entry and FAT periodically. This is only done directly after a half buffer write, and only
+		 * if the other half is still less than half full, so the extra sector writes always have most of a half buffer
+		 * worth of slack and never delay the next buffer write. If the write ran long we just try again after the next one.
+		 */
+		if (logger->commit_interval_micros > 0 && *(logger->time_micros_ptr) - logger->time_last_commit > logger->commit_interval_micros)
+		{
+			if (!logger->ready_to_write && logger->data_buffer_index % (logger->data_buffer_len / 2) < logger->data_buffer_len / 4)
+			{
+				SDLogger_Commit(logger);
+				logger->time_last_commit = *(logger->time_micros_ptr);
+			}
+		}
+
+		/*
+		 * Open the next segment as soon as the following write is going to need it, under the same slack rule as the commits,
+		 * so the rollover itself is just a write and a close. If there was no slack it is opened at the rollover instead.
+		 */
+		if (!logger->raw_mode && logger->segment_max_bytes > 0 && !logger->next_fil_open && logger->fresult == FR_OK &&
+			logger->data_buffer_len / 2 > logger->segment_max_bytes - f_tell(&(logger->fil)))
+		{
+			if (!logger->ready_to_write && logger->data_buffer_index % (logger->data_buffer_len / 2) < logger->data_buffer_len / 4)
+			{
+				SDLogger_OpenSpareSegment(logger);
+			}
+		}
 	}
 }
 
-void SDLogger_StopRecording(SDLogger* logger)
+static void SDLogger_WriteRemaining(SDLogger* logger)
 {
 	if (logger->ready_to_write)
 	{
-		/* if we are still ready to write, then there is a complete half of the buffer */
+		/* if we are still ready to write, then there is a complete half of the buffer to go out first */
 		SDLogger_Update(logger);
 	}
+
+	/* write whatever data is remaining in the buffer */
+	uint8_t* data_ptr;
+	uint32_t num_bytes;
+
+	if (logger->data_buffer_index < logger->data_buffer_len / 2)
+	{
+		/* the remaining data is in the first half */
+		data_ptr = &(logger->data_buffer[0]);
+		num_bytes = logger->data_buffer_index;
+	}
 	else
 	{
-		/* write whatever data is remaining in the buffer */
-		uint8_t* data_ptr;
-		uint32_t num_bytes;
+		/* the remaining data is in the second half */
+		data_ptr = &(logger->data_buffer[logger->data_buffer_len / 2]);
+		num_bytes = logger->data_buffer_index - logger->data_buffer_len / 2;
+	}
 
-		if (logger->data_buffer_index < logger->data_buffer_len / 2)
-		{
-			/* the remaining data is in the first half */
-			data_ptr = &(logger->data_buffer[0]);
-			num_bytes = logger->data_buffer_index;
-		}
-		else
+	if (logger->fresult == FR_OK) {SDLogger_WriteData(logger, data_ptr, num_bytes);}
+	logger->data_buffer_index = 0;
+}
+
+void SDLogger_Flush(SDLogger* logger)
+{
+	SDLogger_WriteRemaining(logger);
+
+	/* the data is on the card, make sure the file system knows about it too */
+	if (logger->fresult == FR_OK)
+	{
+		SDLogger_Commit(logger);
+		logger->time_last_commit = *(logger->time_micros_ptr);
+	}
+}
+
+void SDLogger_StopRecording(SDLogger* logger)
+{
+	SDLogger_WriteRemaining(logger);
+
+	/* close the file */
+	if (logger->raw_mode)
+	{
+		SDLogger_Commit(logger);
+	}
+	else
+	{
+		if (logger->next_fil_open)
 		{
-			/* the remaining data is in the second half */
-			data_ptr = &(logger->data_buffer[logger->data_buffer_len / 2]);
-			num_bytes = logger->data_buffer_index - logger->data_buffer_len / 2;
+			/* the recording ended before the next segment was needed */
+			char name[24];
+			SDLogger_FormatSegmentName(name, logger->data_file_name, logger->data_file_ext, logger->recording_number, --logger->segment_count);
+			(void)f_close(&next_fil);
+			(void)f_unlink(name);
+			logger->next_fil_open = 0;
+			next_fil_owner = NULL;
 		}
 
-		logger->fresult = f_write(&(logger->fil), data_ptr, num_bytes, &(logger->write_count));
+		/* cut off whatever was preallocated but not used */
+		FRESULT write_result = logger->fresult;
+		logger->fresult = f_truncate(&(logger->fil));
+		if (logger->fresult == FR_OK) {logger->fresult = f_close(&(logger->fil));}
+		if (write_result != FR_OK) {logger->fresult = write_result;}
+	}
+}
+
+void SDLogger_Rewrite(SDLogger* logger, uint32_t offset, const void* data, uint32_t len)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
 
+	/* raw recordings are changed a sector at a time, the data starts after the raw header */
+	if (logger->raw_mode)
+	{
+		while (len > 0 && logger->fresult == FR_OK)
+		{
+			uint32_t sector = logger->raw_region_start + logger->raw_header_sector + SD_LOGGER_RAW_HEADER_SECTORS + offset / SD_LOGGER_SECTOR_SIZE;
+			uint32_t start = offset % SD_LOGGER_SECTOR_SIZE;
+			uint32_t count = SD_LOGGER_SECTOR_SIZE - start < len ? SD_LOGGER_SECTOR_SIZE - start : len;
+			if (disk_read(0, raw_block.bytes, sector, 1) != RES_OK) {logger->fresult = FR_DISK_ERR; return;}
+			memcpy(raw_block.bytes + start, bytes, count);
+			if (disk_write(0, raw_block.bytes, sector, 1) != RES_OK) {logger->fresult = FR_DISK_ERR; return;}
+			offset += count;
+			bytes += count;
+			len -= count;
+		}
+		return;
 	}
 
-	/* close the file */
-	logger->fresult = f_close(&(logger->fil));
+	/* the first segment is normally still the open one, otherwise it's opened again just for this */
+	UINT count = 0;
+	if (logger->segment_count <= 1)
+	{
+		FSIZE_t position = f_tell(&(logger->fil));
+		logger->fresult = f_lseek(&(logger->fil), offset);
+		if (logger->fresult == FR_OK) {logger->fresult = f_write(&(logger->fil), bytes, len, &count);}
+		if (logger->fresult == FR_OK) {logger->fresult = f_lseek(&(logger->fil), position);}
+		if (logger->fresult == FR_OK) {logger->fresult = f_sync(&(logger->fil));}
+	}
+	else
+	{
+		char name[24];
+		FIL fil;
+		SDLogger_FormatSegmentName(name, logger->data_file_name, logger->data_file_ext, logger->recording_number, 0);
+		logger->fresult = f_open(&fil, name, FA_OPEN_EXISTING|FA_WRITE);
+		if (logger->fresult != FR_OK) {return;}
+		logger->fresult = f_lseek(&fil, offset);
+		if (logger->fresult == FR_OK) {logger->fresult = f_write(&fil, bytes, len, &count);}
+		FRESULT close_result = f_close(&fil);
+		if (logger->fresult == FR_OK) {logger->fresult = close_result;}
+	}
+	if (logger->fresult == FR_OK && count != len) {logger->fresult = FR_DENIED;}
 }
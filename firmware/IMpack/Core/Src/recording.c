@@ -0,0 +1,54 @@
+/*
+ * Self-describing header at the start of each recording
+ */
+
+#include "recording.h"
+#include <stddef.h>
+#include <string.h>
+
+void RecordingHeader_Init(RecordingHeader* header, uint16_t data_point_size, const char* firmware_version)
+{
+	memset(header, 0, sizeof(RecordingHeader));
+	memcpy(header->magic, RECORDING_HEADER_MAGIC, sizeof(header->magic));
+	header->version = RECORDING_HEADER_VERSION;
+	header->header_size = sizeof(RecordingHeader);
+	strncpy(header->firmware_version, firmware_version, sizeof(header->firmware_version) - 1);
+	header->data_point_size = data_point_size;
+	header->settings_offset = offsetof(RecordingHeader, settings);
+}
+
+void RecordingHeader_SetChannel(RecordingHeader* header, uint8_t channel, uint16_t data_type, const char* name, const char* unit,
+								uint8_t flags, uint8_t resolution, uint32_t full_scale, float odr_hz)
+{
+	RecordingChannel* descriptor = &(header->channels[channel]);
+	descriptor->data_type = data_type;
+	descriptor->flags = flags;
+	descriptor->resolution = resolution;
+	descriptor->full_scale = full_scale;
+	descriptor->scale = (float)full_scale / 32768.0f;  /* left justified so the full range always spans the 16 bit value */
+	descriptor->odr_hz = odr_hz;
+	strncpy(descriptor->name, name, sizeof(descriptor->name) - 1);
+	strncpy(descriptor->unit, unit, sizeof(descriptor->unit) - 1);
+
+	if (channel >= header->channel_count) {header->channel_count = channel + 1;}
+}
+
+void RecordingHeader_SetSettingsLength(RecordingHeader* header, uint32_t settings_len)
+{
+	header->settings_len = settings_len;
+}
+
+uint8_t RecordingHeader_IsValid(const RecordingHeader* header)
+{
+	return !memcmp(header->magic, RECORDING_HEADER_MAGIC, sizeof(header->magic)) && header->version >= 1 &&
+		   header->header_size >= sizeof(RecordingHeader) && header->channel_count <= RECORDING_MAX_CHANNELS;
+}
+
+const RecordingChannel* RecordingHeader_FindChannel(const RecordingHeader* header, uint16_t data_type)
+{
+	for (uint8_t i = 0; i < header->channel_count; i++)
+	{
+		if (header->channels[i].data_type == data_type) {return &(header->channels[i]);}
+	}
+	return NULL;
+}
@@ -72,3 +72,132 @@ HAL_StatusTypeDef SPISensor_Disable(SPISensor* sensor)
 	return SPISensor_WriteRegister(sensor, sensor->disable_reg, sensor->disable_data);
 }
 
+
+void SPISequence_Init(SPISequence* sequence)
+{
+	sequence->burst_count = 0;
+	sequence->byte_count = 0;
+	sequence->error_count = 0;
+	for (uint8_t i = 0; i < SPI_SEQUENCE_MAX_BUSES; i++)
+	{
+		sequence->bus[i] = NULL;
+		sequence->current[i] = -1;
+	}
+}
+
+uint8_t SPISequence_Add(SPISequence* sequence, SPISensor* sensor, const uint8_t* reg, const uint8_t* data, uint8_t size)
+{
+	for (uint8_t i = 0; i < size; i++)
+	{
+		SPIBurst* burst = sequence->burst_count > 0 ? &sequence->bursts[sequence->burst_count - 1] : NULL;
+		if (burst != NULL && burst->sensor->spi == sensor->spi && burst->sensor->cs_pin == sensor->cs_pin &&
+			burst->sensor->cs_port == sensor->cs_port && reg[i] == burst->last_reg + 1 && sequence->byte_count < SPI_SEQUENCE_MAX_BYTES)
+		{
+			/* the next register along, carry on with the same burst */
+			sequence->bytes[sequence->byte_count++] = data[i];
+			burst->len++;
+			burst->last_reg = reg[i];
+			continue;
+		}
+
+		/* start a new burst with the address byte */
+		if (sequence->burst_count >= SPI_SEQUENCE_MAX_BURSTS || sequence->byte_count + 2 > SPI_SEQUENCE_MAX_BYTES) {return 0;}
+		burst = &sequence->bursts[sequence->burst_count++];
+		burst->sensor = sensor;
+		burst->start = sequence->byte_count;
+		burst->len = 2;
+		burst->last_reg = reg[i];
+		sequence->bytes[sequence->byte_count++] = sensor->convert_reg_write(reg[i]);
+		sequence->bytes[sequence->byte_count++] = data[i];
+	}
+
+	return 1;
+}
+
+static void SPISequence_Next(SPISequence* sequence, uint8_t bus)
+{
+	/* send the next burst on this bus after the current one, the bus is done once there are none left */
+	SPI_HandleTypeDef* spi = sequence->bus[bus];
+	int8_t next = sequence->current[bus] + 1;
+	while (next < sequence->burst_count && sequence->bursts[next].sensor->spi != spi) {next++;}
+	if (next >= sequence->burst_count)
+	{
+		sequence->current[bus] = -1;
+		return;
+	}
+
+	SPIBurst* burst = &sequence->bursts[next];
+	sequence->current[bus] = next;
+	HAL_GPIO_WritePin(burst->sensor->cs_port, burst->sensor->cs_pin, GPIO_PIN_RESET);
+	if (HAL_SPI_Transmit_DMA(spi, &sequence->bytes[burst->start], burst->len) != HAL_OK)
+	{
+		/* give up on this bus */
+		HAL_GPIO_WritePin(burst->sensor->cs_port, burst->sensor->cs_pin, GPIO_PIN_SET);
+		sequence->error_count++;
+		sequence->current[bus] = -1;
+	}
+}
+
+void SPISequence_Start(SPISequence* sequence)
+{
+	/* find the buses used, then start the first burst on each of them */
+	uint8_t bus_count = 0;
+	for (uint8_t i = 0; i < sequence->burst_count; i++)
+	{
+		SPI_HandleTypeDef* spi = sequence->bursts[i].sensor->spi;
+		uint8_t b = 0;
+		while (b < bus_count && sequence->bus[b] != spi) {b++;}
+		if (b == bus_count && bus_count < SPI_SEQUENCE_MAX_BUSES) {sequence->bus[bus_count++] = spi;}
+	}
+
+	for (uint8_t b = 0; b < bus_count; b++)
+	{
+		sequence->current[b] = -1;
+		SPISequence_Next(sequence, b);
+	}
+}
+
+void SPISequence_TransmitComplete(SPISequence* sequence, SPI_HandleTypeDef* spi, uint8_t error)
+{
+	for (uint8_t b = 0; b < SPI_SEQUENCE_MAX_BUSES; b++)
+	{
+		if (sequence->bus[b] != spi || sequence->current[b] < 0) {continue;}
+
+		SPIBurst* burst = &sequence->bursts[sequence->current[b]];
+		HAL_GPIO_WritePin(burst->sensor->cs_port, burst->sensor->cs_pin, GPIO_PIN_SET);
+		sequence->error_count += error;
+		SPISequence_Next(sequence, b);
+	}
+}
+
+uint8_t SPISequence_IsDone(SPISequence* sequence)
+{
+	for (uint8_t b = 0; b < SPI_SEQUENCE_MAX_BUSES; b++)
+		if (sequence->current[b] >= 0)
+			return 0;
+
+	return 1;
+}
+
+uint8_t SPISequence_Wait(SPISequence* sequence, volatile uint32_t* time_micros_ptr, uint32_t timeout_micros)
+{
+	uint32_t time_start = *time_micros_ptr;
+	while (!SPISequence_IsDone(sequence))
+	{
+		if (*time_micros_ptr - time_start > timeout_micros)
+		{
+			/* a bus is stuck, stop it so the blocking calls can use it again */
+			for (uint8_t b = 0; b < SPI_SEQUENCE_MAX_BUSES; b++)
+			{
+				if (sequence->current[b] < 0) {continue;}
+				SPIBurst* burst = &sequence->bursts[sequence->current[b]];
+				(void)HAL_SPI_Abort(sequence->bus[b]);
+				HAL_GPIO_WritePin(burst->sensor->cs_port, burst->sensor->cs_pin, GPIO_PIN_SET);
+				sequence->current[b] = -1;
+				sequence->error_count++;
+			}
+		}
+	}
+
+	return sequence->error_count;
+}
@@ -0,0 +1,143 @@
+/*
+ * Persistent file system session on the SD card
+ */
+
+#include "storage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void SDStorage_Init(SDStorage* storage, SD_HandleTypeDef* hsd, GPIO_TypeDef* detect_port, uint16_t detect_pin, volatile uint32_t* time_micros_ptr, uint32_t idle_timeout_micros)
+{
+	storage->hsd = hsd;
+	storage->detect_port = detect_port;
+	storage->detect_pin = detect_pin;
+	storage->time_micros_ptr = time_micros_ptr;
+
+	storage->mounted = 0;
+	storage->fresult = FR_NOT_READY;
+
+	storage->idle_timeout_micros = idle_timeout_micros;
+	storage->time_last_access = *time_micros_ptr;
+}
+
+uint8_t SDStorage_Open(SDStorage* storage)
+{
+	/* a card that was pulled out since the last access needs a clean re-mount */
+	if (storage->mounted && !SDStorage_CardDetected(storage))
+	{
+		SDStorage_Close(storage);
+	}
+
+	if (!storage->mounted)
+	{
+		if (!SDStorage_CardDetected(storage))
+		{
+			storage->fresult = FR_NOT_READY;
+			return 0;
+		}
+
+		storage->fresult = f_mount(&(storage->fs), "/", 1);
+		if (storage->fresult != FR_OK) {return 0;}
+
+		/* mounting re-initializes the card in 1 bit mode so switch back to the 4 bit bus */
+		if (HAL_SD_ConfigWideBusOperation(storage->hsd, SDIO_BUS_WIDE_4B) != HAL_OK)
+		{
+			(void)f_mount(NULL, "/", 1);
+			storage->fresult = FR_DISK_ERR;
+			return 0;
+		}
+
+		storage->mounted = 1;
+	}
+
+	storage->time_last_access = *(storage->time_micros_ptr);
+	return 1;
+}
+
+void SDStorage_Close(SDStorage* storage)
+{
+	/* files are synced as they are closed so there is nothing left in the session to flush */
+	storage->fresult = f_mount(NULL, "/", 1);
+	storage->mounted = 0;
+}
+
+void SDStorage_Update(SDStorage* storage)
+{
+	if (!storage->mounted) {return;}
+
+	if (!SDStorage_CardDetected(storage))
+	{
+		/* card removed, drop the session so the next access re-mounts whatever card is inserted */
+		SDStorage_Close(storage);
+	}
+	else if (storage->idle_timeout_micros > 0 && *(storage->time_micros_ptr) - storage->time_last_access > storage->idle_timeout_micros)
+	{
+		/* release the card after a long idle period */
+		SDStorage_Close(storage);
+	}
+}
+
+uint8_t SDStorage_CardDetected(SDStorage* storage)
+{
+	return HAL_GPIO_ReadPin(storage->detect_port, storage->detect_pin) == GPIO_PIN_RESET;
+}
+
+uint8_t SDStorage_Format(SDStorage* storage, void* work, uint32_t work_len, char* marker_file_name)
+{
+	/*
+	 * Re-format the card as FAT32 with the largest cluster size that still gives a valid volume, and the data area aligned
+	 * to the card's allocation unit (the disk driver reports it as the erase block size). Clusters then never straddle
+	 * an erase block, which keeps the write latency of the card consistent. Everything on the card is lost.
+	 */
+	if (!SDStorage_CardDetected(storage))
+	{
+		storage->fresult = FR_NOT_READY;
+		return 0;
+	}
+	if (storage->mounted) {SDStorage_Close(storage);}
+
+	for (uint32_t cluster_size = SD_STORAGE_MAX_CLUSTER_SIZE; cluster_size >= SD_STORAGE_MIN_CLUSTER_SIZE; cluster_size >>= 1)
+	{
+		storage->fresult = f_mkfs("/", FM_FAT32, cluster_size, work, work_len);
+		if (storage->fresult != FR_MKFS_ABORTED) {break;}  /* aborted means too few clusters for FAT32 at this size */
+	}
+	if (storage->fresult != FR_OK) {return 0;}
+
+	if (!SDStorage_Open(storage)) {return 0;}
+
+	/* leave a marker with the layout so we can tell later whether the card was re-formatted elsewhere */
+	FIL fil;
+	UINT count;
+	char text[96];
+	UINT len = sprintf(text, "IMpack card layout\ncluster_bytes = %lu\ndata_start_sector = %lu\n", (uint32_t)storage->fs.csize * _MAX_SS, (uint32_t)storage->fs.database);
+
+	storage->fresult = f_open(&fil, marker_file_name, FA_CREATE_ALWAYS|FA_WRITE);
+	if (storage->fresult != FR_OK) {return 0;}
+	storage->fresult = f_write(&fil, text, len, &count);
+	if (f_close(&fil) != FR_OK || storage->fresult != FR_OK || count != len) {return 0;}
+
+	return 1;
+}
+
+uint8_t SDStorage_IsPrepared(SDStorage* storage, char* marker_file_name)
+{
+	if (!storage->mounted) {return 0;}
+
+	FIL fil;
+	UINT count = 0;
+	char text[96];
+
+	if (f_open(&fil, marker_file_name, FA_READ) != FR_OK) {return 0;}
+	if (f_read(&fil, text, sizeof(text) - 1, &count) != FR_OK) {count = 0;}
+	(void)f_close(&fil);
+	text[count] = '\0';
+
+	/* the marker only counts if the volume still has the layout it describes */
+	char* cluster_bytes = strstr(text, "cluster_bytes = ");
+	char* data_start = strstr(text, "data_start_sector = ");
+	if (cluster_bytes == NULL || data_start == NULL) {return 0;}
+
+	return strtoul(cluster_bytes + 16, NULL, 10) == (uint32_t)storage->fs.csize * _MAX_SS &&
+		   strtoul(data_start + 20, NULL, 10) == (uint32_t)storage->fs.database;
+}
@@ -0,0 +1,121 @@
+/*
+ * Acceleration trigger evaluated on the raw sensor data
+ */
+
+#include "trigger.h"
+#include <string.h>
+
+#define TRIGGER_MAX_MAGNITUDE 56756  /* sqrt(3) * 32768 rounded down, beyond any three 16 bit values */
+
+static uint32_t Trigger_CountLevel(const Trigger* trigger, uint32_t level_milli, uint32_t percent, uint32_t full_scale, uint8_t resolution)
+{
+	/*
+	 * counts = level * percent / 100 * 2^(resolution - 1) / full_scale, rounded so comparing whole counts gives the same
+	 * answer as comparing the value in units: down when firing above the level and up when firing below it. The magnitude
+	 * is compared squared, so the level is squared as well, still exactly
+	 */
+	uint64_t numerator = ((uint64_t)level_milli * percent) << (resolution - 1);
+	uint64_t denominator = 100000 * (uint64_t)full_scale;
+	uint64_t quotient = numerator / denominator;
+	uint64_t remainder = numerator % denominator;
+
+	if (!trigger->magnitude)
+	{
+		uint64_t level = quotient + (!trigger->rising && remainder != 0);
+		return level < UINT32_MAX ? (uint32_t)level : UINT32_MAX;
+	}
+
+	/* no three axes reach it, UINT32_MAX is past the largest sum of squares either way */
+	if (quotient > TRIGGER_MAX_MAGNITUDE) {return UINT32_MAX;}
+
+	/* (q + r/d)^2 = q^2 + (2 q r d + r^2) / d^2, and with r^2 = a d + b (b < d) the fraction rounds down to (2 q r + a) / d */
+	uint64_t remainder_squared = remainder * remainder;
+	uint64_t fraction = 2 * quotient * remainder + remainder_squared / denominator;
+	uint8_t exact = remainder_squared % denominator == 0 && fraction % denominator == 0;
+	uint64_t level = quotient * quotient + fraction / denominator + (!trigger->rising && !exact);
+	return level < UINT32_MAX ? (uint32_t)level : UINT32_MAX;
+}
+
+void Trigger_Init(Trigger* trigger, uint8_t rising, uint8_t magnitude, uint8_t all_channels, uint8_t hysteresis_percent, uint32_t min_duration_micros)
+{
+	memset(trigger, 0, sizeof(Trigger));
+	trigger->rising = rising;
+	trigger->magnitude = magnitude;
+	trigger->all_channels = all_channels;
+	trigger->hysteresis_percent = hysteresis_percent < 100 ? hysteresis_percent : 100;
+	trigger->min_duration_micros = min_duration_micros;
+}
+
+void Trigger_SetChannel(Trigger* trigger, uint8_t channel, uint8_t axes, uint32_t level_milli, uint32_t full_scale, uint8_t resolution, uint8_t big_endian)
+{
+	TriggerChannel* c = &(trigger->channels[channel]);
+	if (!c->axes && axes) {trigger->channel_count++;}
+	if (c->axes && !axes) {trigger->channel_count--;}
+
+	c->axes = (axes && trigger->magnitude) ? 0x07 : axes;
+	c->big_endian = big_endian;
+	c->shift = 16 - resolution;
+	c->level = Trigger_CountLevel(trigger, level_milli, 100, full_scale, resolution);
+
+	/* the release level is closer to zero, so it is further below the level when rising and further above it when falling */
+	uint32_t percent = trigger->rising ? 100 - trigger->hysteresis_percent : 100 + trigger->hysteresis_percent;
+	c->release = Trigger_CountLevel(trigger, level_milli, percent, full_scale, resolution);
+}
+
+void Trigger_Reset(Trigger* trigger)
+{
+	trigger->met_count = 0;
+	for (uint8_t i = 0; i < TRIGGER_MAX_CHANNELS; i++)
+	{
+		trigger->channels[i].active = 0;
+		trigger->channels[i].met = 0;
+	}
+}
+
+uint8_t Trigger_Update(Trigger* trigger, uint8_t channel, const uint8_t* raw_data, uint32_t time_micros)
+{
+	TriggerChannel* c = &(trigger->channels[channel]);
+	if (!c->axes) {return 0;}
+
+	/* the sum of squares for the magnitude, otherwise the largest of the selected axes when rising and the smallest when */
+	/* falling, since any one of them crossing counts */
+	uint32_t value = (trigger->magnitude || trigger->rising) ? 0 : UINT32_MAX;
+	for (uint8_t k = 0; k < 3; k++)
+	{
+		if (!(c->axes & (1 << k))) {continue;}
+
+		uint16_t bytes = c->big_endian ? (raw_data[2 * k] << 8) | raw_data[2 * k + 1] : raw_data[2 * k] | (raw_data[2 * k + 1] << 8);
+		int32_t counts = (int16_t)bytes >> c->shift;
+		if (trigger->magnitude)
+		{
+			value += (uint32_t)(counts * counts);
+			continue;
+		}
+		if (counts < 0) {counts = -counts;}
+		if (trigger->rising ? (uint32_t)counts > value : (uint32_t)counts < value) {value = counts;}
+	}
+
+	/* cross the level to become active, and stay active until back past the release level */
+	if (!c->active)
+	{
+		if (trigger->rising ? value > c->level : value < c->level)
+		{
+			c->active = 1;
+			c->active_since_micros = time_micros;
+		}
+	}
+	else if (trigger->rising ? value <= c->release : value >= c->release)
+	{
+		c->active = 0;
+		if (c->met) {trigger->met_count--;}
+		c->met = 0;
+	}
+
+	if (c->active && !c->met && time_micros - c->active_since_micros >= trigger->min_duration_micros)
+	{
+		c->met = 1;
+		trigger->met_count++;
+	}
+
+	return trigger->met_count > 0 && (!trigger->all_channels || trigger->met_count == trigger->channel_count);
+}
@@ -80,6 +80,23 @@ LoopCopyDataInit:
   cmp r4, r1
   bcc CopyDataInit
   
+/* Copy the CCM RAM initializers from flash, zero filled ones included */
+  ldr r0, =_sccmram
+  ldr r1, =_eccmram
+  ldr r2, =_siccmram
+  movs r3, #0
+  b LoopCopyCcmramInit
+
+CopyCcmramInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyCcmramInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyCcmramInit
+
 /* Zero fill the bss segment. */
   ldr r2, =_sbss
   ldr r4, =_ebss
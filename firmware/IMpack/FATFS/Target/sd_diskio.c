@@ -418,6 +418,36 @@ DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 
 /* USER CODE BEGIN beforeIoctlSection */
 /* can be used to modify previous code / undefine following code / add new code */
+extern SD_HandleTypeDef hsd;
+
+/*
+ * Erase block size in sectors from the allocation unit size field of the SD status register, so f_mkfs can align the
+ * data area to it. AU sizes that aren't a power of 2 use the largest power of 2 that divides them, and FatFs caps the
+ * alignment at 32768 sectors (16 MB).
+ */
+static DWORD SD_GetEraseBlockSize(void)
+{
+  static const DWORD au_sectors[] = {1, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 8192, 32768, 16384, 32768, 32768};
+  HAL_SD_CardStatusTypeDef status;
+
+  if (HAL_SD_GetCardStatus(&hsd, &status) != HAL_OK) return 1;
+  return au_sectors[status.AllocationUnitSize & 0x0F];
+}
+
+#if _USE_IOCTL == 1
+/* the generated SD_ioctl below is renamed, and the one in the driver table passes everything to it but gives the AU as the erase block size */
+DRESULT SD_ioctl_generated(BYTE lun, BYTE cmd, void *buff);
+
+DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
+{
+  DRESULT res = SD_ioctl_generated(lun, cmd, buff);
+
+  if (res == RES_OK && cmd == GET_BLOCK_SIZE) *(DWORD*)buff = SD_GetEraseBlockSize();
+  return res;
+}
+
+#define SD_ioctl SD_ioctl_generated
+#endif /* _USE_IOCTL == 1 */
 /* USER CODE END beforeIoctlSection */
 /**
   * @brief  I/O control operation
@@ -472,6 +502,7 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 
 /* USER CODE BEGIN afterIoctlSection */
 /* can be used to modify previous code / undefine following code / add new code */
+#undef SD_ioctl
 /* USER CODE END afterIoctlSection */
 
 /* USER CODE BEGIN callbackSection */
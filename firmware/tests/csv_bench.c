@@ -0,0 +1,115 @@
+/*
+ * CSV line formatting benchmark
+ *
+ * Times the fixed point formatter against the float and snprintf path the converter used before it, on the same random
+ * data points, and checks every fixed point line against printf("%.6f") of the exact value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "csv.h"
+
+#define BENCH_POINTS 65536
+#define BENCH_SECONDS 0.5
+
+typedef struct
+{
+	uint32_t time_micros;
+	int16_t data[3];
+
+} BenchPoint;
+
+static BenchPoint points[BENCH_POINTS];
+static char out[BENCH_POINTS * CSV_MAX_LINE_LEN];
+
+static double Bench_Now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+/* the old path: counts times a float scale, then printed with %f */
+static uint32_t Bench_FormatFloat(char* buf, const BenchPoint* point, float units_per_bit)
+{
+	float data_x = point->data[0] * units_per_bit;
+	float data_y = point->data[1] * units_per_bit;
+	float data_z = point->data[2] * units_per_bit;
+	return snprintf(buf, 100, "%lu,%f,%f,%f\n", (unsigned long)point->time_micros, data_x, data_y, data_z);
+}
+
+static double Bench_Run(uint8_t fixed_point, const CSVScale* scale, float units_per_bit)
+{
+	/* lines per second over the whole set of points, repeated for long enough to time */
+	uint32_t runs = 0;
+	double start = Bench_Now();
+	double elapsed;
+	do
+	{
+		char* p = out;
+		for (uint32_t i = 0; i < BENCH_POINTS; i++)
+		{
+			if (fixed_point)
+				p += CSV_FormatLine(p, points[i].time_micros, points[i].data[0], points[i].data[1], points[i].data[2], scale);
+			else
+				p += Bench_FormatFloat(p, &points[i], units_per_bit);
+		}
+		runs++;
+		elapsed = Bench_Now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	return (double)BENCH_POINTS * runs / elapsed;
+}
+
+static uint32_t Bench_CheckExact(const CSVScale* scale, uint32_t full_scale, uint8_t resolution)
+{
+	/* every count for this range against the exact value printed by the C library */
+	uint32_t mismatches = 0;
+	double units_per_bit = (double)full_scale / (1 << (resolution - 1));
+	for (int32_t counts = INT16_MIN; counts <= INT16_MAX; counts++)
+	{
+		char fixed[CSV_MAX_LINE_LEN + 1], exact[100];
+		uint32_t len = CSV_FormatLine(fixed, 4294967295u, counts, counts, counts, scale);
+		fixed[len] = '\0';
+		double value = counts * units_per_bit;
+		snprintf(exact, sizeof(exact), "4294967295,%.6f,%.6f,%.6f\n", value, value, value);
+		mismatches += strcmp(fixed, exact) != 0;
+	}
+	return mismatches;
+}
+
+int main(void)
+{
+	/* the ranges of each sensor with its bit depth */
+	static const struct {const char* name; uint32_t full_scale; uint8_t resolution;} ranges[] = {
+		{"LSM6DSx 16 g", 16, 16}, {"LSM6DSx 2000 dps", 2000, 16}, {"IIS3DWB 16 g", 16, 16}, {"ADXL37x 200 g", 200, 12}};
+
+	srand(1);
+	uint32_t time_micros = 0;
+	for (uint32_t i = 0; i < BENCH_POINTS; i++)
+	{
+		time_micros += 38 + rand() % 4;
+		points[i].time_micros = time_micros;
+		for (uint8_t k = 0; k < 3; k++) {points[i].data[k] = rand() - RAND_MAX / 2;}
+	}
+
+	uint32_t failures = 0;
+	for (uint32_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+	{
+		CSVScale scale;
+		CSV_InitScale(&scale, ranges[r].full_scale, ranges[r].resolution);
+		float units_per_bit = (float)ranges[r].full_scale / (1 << (ranges[r].resolution - 1));
+
+		double before = Bench_Run(0, &scale, units_per_bit);
+		double after = Bench_Run(1, &scale, units_per_bit);
+		uint32_t mismatches = Bench_CheckExact(&scale, ranges[r].full_scale, ranges[r].resolution);
+		failures += mismatches;
+
+		printf("%-18s float/snprintf %6.2f M lines/s  fixed point %6.2f M lines/s  %5.1fx  %lu lines not exact\n", ranges[r].name, before / 1e6,
+			   after / 1e6, after / before, (unsigned long)mismatches);
+	}
+
+	return failures != 0;
+}
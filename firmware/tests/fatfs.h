@@ -0,0 +1,142 @@
+/*
+ * Stand-in for the FatFs header on the host, files are kept in memory
+ *
+ * Only the calls the tested modules make are here. Reads and writes are counted so the tests can see how often a module
+ * goes to the card.
+ */
+
+#ifndef TESTS_FATFS_H_
+#define TESTS_FATFS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FATFS_STUB_MAX_FILES 8
+#define FATFS_STUB_NAME_LEN 16
+
+typedef char TCHAR;
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef DWORD FSIZE_t;
+
+typedef enum
+{
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_INT_ERR,
+	FR_NOT_READY,
+	FR_NO_FILE,
+	FR_NO_PATH,
+	FR_INVALID_NAME,
+	FR_DENIED
+} FRESULT;
+
+#define FA_READ				0x01
+#define FA_WRITE			0x02
+#define FA_OPEN_EXISTING	0x00
+#define FA_CREATE_ALWAYS	0x08
+
+typedef struct
+{
+	char name[FATFS_STUB_NAME_LEN];
+	uint8_t* data;
+	uint32_t size;
+	uint32_t capacity;
+} FatFsStubFile;
+
+typedef struct
+{
+	FatFsStubFile* file;
+	FSIZE_t fptr;
+	BYTE flag;
+} FIL;
+
+static FatFsStubFile fatfs_stub_files[FATFS_STUB_MAX_FILES];
+static uint32_t fatfs_stub_read_count;  /* f_read calls */
+static uint32_t fatfs_stub_write_count;  /* f_write calls */
+
+#define f_size(fp) ((fp)->file->size)
+#define f_tell(fp) ((fp)->fptr)
+
+static FatFsStubFile* FatFsStub_Find(const TCHAR* path, uint8_t create)
+{
+	FatFsStubFile* empty = NULL;
+	for (uint32_t i = 0; i < FATFS_STUB_MAX_FILES; i++)
+	{
+		if (fatfs_stub_files[i].name[0] == '\0') {if (empty == NULL) {empty = &fatfs_stub_files[i];} continue;}
+		if (strcmp(fatfs_stub_files[i].name, path) == 0) {return &fatfs_stub_files[i];}
+	}
+	if (!create || empty == NULL || strlen(path) >= FATFS_STUB_NAME_LEN) {return NULL;}
+
+	strcpy(empty->name, path);
+	empty->size = 0;
+	return empty;
+}
+
+static FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
+{
+	fp->file = FatFsStub_Find(path, (mode & FA_CREATE_ALWAYS) != 0);
+	if (fp->file == NULL) {return FR_NO_FILE;}
+	if (mode & FA_CREATE_ALWAYS) {fp->file->size = 0;}
+	fp->fptr = 0;
+	fp->flag = mode;
+	return FR_OK;
+}
+
+static FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+	fatfs_stub_read_count++;
+	*br = 0;
+	if (!(fp->flag & FA_READ)) {return FR_DENIED;}
+	if (btr > fp->file->size - fp->fptr) {btr = fp->file->size - fp->fptr;}
+	memcpy(buff, fp->file->data + fp->fptr, btr);
+	fp->fptr += btr;
+	*br = btr;
+	return FR_OK;
+}
+
+static FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+	fatfs_stub_write_count++;
+	*bw = 0;
+	if (!(fp->flag & FA_WRITE)) {return FR_DENIED;}
+	FatFsStubFile* file = fp->file;
+	if (fp->fptr + btw > file->capacity)
+	{
+		file->capacity = 2 * (fp->fptr + btw);
+		file->data = realloc(file->data, file->capacity);
+	}
+	memcpy(file->data + fp->fptr, buff, btw);
+	fp->fptr += btw;
+	if (fp->fptr > file->size) {file->size = fp->fptr;}
+	*bw = btw;
+	return FR_OK;
+}
+
+static FRESULT f_close(FIL* fp)
+{
+	fp->file = NULL;
+	return FR_OK;
+}
+
+static FRESULT f_unlink(const TCHAR* path)
+{
+	FatFsStubFile* file = FatFsStub_Find(path, 0);
+	if (file == NULL) {return FR_NO_FILE;}
+	file->name[0] = '\0';
+	return FR_OK;
+}
+
+/* put a whole file in place for a test */
+static void FatFsStub_SetFile(const TCHAR* path, const char* text, uint32_t len)
+{
+	FIL fil;
+	UINT count;
+	(void)f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+	(void)f_write(&fil, text, len, &count);
+	(void)f_close(&fil);
+}
+
+#endif /* TESTS_FATFS_H_ */
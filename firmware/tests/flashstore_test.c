@@ -0,0 +1,148 @@
+/*
+ * Flash record tests
+ *
+ * The flash sector is a block of RAM that the stubbed HAL erases to all ones and programs the way flash does, only
+ * clearing bits. Records are saved and loaded back, then damaged in the ways a load has to refuse, and every step of a
+ * save is made to fail in turn as a power loss would. Returns non-zero if anything fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "flashstore.h"
+
+#define TEST_SECTOR_LEN 16384
+
+static uint32_t fail_count = 0;
+#define CHECK(condition, ...) do {if (!(condition)) {fail_count++; if (fail_count <= 20) {printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n");}}} while (0)
+
+/* flash addresses are 32 bits, so the sector has to sit in the low 4 GB, which a binary linked without PIE gives */
+static uint8_t sector[TEST_SECTOR_LEN] __attribute__((aligned(4)));
+static uint32_t address;
+
+static uint8_t locked = 1;
+static uint8_t fail_erase;
+static int32_t fail_program = -1;  /* index of the program step that fails, -1 for none */
+static int32_t program_count;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	locked = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	locked = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError)
+{
+	CHECK(!locked, "erase while locked");
+	CHECK(pEraseInit->TypeErase == FLASH_TYPEERASE_SECTORS && pEraseInit->Sector == FLASH_SECTOR_11 && pEraseInit->NbSectors == 1, "erase of the wrong sector");
+	program_count = 0;
+	*SectorError = 0xFFFFFFFF;
+	if (fail_erase) {return HAL_ERROR;}
+	memset(sector, 0xFF, sizeof(sector));
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	CHECK(!locked, "program while locked");
+	CHECK(TypeProgram == FLASH_TYPEPROGRAM_WORD && Address % 4 == 0, "program of a partial word");
+	CHECK(Address >= address && Address + 4 <= address + TEST_SECTOR_LEN, "program outside the sector");
+	if (program_count++ == fail_program) {return HAL_ERROR;}
+
+	/* programming only clears bits */
+	uint32_t* word = (uint32_t*)(uintptr_t)Address;
+	*word &= (uint32_t)Data;
+	return HAL_OK;
+}
+
+static void Test_Fill(uint8_t* data, uint32_t len, uint32_t seed)
+{
+	for (uint32_t i = 0; i < len; i++) {data[i] = (uint8_t)(seed + 7 * i + (i >> 8));}
+}
+
+static void Test_RoundTrip(void)
+{
+	static const uint32_t lengths[] = {0, 1, 3, 4, 5, 801, 4096, TEST_SECTOR_LEN - sizeof(FlashStoreHeader)};
+	static uint8_t data[TEST_SECTOR_LEN], loaded[TEST_SECTOR_LEN];
+
+	memset(sector, 0xFF, sizeof(sector));
+	CHECK(!FlashStore_Load(address, 5, loaded, 801), "erased sector loaded");
+
+	for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+	{
+		uint32_t len = lengths[i];
+		Test_Fill(data, len, i);
+		memset(loaded, 0, sizeof(loaded));
+		CHECK(FlashStore_Save(address, FLASH_SECTOR_11, 100 + i, data, len), "save %lu bytes", (unsigned long)len);
+		CHECK(locked, "left unlocked after a save");
+		CHECK(FlashStore_Load(address, 100 + i, loaded, len) && memcmp(loaded, data, len) == 0, "load %lu bytes", (unsigned long)len);
+		CHECK(!FlashStore_Load(address, 99 + i, loaded, len), "load %lu bytes with the wrong key", (unsigned long)len);
+		CHECK(!FlashStore_Load(address, 100 + i, loaded, len + 4), "load %lu bytes as a longer record", (unsigned long)len);
+		if (len > 0) {CHECK(!FlashStore_Load(address, 100 + i, loaded, len - 1), "load %lu bytes as a shorter record", (unsigned long)len);}
+	}
+}
+
+static void Test_Damage(void)
+{
+	/* any single bit flipped in the header or the data is caught */
+	static uint8_t data[801], loaded[801];
+	Test_Fill(data, sizeof(data), 3);
+	CHECK(FlashStore_Save(address, FLASH_SECTOR_11, 5, data, sizeof(data)), "save");
+	for (uint32_t bit = 0; bit < 8 * (sizeof(FlashStoreHeader) + sizeof(data)); bit++)
+	{
+		sector[bit / 8] ^= 1 << (bit % 8);
+		CHECK(!FlashStore_Load(address, 5, loaded, sizeof(data)), "bit %lu flipped", (unsigned long)bit);
+		sector[bit / 8] ^= 1 << (bit % 8);
+	}
+	CHECK(FlashStore_Load(address, 5, loaded, sizeof(data)), "load after putting the bits back");
+}
+
+static void Test_PowerLoss(void)
+{
+	/* each step of a save failing in turn leaves no valid record, not even the one that was there before */
+	static uint8_t old_data[801], data[801], loaded[801];
+	Test_Fill(old_data, sizeof(old_data), 1);
+	Test_Fill(data, sizeof(data), 2);
+	int32_t steps = (sizeof(data) + 3) / 4 + sizeof(FlashStoreHeader) / 4;
+
+	for (fail_program = -1; fail_program < steps; fail_program++)
+	{
+		int32_t fail = fail_program;
+		fail_program = -1;
+		CHECK(FlashStore_Save(address, FLASH_SECTOR_11, 5, old_data, sizeof(old_data)), "save of the old record");
+		fail_program = fail;
+
+		fail_erase = fail_program == -1;
+		CHECK(!FlashStore_Save(address, FLASH_SECTOR_11, 5, data, sizeof(data)), "save reported success with step %ld failing", (long)fail_program);
+		CHECK(locked, "left unlocked after a failed save");
+		uint8_t valid = FlashStore_Load(address, 5, loaded, sizeof(data));
+		CHECK(!valid || (fail_erase && memcmp(loaded, old_data, sizeof(old_data)) == 0), "record valid with step %ld failing", (long)fail_program);
+		fail_erase = 0;
+	}
+	fail_program = -1;
+
+	/* and with nothing failing the last step is the magic number */
+	CHECK(FlashStore_Save(address, FLASH_SECTOR_11, 5, data, sizeof(data)) && program_count == steps, "%ld program steps", (long)program_count);
+}
+
+int main(void)
+{
+	address = (uint32_t)(uintptr_t)sector;
+	if ((uintptr_t)address != (uintptr_t)sector)
+	{
+		printf("flashstore_test: the sector is above 4 GB, link without PIE\n");
+		return 1;
+	}
+
+	Test_RoundTrip();
+	Test_Damage();
+	Test_PowerLoss();
+
+	printf("flashstore_test: %lu failures\n", (unsigned long)fail_count);
+	return fail_count != 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * Stand-in for the board's fatfs.h on the host, for the tests that run the real FatFs on a disk image in memory
+ *
+ * The tests that use it put this directory ahead of the FatFs stub in the include path.
+ */
+
+#ifndef TESTS_IMAGE_FATFS_H_
+#define TESTS_IMAGE_FATFS_H_
+
+#include "ff.h"
+#include "ramdisk.h"
+
+#endif /* TESTS_IMAGE_FATFS_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Disk image in memory behind the FatFs disk calls
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "ramdisk.h"
+
+#define RAMDISK_CHUNK_LEN (RAMDISK_CHUNK_SECTORS * RAMDISK_SECTOR_SIZE)
+
+static uint8_t** chunks;
+static uint32_t chunk_count;
+static uint32_t sector_count;
+
+void RamDisk_Create(uint32_t sectors)
+{
+	for (uint32_t i = 0; i < chunk_count; i++) {free(chunks[i]);}
+	free(chunks);
+	sector_count = sectors;
+	chunk_count = (sectors + RAMDISK_CHUNK_SECTORS - 1) / RAMDISK_CHUNK_SECTORS;
+	chunks = calloc(chunk_count, sizeof(uint8_t*));
+}
+
+void RamDisk_Read(uint32_t sector, uint32_t offset, void* data, uint32_t len)
+{
+	uint8_t* out = data;
+	uint64_t position = (uint64_t)sector * RAMDISK_SECTOR_SIZE + offset;
+	while (len > 0)
+	{
+		uint32_t chunk = position / RAMDISK_CHUNK_LEN;
+		uint32_t start = position % RAMDISK_CHUNK_LEN;
+		uint32_t part = RAMDISK_CHUNK_LEN - start < len ? RAMDISK_CHUNK_LEN - start : len;
+		if (chunk < chunk_count && chunks[chunk] != NULL) {memcpy(out, chunks[chunk] + start, part);}
+		else {memset(out, 0, part);}
+		out += part;
+		position += part;
+		len -= part;
+	}
+}
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+	return chunks == NULL || pdrv != 0 ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_status(BYTE pdrv)
+{
+	return chunks == NULL || pdrv != 0 ? STA_NOINIT : 0;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+	if (pdrv != 0 || sector + count > sector_count) {return RES_PARERR;}
+	RamDisk_Read(sector, 0, buff, count * RAMDISK_SECTOR_SIZE);
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+	if (pdrv != 0 || sector + count > sector_count) {return RES_PARERR;}
+	for (UINT i = 0; i < count; i++)
+	{
+		uint32_t chunk = (sector + i) / RAMDISK_CHUNK_SECTORS;
+		if (chunks[chunk] == NULL) {chunks[chunk] = calloc(1, RAMDISK_CHUNK_LEN);}
+		memcpy(chunks[chunk] + (sector + i) % RAMDISK_CHUNK_SECTORS * RAMDISK_SECTOR_SIZE, buff + i * RAMDISK_SECTOR_SIZE, RAMDISK_SECTOR_SIZE);
+	}
+	return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+	if (pdrv != 0) {return RES_PARERR;}
+	switch (cmd)
+	{
+		case CTRL_SYNC: return RES_OK;
+		case GET_SECTOR_COUNT: *(DWORD*)buff = sector_count; return RES_OK;
+		case GET_SECTOR_SIZE: *(WORD*)buff = RAMDISK_SECTOR_SIZE; return RES_OK;
+		case GET_BLOCK_SIZE: *(DWORD*)buff = 1; return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+DWORD get_fattime(void)
+{
+	return ((DWORD)(2020 - 1980) << 25) | (1 << 21) | (1 << 16);
+}
@@ -0,0 +1,19 @@
+/*
+ * Disk image in memory behind the FatFs disk calls
+ *
+ * The image is sparse, sectors only take memory once they are written, so a FAT32 volume the size of a small card fits
+ * easily.
+ */
+
+#ifndef TESTS_IMAGE_RAMDISK_H_
+#define TESTS_IMAGE_RAMDISK_H_
+
+#include <stdint.h>
+
+#define RAMDISK_SECTOR_SIZE 512
+#define RAMDISK_CHUNK_SECTORS 128  /* sectors allocated together on the first write to any of them */
+
+void RamDisk_Create(uint32_t sector_count);  /* a blank image, any previous one is freed */
+void RamDisk_Read(uint32_t sector, uint32_t offset, void* data, uint32_t len);  /* read around the file system, offset may run past the sector */
+
+#endif /* TESTS_IMAGE_RAMDISK_H_ */
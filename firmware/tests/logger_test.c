@@ -0,0 +1,559 @@
+/*
+ * Logger tests on a FatFs image
+ *
+ * The real logger and FatFs write to a FAT32 image in memory while the sensor and read interrupts are played back
+ * around them, and the recordings are read back from the image, in file and raw modes. The pre-trigger join and the end
+ * of a multi-shot event repeat the steps of App_JoinPretrigger and App_EndEvent, which need the board, with the
+ * interrupts that can land in the middle of the join. Segmented files and channel loggers rolling over together are
+ * read back segment by segment. Returns non-zero if anything fails.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "logger.h"
+#include "recording.h"
+
+#define TEST_IMAGE_SECTORS (400u * 1024 * 1024 / 512)
+#define TEST_MAX_EVENTS 12
+
+static uint32_t fail_count = 0;
+#define CHECK(condition, ...) do {if (!(condition)) {fail_count++; if (fail_count <= 20) {printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n");}}} while (0)
+
+/* same layout as the data points in app.c, the data holds a sequence number so gaps and repeats show */
+typedef struct
+{
+	uint32_t time_micros;
+	uint8_t data[6];
+	uint16_t data_type;
+} DataPoint;
+
+static FATFS fs;
+static SDLogger logger;
+static RecordingHeader recording_header __attribute__((aligned(4)));
+
+static DataPoint data_buffer[CD_LOGGER_DATA_BUFFER_LEN];
+static uint32_t data_pending_index;
+static uint32_t data_read_index;
+static uint8_t data_ring_wrapped;
+static uint8_t recording;
+static volatile uint32_t time_micros;
+static uint32_t time_recording_started;
+static uint32_t sample_interval;  /* microseconds between data points */
+static uint32_t sequence;  /* number of the next data point read */
+
+static uint8_t series_open;
+static uint8_t event_open;
+static uint32_t series_started;
+static uint32_t event_trigger_micros;
+static RecordingEvent recording_event;
+
+/* the sensor interrupt stamps a data point, the read interrupt fills it in and hands it to the logger while recording */
+static void Test_SampleInterrupt(void)
+{
+	time_micros += sample_interval;
+	data_buffer[data_pending_index].time_micros = time_micros - time_recording_started;
+	data_buffer[data_pending_index].data_type = 0x8000;
+	if (++data_pending_index == CD_LOGGER_DATA_BUFFER_LEN)
+	{
+		data_pending_index = 0;
+		data_ring_wrapped = 1;
+	}
+}
+
+static void Test_ReadInterrupt(void)
+{
+	if (data_read_index == data_pending_index) {return;}
+	memcpy(data_buffer[data_read_index].data, &sequence, sizeof(sequence));
+	sequence++;
+	if (++data_read_index == CD_LOGGER_DATA_BUFFER_LEN) {data_read_index = 0;}
+	if (recording) {SDLogger_IncrementDataIndex(&logger);}
+}
+
+static uint32_t Test_Sequence(DataPoint* point)
+{
+	uint32_t s;
+	memcpy(&s, point->data, sizeof(s));
+	return s;
+}
+
+/* the steps of App_JoinPretrigger */
+static void Test_Join(uint32_t trigger_index, uint32_t pretrigger_micros)
+{
+	uint32_t trigger_stamp = data_buffer[trigger_index].time_micros;
+	uint32_t origin = trigger_stamp - pretrigger_micros;
+	uint8_t first_event = !series_open || recording_header.event_count == 0;
+	uint32_t shift = first_event ? origin : series_started - time_recording_started;
+
+	uint32_t first = data_read_index;
+	uint32_t half_len = CD_LOGGER_DATA_BUFFER_LEN / 2;
+	for (uint32_t count = 0; count < half_len - PRETRIGGER_MARGIN_LEN; count++)
+	{
+		if (first == 0 && !data_ring_wrapped) {break;}
+		uint32_t previous = first == 0 ? CD_LOGGER_DATA_BUFFER_LEN - 1 : first - 1;
+		if ((int32_t)(data_buffer[previous].time_micros - origin) < 0) {break;}
+		first = previous;
+	}
+
+	/* interrupts that land between the scan and the interrupts-off section */
+	Test_ReadInterrupt();
+	Test_SampleInterrupt();
+	Test_ReadInterrupt();
+
+	time_recording_started += shift;
+	uint32_t pending = data_pending_index;
+	uint32_t read = data_read_index;
+	if ((read + CD_LOGGER_DATA_BUFFER_LEN - first) % CD_LOGGER_DATA_BUFFER_LEN > half_len) {first = (read + CD_LOGGER_DATA_BUFFER_LEN - half_len) % CD_LOGGER_DATA_BUFFER_LEN;}
+	uint32_t first_point = logger.data_point_count;
+	uint32_t padding = SDLogger_JoinBuffer(&logger, first * sizeof(DataPoint), read * sizeof(DataPoint), first_event);
+	recording = 1;
+
+	/* and while the time stamps are shifted */
+	Test_SampleInterrupt();
+	Test_ReadInterrupt();
+
+	for (uint32_t i = first; i != pending; i = i + 1 == CD_LOGGER_DATA_BUFFER_LEN ? 0 : i + 1)
+		data_buffer[i].time_micros -= shift;
+	event_trigger_micros = trigger_stamp - shift;
+	uint32_t trigger_point = (trigger_index + CD_LOGGER_DATA_BUFFER_LEN - first) % CD_LOGGER_DATA_BUFFER_LEN;
+
+	if (first_event)
+	{
+		recording_header.header_size = sizeof(recording_header) + logger.header_reserve + padding;
+		recording_header.trigger_micros = event_trigger_micros;
+		recording_header.trigger_sample = trigger_point;
+		series_started = time_recording_started;
+	}
+
+	if (series_open)
+	{
+		recording_event.first_point = first_point;
+		recording_event.point_count = 0;
+		recording_event.trigger_micros = event_trigger_micros;
+		recording_event.trigger_point = first_point + trigger_point;
+		event_open = 1;
+	}
+}
+
+/* the steps of App_EndEvent */
+static void Test_EndEvent(void)
+{
+	event_open = 0;
+	SDLogger_Flush(&logger);
+	recording_event.point_count = logger.data_point_count - recording_event.first_point;
+	uint32_t n = recording_header.event_count;
+	if (logger.fresult == FR_OK) {SDLogger_Rewrite(&logger, sizeof(recording_header) + n * sizeof(RecordingEvent), &recording_event, sizeof(RecordingEvent));}
+	recording_header.event_count = n + 1;
+	if (logger.fresult == FR_OK) {SDLogger_Rewrite(&logger, offsetof(RecordingHeader, event_count), &recording_header.event_count, sizeof(recording_header.event_count));}
+}
+
+/*
+ * A new recording in the given mode with the header written with the first data, as the app starts a triggered one, and
+ * an event table of event_capacity entries for a multi-shot series
+ */
+static uint8_t Test_StartRecording(uint8_t raw, uint32_t segment_max_bytes, uint32_t event_capacity, char* data_file_full, uint32_t* recording_number)
+{
+	memset(data_buffer, 0xA5, sizeof(data_buffer));
+	memset(&recording_header, 0, sizeof(recording_header));
+	memcpy(recording_header.magic, "IMPK", 4);
+	recording_header.version = RECORDING_HEADER_VERSION;
+	recording_header.header_size = sizeof(recording_header);
+	recording_header.data_point_size = sizeof(DataPoint);
+
+	SDLogger_Initialize(&logger, (uint8_t*)data_buffer, sizeof(data_buffer), sizeof(DataPoint), &time_micros);
+	SDLogger_SetCommitInterval(&logger, 50000);
+	SDLogger_SetSegmentSize(&logger, segment_max_bytes);
+	SDLogger_SetHeader(&logger, &recording_header, sizeof(recording_header));
+	SDLogger_DeferHeader(&logger, 1);
+	SDLogger_ReserveAfterHeader(&logger, event_capacity * sizeof(RecordingEvent));
+	SDLogger_SetPreallocation(&logger, event_capacity > 0 ? 3000000 : 0);
+	recording_header.header_size += logger.header_reserve;
+	recording_header.event_capacity = event_capacity;
+	if (raw) {SDLogger_StartRawRecording(&logger, "RAWLOG.BIN", 64, "test", recording_number);}
+	else {SDLogger_StartRecording(&logger, "DATA", ".DAT", "DATA.IDX", data_file_full, recording_number);}
+
+	data_pending_index = 0;
+	data_read_index = 0;
+	data_ring_wrapped = 0;
+	recording = 0;
+	time_recording_started = time_micros;
+	series_open = event_capacity > 0;
+	event_open = 0;
+	return logger.fresult == FR_OK;
+}
+
+/* the whole recording from the image, every segment of a file one joined up, NULL if it can't be found */
+static uint8_t* Test_ReadRecording(uint8_t raw, uint32_t recording_number, uint32_t* len)
+{
+	uint8_t* data = NULL;
+	*len = 0;
+	if (raw)
+	{
+		SDLoggerRawHeader raw_header;
+		RamDisk_Read(logger.raw_region_start + logger.raw_header_sector, 0, &raw_header, sizeof(raw_header));
+		CHECK(raw_header.start_sector == logger.raw_header_sector + 2, "raw data starts at sector %lu", (unsigned long)raw_header.start_sector);
+		data = malloc(raw_header.length);
+		RamDisk_Read(logger.raw_region_start + raw_header.start_sector, 0, data, raw_header.length);
+		*len = raw_header.length;
+		return data;
+	}
+
+	for (uint32_t segment = 0;; segment++)
+	{
+		char name[16];
+		FIL file;
+		UINT bytes_read;
+		SDLogger_FormatSegmentName(name, "DATA", ".DAT", recording_number, segment);
+		if (f_open(&file, name, FA_READ) != FR_OK) {break;}
+		data = realloc(data, *len + f_size(&file));
+		f_read(&file, data + *len, f_size(&file), &bytes_read);
+		*len += bytes_read;
+		f_close(&file);
+		f_unlink(name);  /* only one recording is kept in memory at a time */
+	}
+	return data;
+}
+
+/*
+ * One triggered recording: armed_count data points with the reads lag_count behind, the trigger set off by the data
+ * point late_count before the last one read, a window of pretrigger_micros, then post_count data points with the logger
+ * updated every update_spacing of them
+ */
+static void Test_Pretrigger(uint8_t raw, uint32_t interval, uint32_t armed_count, uint32_t pretrigger_micros, uint32_t lag_count, uint32_t late_count, uint32_t post_count, uint32_t update_spacing)
+{
+	char name[16];
+	uint32_t recording_number;
+	sample_interval = interval;
+	sequence = 0;
+	if (!Test_StartRecording(raw, 0xFFFFFFFF, 0, name, &recording_number))
+	{
+		CHECK(0, "start %d", logger.fresult);
+		return;
+	}
+
+	for (uint32_t i = 0; i < armed_count; i++)
+	{
+		Test_SampleInterrupt();
+		if (i >= lag_count) {Test_ReadInterrupt();}
+	}
+	if (late_count >= armed_count - lag_count) {late_count = armed_count - lag_count - 1;}
+	uint32_t trigger_index = (data_read_index + CD_LOGGER_DATA_BUFFER_LEN - 1 - late_count) % CD_LOGGER_DATA_BUFFER_LEN;
+	uint32_t trigger_sequence = Test_Sequence(&data_buffer[trigger_index]);
+	Test_Join(trigger_index, pretrigger_micros);
+
+	for (uint32_t i = 0; i < post_count; i++)
+	{
+		Test_SampleInterrupt();
+		Test_ReadInterrupt();
+		if (i % update_spacing == 0) {SDLogger_Update(&logger);}
+	}
+	while (data_read_index != data_pending_index) {Test_ReadInterrupt();}
+	SDLogger_StopRecording(&logger);
+	CHECK(logger.fresult == FR_OK, "stop %d", logger.fresult);
+
+	uint32_t len;
+	uint8_t* data = Test_ReadRecording(raw, recording_number, &len);
+	RecordingHeader* header = (RecordingHeader*)data;
+	if (data == NULL || len < sizeof(RecordingHeader) || memcmp(header->magic, "IMPK", 4) != 0 || header->header_size > len)
+	{
+		CHECK(0, "no recording, raw %u", raw);
+		free(data);
+		return;
+	}
+	CHECK(header->trigger_micros == pretrigger_micros, "trigger at %lu us", (unsigned long)header->trigger_micros);
+	CHECK((len - header->header_size) % sizeof(DataPoint) == 0, "partial data point, %lu bytes with a header of %lu", (unsigned long)len, (unsigned long)header->header_size);
+
+	/* every data point from the window start on, evenly spaced, with the trigger at pretrigger_micros */
+	uint32_t count = (len - header->header_size) / sizeof(DataPoint);
+	DataPoint* points = (DataPoint*)(data + header->header_size);
+	uint32_t first_sequence = Test_Sequence(&points[0]);
+	CHECK((int32_t)points[0].time_micros >= 0 && points[0].time_micros <= pretrigger_micros, "first data point at %ld us", (long)(int32_t)points[0].time_micros);
+	uint32_t gaps = 0;
+	for (uint32_t i = 0; i < count; i++)
+		if (Test_Sequence(&points[i]) != first_sequence + i || points[i].time_micros != points[0].time_micros + i * interval) {gaps++;}
+	CHECK(gaps == 0, "%lu data points out of place, raw %u", (unsigned long)gaps, raw);
+	CHECK(first_sequence + count == sequence, "%lu data points lost at the end", (unsigned long)(sequence - first_sequence - count));
+	CHECK(header->trigger_sample < count && Test_Sequence(&points[header->trigger_sample]) == trigger_sequence && points[header->trigger_sample].time_micros == pretrigger_micros, "trigger sample %lu", (unsigned long)header->trigger_sample);
+
+	/* the window is only cut short by the start of arming or the half buffer limit, which the late data points count against */
+	uint32_t window = trigger_sequence - first_sequence;
+	uint32_t expected_window = pretrigger_micros / interval < trigger_sequence ? pretrigger_micros / interval : trigger_sequence;
+	CHECK(window >= expected_window || window + late_count + lag_count + 3 >= CD_LOGGER_DATA_BUFFER_LEN / 2 - PRETRIGGER_MARGIN_LEN, "window of %lu data points, %lu by time", (unsigned long)window, (unsigned long)expected_window);
+	free(data);
+}
+
+/*
+ * A multi-shot series of event_count events, each armed afresh with random timing and a window of pretrigger_micros,
+ * then closed off with its table entry. After a power loss the recording is read back as the last commit left it.
+ */
+static void Test_MultiShot(uint8_t raw, uint32_t interval, uint32_t event_count, uint32_t event_capacity, uint32_t pretrigger_micros, uint32_t segment_max_bytes, uint8_t power_loss)
+{
+	char name[16];
+	uint32_t recording_number;
+	uint32_t trigger_sequences[TEST_MAX_EVENTS];
+	uint32_t trigger_stamps[TEST_MAX_EVENTS];  /* on the time_micros clock */
+	uint32_t series_start = 0;
+	sample_interval = interval;
+	sequence = 0;
+	if (!Test_StartRecording(raw, segment_max_bytes, event_capacity, name, &recording_number))
+	{
+		CHECK(0, "start %d", logger.fresult);
+		return;
+	}
+
+	for (uint32_t e = 0; e < event_count; e++)
+	{
+		/* arming starts the buffer and the time stamps again */
+		data_pending_index = 0;
+		data_read_index = 0;
+		data_ring_wrapped = 0;
+		recording = 0;
+		time_recording_started = time_micros;
+		event_trigger_micros = 0;
+
+		uint32_t armed_count = 100 + rand() % 20000;
+		uint32_t lag_count = rand() % 5;
+		uint32_t post_count = rand() % 30000;
+		uint32_t update_spacing = 1 + rand() % 100;
+		for (uint32_t i = 0; i < armed_count; i++)
+		{
+			Test_SampleInterrupt();
+			if (i >= lag_count) {Test_ReadInterrupt();}
+		}
+		uint32_t late_count = rand() % 2 ? 0 : rand() % 300;
+		if (late_count >= armed_count - lag_count) {late_count = armed_count - lag_count - 1;}
+		uint32_t trigger_index = (data_read_index + CD_LOGGER_DATA_BUFFER_LEN - 1 - late_count) % CD_LOGGER_DATA_BUFFER_LEN;
+		trigger_sequences[e] = Test_Sequence(&data_buffer[trigger_index]);
+		trigger_stamps[e] = time_recording_started + data_buffer[trigger_index].time_micros;
+		Test_Join(trigger_index, pretrigger_micros);
+		if (e == 0) {series_start = series_started;}
+
+		for (uint32_t i = 0; i < post_count; i++)
+		{
+			Test_SampleInterrupt();
+			Test_ReadInterrupt();
+			if (i % update_spacing == 0) {SDLogger_Update(&logger);}
+		}
+		while (data_read_index != data_pending_index) {Test_ReadInterrupt();}
+		recording = 0;
+		Test_EndEvent();
+		CHECK(logger.fresult == FR_OK, "end of event %lu: %d", (unsigned long)e, logger.fresult);
+
+		/* saving and arming again, the data points of the armed time before the next window aren't kept */
+		time_micros += 1000 + rand() % 100000;
+		sequence += 1000;
+	}
+	if (!power_loss)
+	{
+		SDLogger_StopRecording(&logger);
+		CHECK(logger.fresult == FR_OK, "stop %d", logger.fresult);
+	}
+
+	uint32_t len;
+	uint8_t* data = Test_ReadRecording(raw, recording_number, &len);
+	RecordingHeader* header = (RecordingHeader*)data;
+	if (data == NULL || len < sizeof(RecordingHeader) || memcmp(header->magic, "IMPK", 4) != 0 || header->header_size > len)
+	{
+		CHECK(0, "no recording, raw %u", raw);
+		free(data);
+		return;
+	}
+	CHECK(header->event_count == event_count && header->event_capacity == event_capacity, "%lu of %lu events", (unsigned long)header->event_count, (unsigned long)event_count);
+	CHECK(header->header_size >= sizeof(RecordingHeader) + event_capacity * sizeof(RecordingEvent) && header->header_size < sizeof(RecordingHeader) + event_capacity * sizeof(RecordingEvent) + 2 * SD_LOGGER_SECTOR_SIZE, "header size %lu", (unsigned long)header->header_size);
+
+	/* the events follow on from each other, each one contiguous, with its trigger where the table says */
+	uint32_t count = (len - header->header_size) / sizeof(DataPoint);
+	DataPoint* points = (DataPoint*)(data + header->header_size);
+	RecordingEvent* table = (RecordingEvent*)(data + sizeof(RecordingHeader));
+	uint32_t next = 0;
+	for (uint32_t e = 0; e < header->event_count && e < event_count; e++)
+	{
+		RecordingEvent* event = &table[e];
+		CHECK(event->first_point == next, "event %lu starts at %lu not %lu", (unsigned long)e, (unsigned long)event->first_point, (unsigned long)next);
+		if (event->first_point + event->point_count > count || event->trigger_point >= count)
+		{
+			CHECK(0, "event %lu past the end of the data", (unsigned long)e);
+			break;
+		}
+		next = event->first_point + event->point_count;
+
+		DataPoint* first = &points[event->first_point];
+		uint32_t gaps = 0;
+		for (uint32_t i = 1; i < event->point_count; i++)
+			if (Test_Sequence(&first[i]) != Test_Sequence(first) + i || first[i].time_micros != first->time_micros + i * interval) {gaps++;}
+		CHECK(gaps == 0, "%lu data points out of place in event %lu", (unsigned long)gaps, (unsigned long)e);
+		if (e > 0) {CHECK((int32_t)(first->time_micros - first[-1].time_micros) > 0, "time goes back at event %lu", (unsigned long)e);}
+		CHECK(Test_Sequence(&points[event->trigger_point]) == trigger_sequences[e], "event %lu trigger point", (unsigned long)e);
+		CHECK(points[event->trigger_point].time_micros == event->trigger_micros && event->trigger_micros == trigger_stamps[e] - series_start, "event %lu trigger time", (unsigned long)e);
+	}
+	CHECK(table[0].trigger_micros == header->trigger_micros && table[0].trigger_point == header->trigger_sample, "first event doesn't match the header");
+	CHECK(next == count, "%lu data points in the events, %lu in the recording", (unsigned long)next, (unsigned long)count);
+	free(data);
+}
+
+/* recordings that end just under, on and just over a segment boundary leave every point once and no empty segment */
+static void Test_Segments(void)
+{
+	static const uint32_t counts[] = {1000, 250, 249, 251};
+	static DataPoint points[100];
+	SDLogger_Initialize(&logger, (uint8_t*)points, sizeof(points), sizeof(DataPoint), &time_micros);
+	SDLogger_SetCommitInterval(&logger, 1000);
+	SDLogger_SetSegmentSize(&logger, 3100);
+
+	for (uint32_t r = 0; r < sizeof(counts) / sizeof(counts[0]); r++)
+	{
+		char name[16];
+		uint32_t recording_number;
+		uint32_t index = 0;
+		SDLogger_StartRecording(&logger, "DATA", ".DAT", "DATA.IDX", name, &recording_number);
+		for (uint32_t i = 0; i < counts[r]; i++)
+		{
+			points[index].time_micros = i;
+			points[index].data_type = r;
+			if (++index == sizeof(points) / sizeof(points[0])) {index = 0;}
+			SDLogger_IncrementDataIndex(&logger);
+			time_micros += 10;
+			if (i % 3 == 0) {SDLogger_Update(&logger);}
+		}
+		SDLogger_StopRecording(&logger);
+		CHECK(logger.fresult == FR_OK, "recording of %lu data points: %d", (unsigned long)counts[r], logger.fresult);
+
+		uint32_t segment_count = logger.segment_count;
+		char extra[16];
+		SDLogger_FormatSegmentName(extra, "DATA", ".DAT", recording_number, segment_count);
+		CHECK(f_stat(extra, NULL) != FR_OK, "%s left after %lu segments", extra, (unsigned long)segment_count);
+
+		uint32_t len;
+		uint8_t* data = Test_ReadRecording(0, recording_number, &len);
+		DataPoint* read_back = (DataPoint*)data;
+		uint32_t gaps = 0;
+		for (uint32_t i = 0; i < len / sizeof(DataPoint); i++)
+			if (read_back[i].time_micros != i || read_back[i].data_type != r) {gaps++;}
+		CHECK(gaps == 0 && len == counts[r] * sizeof(DataPoint), "%lu of %lu data points, %lu out of place", (unsigned long)(len / sizeof(DataPoint)), (unsigned long)counts[r], (unsigned long)gaps);
+		free(data);
+	}
+}
+
+/* four channel loggers at different rates, the two at the same rate rolling over together and sharing the spare file */
+static void Test_ChannelRollover(void)
+{
+	typedef struct __attribute__((packed))
+	{
+		uint32_t time_micros;
+		int16_t data[3];
+	} ChannelPoint;
+	static ChannelPoint points[4][512];
+	static SDLogger loggers[4];
+	static char* names[4] = {"LSMA", "LSMG", "IISA", "ADXA"};
+
+	for (uint32_t r = 1; r <= 20; r++)
+	{
+		uint32_t segment_max_bytes = 10240 * (1 + rand() % 4);
+		uint32_t counts[4], spacing[4];
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			SDLogger_Initialize(&loggers[c], (uint8_t*)points[c], sizeof(points[c]), sizeof(ChannelPoint), &time_micros);
+			SDLogger_SetCommitInterval(&loggers[c], 1000);
+			SDLogger_SetSegmentSize(&loggers[c], segment_max_bytes);
+			SDLogger_StartChannelRecording(&loggers[c], names[c], ".BIN", r, 100000);
+			counts[c] = 0;
+			spacing[c] = c < 2 ? 1 : 1 + rand() % 3;
+		}
+
+		uint32_t steps = 3000 + rand() % 20000;
+		for (uint32_t i = 0; i < steps; i++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				if (i % spacing[c] != 0) {continue;}
+				ChannelPoint* point = (ChannelPoint*)(loggers[c].data_buffer + loggers[c].data_buffer_index);
+				point->time_micros = counts[c]++;
+				point->data[0] = c;
+				SDLogger_IncrementDataIndex(&loggers[c]);
+			}
+			time_micros += 10;
+			if (i % (1 + rand() % 40) == 0)
+				for (uint32_t c = 0; c < 4; c++)
+					SDLogger_Update(&loggers[c]);
+		}
+
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			SDLogger_StopRecording(&loggers[c]);
+			CHECK(loggers[c].fresult == FR_OK, "recording %lu, %s: %d", (unsigned long)r, names[c], loggers[c].fresult);
+			uint32_t expected = 0;
+			uint32_t gaps = 0;
+			for (uint32_t s = 0; s < loggers[c].segment_count; s++)
+			{
+				char name[16];
+				FIL file;
+				SDLogger_FormatSegmentName(name, names[c], ".BIN", r, s);
+				if (f_open(&file, name, FA_READ) != FR_OK)
+				{
+					CHECK(0, "%s missing", name);
+					continue;
+				}
+				CHECK(s + 1 == loggers[c].segment_count || f_size(&file) == loggers[c].segment_max_bytes, "%s is %lu bytes", name, (unsigned long)f_size(&file));
+				ChannelPoint point;
+				UINT bytes_read;
+				while (f_read(&file, &point, sizeof(point), &bytes_read) == FR_OK && bytes_read == sizeof(point))
+				{
+					if (point.time_micros != expected || point.data[0] != (int16_t)c) {gaps++;}
+					expected++;
+				}
+				f_close(&file);
+				f_unlink(name);
+			}
+			char extra[16];
+			SDLogger_FormatSegmentName(extra, names[c], ".BIN", r, loggers[c].segment_count);
+			CHECK(expected == counts[c] && gaps == 0, "recording %lu, %s: %lu of %lu data points, %lu out of place", (unsigned long)r, names[c], (unsigned long)expected, (unsigned long)counts[c], (unsigned long)gaps);
+			CHECK(f_stat(extra, NULL) != FR_OK, "%s left after %lu segments", extra, (unsigned long)loggers[c].segment_count);
+		}
+	}
+}
+
+int main(void)
+{
+	static BYTE work[32768];
+	RamDisk_Create(TEST_IMAGE_SECTORS);
+	if (f_mkfs("", FM_FAT32, 4096, work, sizeof(work)) != FR_OK || f_mount(&fs, "", 1) != FR_OK)
+	{
+		printf("logger_test: no file system on the image\n");
+		return 1;
+	}
+
+	srand(1);
+	for (uint8_t raw = 0; raw < 2; raw++)
+	{
+		Test_Pretrigger(raw, 37, 20000, 50000, 3, 0, 30000, 50);  /* ring wrapped */
+		Test_Pretrigger(raw, 37, 500, 50000, 3, 0, 30000, 50);  /* trigger right after arming, before the window filled */
+		Test_Pretrigger(raw, 20, 30000, 200000, 2, 0, 30000, 50);  /* window over half the buffer */
+		Test_Pretrigger(raw, 100, 4300, 10000, 5, 0, 10, 1);  /* stop straight after the trigger */
+		Test_Pretrigger(raw, 37, CD_LOGGER_DATA_BUFFER_LEN / 2 + 170, 5000, 0, 0, 20000, 7);  /* read index just past a half */
+		Test_Pretrigger(raw, 37, CD_LOGGER_DATA_BUFFER_LEN * 3, 1000, 1, 0, 20000, 1);
+		Test_Pretrigger(raw, 37, 20000, 0, 3, 0, 20000, 10);  /* no window, the recording starts at the trigger */
+		Test_Pretrigger(raw, 37, 20000, 0, 3, 300, 20000, 10);  /* and with the trigger noticed late */
+		for (uint32_t i = 0; i < 40; i++)
+			Test_Pretrigger(raw, 10 + rand() % 90, 100 + rand() % 40000, rand() % 150000, rand() % 8, rand() % 2 ? 0 : rand() % 1000, rand() % 40000, 1 + rand() % 200);
+	}
+
+	/* file and raw series, a third of them segmented and a quarter cut off by a power loss */
+	for (uint32_t i = 0; i < 30; i++)
+	{
+		for (uint8_t raw = 0; raw < 2; raw++)
+		{
+			uint32_t capacity = 1 + rand() % 256;
+			uint32_t events = 1 + rand() % (capacity < TEST_MAX_EVENTS ? capacity : TEST_MAX_EVENTS);
+			Test_MultiShot(raw, 10 + rand() % 90, events, capacity, rand() % 150000, rand() % 3 ? 0xFFFFFFFF : 200000u + rand() % 1000000, rand() % 4 == 0);
+		}
+	}
+
+	Test_Segments();
+	Test_ChannelRollover();
+
+	printf("logger_test: %lu failures\n", (unsigned long)fail_count);
+	return fail_count != 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Settings file parser benchmark
+ *
+ * Times the parse of a full settings file, with and without profiles, and the id lookup with the hash table against the
+ * one by one search it replaced. The reads count how often the parser would go to the card.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "config.h"
+#include "recording.h"
+#include "setting.h"
+#include "schema.inc"
+
+#define BENCH_SECONDS 0.5
+
+static int32_t settings[SET_COUNT];
+static int32_t profile_rows[SETTING_MAX_PROFILES][SET_COUNT];
+
+static double Bench_Now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+static void Bench_Parse(const char* name, const char* text, SettingProfiles* profiles)
+{
+	FatFsStub_SetFile("settings.txt", text, strlen(text));
+
+	SettingParseReport report;
+	uint32_t runs = 0;
+	uint32_t reads = fatfs_stub_read_count;
+	double start = Bench_Now();
+	double elapsed;
+	do
+	{
+		(void)Setting_ParseArray(settings_schema, settings, SET_COUNT, "settings.txt", &report, profiles);
+		runs++;
+		elapsed = Bench_Now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	printf("%-24s %5lu lines %5lu bytes  %8.2f us/file  %6.2f M lines/s  %lu reads/file  %lu errors\n", name, (unsigned long)report.line_count,
+		   (unsigned long)strlen(text), 1e6 * elapsed / runs, report.line_count * runs / elapsed / 1e6, (unsigned long)(fatfs_stub_read_count - reads) / runs,
+		   (unsigned long)report.error_count);
+}
+
+static void Bench_Find(const char* name, const uint8_t* table, uint32_t seed)
+{
+	uint32_t runs = 0;
+	uint32_t found = 0;
+	double start = Bench_Now();
+	double elapsed;
+	do
+	{
+		for (uint32_t i = 0; i < SET_COUNT; i++)
+		{
+			uint32_t index;
+			found += Setting_Find(settings_schema, SET_COUNT, table, seed, settings_schema[i].id, strlen(settings_schema[i].id), &index);
+		}
+		runs++;
+		elapsed = Bench_Now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	printf("%-24s %8.1f ns/id  (%lu found)\n", name, 1e9 * elapsed / runs / SET_COUNT, (unsigned long)found / runs);
+}
+
+int main(void)
+{
+	Setting_SetDefaults(settings_schema, settings, SET_COUNT);
+
+	/* the file as the firmware writes it, then with a comment on every line and a few profiles */
+	static char text[16384];
+	uint32_t len = Setting_FormatArray(settings_schema, settings, SET_COUNT, text, sizeof(text));
+	text[len] = '\0';
+	Bench_Parse("defaults", text, NULL);
+
+	len = 0;
+	for (uint32_t i = 0; i < SET_COUNT; i++) {len += sprintf(text + len, "%s = %ld  # setting %lu\n", settings_schema[i].id, (long)settings[i], (unsigned long)i);}
+	Bench_Parse("commented", text, NULL);
+
+	for (uint32_t p = 0; p < SETTING_MAX_PROFILES; p++)
+	{
+		len += sprintf(text + len, "\n[profile%lu]\n", (unsigned long)p);
+		for (uint32_t i = p; i < SET_COUNT; i += 4) {len += sprintf(text + len, "%s = %ld\n", settings_schema[i].id, (long)settings[i]);}
+	}
+	SettingProfiles profiles = {0, {{0}}, &profile_rows[0][0]};
+	Bench_Parse("commented, 4 profiles", text, &profiles);
+
+	uint8_t table[SETTING_HASH_LEN];
+	uint32_t seed;
+	if (!Setting_BuildHashTable(settings_schema, SET_COUNT, table, &seed)) {printf("no perfect hash seed for the schema\n"); return 1;}
+	Bench_Find("lookup, hash table", table, seed);
+	Bench_Find("lookup, one by one", NULL, 0);
+
+	return 0;
+}
@@ -0,0 +1,289 @@
+/*
+ * Settings file parser tests
+ *
+ * Hand written cases for the lines users get wrong, then random lines checked against a slower reference parser, and
+ * random files checked against the values and report they should give. Returns non-zero if anything fails.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+#include "recording.h"
+#include "setting.h"
+#include "schema.inc"
+
+#define FUZZ_LINES 200000
+#define FUZZ_FILES 3000
+
+static uint32_t fail_count = 0;
+#define CHECK(condition, ...) do {if (!(condition)) {fail_count++; if (fail_count <= 20) {printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n");}}} while (0)
+
+static int32_t settings[SET_COUNT];
+static int32_t defaults[SET_COUNT];
+static int32_t profile_rows[SETTING_MAX_PROFILES][SET_COUNT];
+
+static uint8_t Test_Line(const char* text, int32_t* value)
+{
+	char line[CHAR_BUF_LEN];
+	char* id;
+	uint32_t id_len;
+	snprintf(line, sizeof(line), "%s", text);
+	return Setting_ParseLine(line, &id, &id_len, value);
+}
+
+static uint8_t Test_File(const char* text, SettingParseReport* report, SettingProfiles* profiles)
+{
+	FatFsStub_SetFile("settings.txt", text, strlen(text));
+	memcpy(settings, defaults, sizeof(settings));
+	return Setting_ParseArray(settings_schema, settings, SET_COUNT, "settings.txt", report, profiles);
+}
+
+/* the whole base section with default values, so a test only has to add the lines it is about */
+static uint32_t Test_FormatDefaults(char* text)
+{
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < SET_COUNT; i++) {len += sprintf(text + len, "%s = %ld\n", settings_schema[i].id, (long)defaults[i]);}
+	return len;
+}
+
+static void Test_Numbers(void)
+{
+	int32_t value;
+	CHECK(Test_Line("a = 2147483647", &value) == SETTING_OK && value == INT32_MAX, "largest number");
+	CHECK(Test_Line("a = -2147483648", &value) == SETTING_OK && value == INT32_MIN, "smallest number");
+	CHECK(Test_Line("a = 2147483648", &value) == SETTING_ERROR_SYNTAX, "one past the largest number");
+	CHECK(Test_Line("a = -2147483649", &value) == SETTING_ERROR_SYNTAX, "one past the smallest number");
+	CHECK(Test_Line("a = 99999999999999999999999999999999", &value) == SETTING_ERROR_SYNTAX, "number far too long");
+	CHECK(Test_Line("a = 000000000000000000000000000042", &value) == SETTING_OK && value == 42, "leading zeros");
+	CHECK(Test_Line("a = +7", &value) == SETTING_OK && value == 7, "plus sign");
+	CHECK(Test_Line("a = - 7", &value) == SETTING_ERROR_SYNTAX, "space after the sign");
+	CHECK(Test_Line("a = 7x", &value) == SETTING_ERROR_SYNTAX, "junk after the number");
+	CHECK(Test_Line("a = 7.5", &value) == SETTING_ERROR_SYNTAX, "decimal point");
+	CHECK(Test_Line("a = 7 # note\r", &value) == SETTING_OK && value == 7, "comment and carriage return");
+
+	/* a line past the buffer is an error of its own, whatever it holds */
+	static char text[8192];
+	uint32_t len = Test_FormatDefaults(text);
+	sprintf(text + len, "%s = 1%0150d\n", SETTING_PRETRIGGER_ID, 0);
+	SettingParseReport report;
+	CHECK(!Test_File(text, &report, NULL) && report.error_count == 1 && report.errors[0].error == SETTING_ERROR_LINE_TOO_LONG, "overlong line");
+}
+
+static void Test_Delimiter(void)
+{
+	int32_t value;
+	CHECK(Test_Line("a 5", &value) == SETTING_ERROR_SYNTAX, "no delimiter");
+	CHECK(Test_Line("a", &value) == SETTING_ERROR_SYNTAX, "id only");
+	CHECK(Test_Line("a =", &value) == SETTING_ERROR_SYNTAX, "no value");
+	CHECK(Test_Line("a == 5", &value) == SETTING_ERROR_SYNTAX, "two delimiters");
+	CHECK(Test_Line("a # = 5", &value) == SETTING_ERROR_SYNTAX, "delimiter in the comment");
+	CHECK(Test_Line("   ", &value) == SETTING_BLANK, "white space only");
+	CHECK(Test_Line("  # a = 5", &value) == SETTING_BLANK, "comment");
+
+	/* an empty id parses but matches nothing */
+	static char text[8192];
+	uint32_t len = Test_FormatDefaults(text);
+	sprintf(text + len, "= 5\n%s 5\n", SETTING_PRETRIGGER_ID);
+	SettingParseReport report;
+	CHECK(!Test_File(text, &report, NULL) && report.error_count == 2 && report.errors[0].error == SETTING_ERROR_UNKNOWN_ID &&
+		  report.errors[1].error == SETTING_ERROR_SYNTAX && report.missing_count == 0, "empty id and no delimiter in a file");
+}
+
+static void Test_Profiles(void)
+{
+	int32_t value;
+	CHECK(Test_Line("[bench]", &value) == SETTING_PROFILE, "profile");
+	CHECK(Test_Line("  [bench]  # note", &value) == SETTING_PROFILE, "profile with a comment");
+	CHECK(Test_Line("[]", &value) == SETTING_ERROR_PROFILE, "empty name");
+	CHECK(Test_Line("[bench", &value) == SETTING_ERROR_PROFILE, "unclosed name");
+	CHECK(Test_Line("[be nch]", &value) == SETTING_ERROR_PROFILE, "space in the name");
+	CHECK(Test_Line("[elevenchars]", &value) == SETTING_PROFILE, "longest name");
+	CHECK(Test_Line("[twelve_chars]", &value) == SETTING_ERROR_PROFILE, "name too long");
+	CHECK(Test_Line("[bench] x", &value) == SETTING_ERROR_SYNTAX, "junk after the name");
+
+	static char text[8192];
+	uint32_t len = Test_FormatDefaults(text);
+	len += sprintf(text + len, "[elevenchars]\n%s = 100\n", SETTING_PRETRIGGER_ID);
+	len += sprintf(text + len, "[bad name]\n%s = 200\n", SETTING_PRETRIGGER_ID);  /* skipped along with its lines */
+	len += sprintf(text + len, "[elevenchars]\n%s = 300\n", SETTING_PRETRIGGER_ID);  /* repeated name */
+	for (uint32_t i = 1; i < SETTING_MAX_PROFILES; i++) {len += sprintf(text + len, "[p%lu]\n", (unsigned long)i);}
+	len += sprintf(text + len, "[extra]\n%s = 400\n", SETTING_PRETRIGGER_ID);  /* one too many */
+
+	SettingProfiles profiles = {0, {{0}}, &profile_rows[0][0]};
+	SettingParseReport report;
+	CHECK(!Test_File(text, &report, &profiles), "bad profiles pass");
+	CHECK(profiles.count == SETTING_MAX_PROFILES && strcmp(profiles.names[0], "elevenchars") == 0, "%lu profiles", (unsigned long)profiles.count);
+	CHECK(profile_rows[0][SET_PRETRIGGER] == 100 && settings[SET_PRETRIGGER] == defaults[SET_PRETRIGGER], "profile values");
+	CHECK(report.error_count == 3 && report.errors[0].error == SETTING_ERROR_PROFILE && report.errors[1].error == SETTING_ERROR_PROFILE &&
+		  report.errors[2].error == SETTING_ERROR_PROFILE, "%lu errors", (unsigned long)report.error_count);
+
+	/* without room for profiles every one is an error */
+	CHECK(!Test_File(text, &report, NULL) && report.error_count == 3 + SETTING_MAX_PROFILES && settings[SET_PRETRIGGER] == defaults[SET_PRETRIGGER],
+		  "profiles not wanted");
+}
+
+static void Test_Duplicates(void)
+{
+	static char text[8192];
+	uint32_t len = Test_FormatDefaults(text);
+	len += sprintf(text + len, "%s = 1\n%s = 2\n", SETTING_PRETRIGGER_ID, SETTING_PRETRIGGER_ID);
+	len += sprintf(text + len, "[bench]\n%s = 3\n%s = 4\n", SETTING_PRETRIGGER_ID, SETTING_PRETRIGGER_ID);
+
+	SettingProfiles profiles = {0, {{0}}, &profile_rows[0][0]};
+	SettingParseReport report;
+	CHECK(!Test_File(text, &report, &profiles), "duplicates pass");
+	CHECK(settings[SET_PRETRIGGER] == defaults[SET_PRETRIGGER] && profile_rows[0][SET_PRETRIGGER] == 3, "the first one counts");
+	CHECK(report.error_count == 3 && report.errors[0].error == SETTING_ERROR_DUPLICATE && report.errors[1].error == SETTING_ERROR_DUPLICATE &&
+		  report.errors[2].error == SETTING_ERROR_DUPLICATE && report.missing_count == 0, "%lu errors", (unsigned long)report.error_count);
+
+	/* a profile may set what the base section already has */
+	len = Test_FormatDefaults(text);
+	sprintf(text + len, "[bench]\n%s = 5\n", SETTING_PRETRIGGER_ID);
+	CHECK(Test_File(text, &report, &profiles) && profile_rows[0][SET_PRETRIGGER] == 5, "base setting repeated in a profile");
+}
+
+/* slower parser written from the description of the format, to check the real one against */
+static uint8_t Reference_ParseLine(const char* line, int32_t* value)
+{
+	const char* c = line + strspn(line, " \t");
+	if (*c == '\0' || *c == '#' || *c == '\r') {return SETTING_BLANK;}
+
+	if (*c == '[')
+	{
+		size_t name_len = strspn(c + 1, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-");
+		if (c[1 + name_len] != ']' || name_len == 0 || name_len >= SETTING_PROFILE_NAME_LEN) {return SETTING_ERROR_PROFILE;}
+		c += 2 + name_len;
+		c += strspn(c, " \t\r");
+		return (*c == '\0' || *c == '#') ? SETTING_PROFILE : SETTING_ERROR_SYNTAX;
+	}
+
+	c += strcspn(c, " \t=#\r");
+	c += strspn(c, " \t");
+	if (*c++ != '=') {return SETTING_ERROR_SYNTAX;}
+	c += strspn(c, " \t");
+
+	const char* digits = (*c == '-' || *c == '+') ? c + 1 : c;
+	if (*digits < '0' || *digits > '9') {return SETTING_ERROR_SYNTAX;}
+	char* end;
+	errno = 0;
+	long long number = strtoll(c, &end, 10);
+	if (errno == ERANGE || number < INT32_MIN || number > INT32_MAX) {return SETTING_ERROR_SYNTAX;}
+	end += strspn(end, " \t\r");
+	if (*end != '\0' && *end != '#') {return SETTING_ERROR_SYNTAX;}
+
+	*value = (int32_t)number;
+	return SETTING_OK;
+}
+
+static void Fuzz_Lines(void)
+{
+	/* pieces that make up real lines, mixed with random characters */
+	static const char* const pieces[] = {" ", "\t", "=", "#", "[", "]", "-", "+", "\r", "0", "7", "2147483647", "2147483648", "999999999999",
+										 "-2147483648", SETTING_PRETRIGGER_ID, "bench", "a_b-c"};
+	char line[CHAR_BUF_LEN];
+	for (uint32_t n = 0; n < FUZZ_LINES; n++)
+	{
+		uint32_t len = 0;
+		uint32_t piece_count = rand() % 10;
+		for (uint32_t p = 0; p < piece_count; p++)
+		{
+			const char* piece = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+			char random[2] = {(char)(1 + rand() % 127), '\0'};
+			if (rand() % 4 == 0) {piece = random;}
+			if (len + strlen(piece) >= CHAR_BUF_LEN) {break;}
+			strcpy(line + len, piece);
+			len += strlen(piece);
+		}
+		line[len] = '\0';
+
+		char copy[CHAR_BUF_LEN];
+		strcpy(copy, line);
+		char* id;
+		uint32_t id_len;
+		int32_t value = 0, expected_value = 0;
+		uint8_t result = Setting_ParseLine(copy, &id, &id_len, &value);
+		uint8_t expected = Reference_ParseLine(line, &expected_value);
+		CHECK(result == expected && (result != SETTING_OK || value == expected_value), "\"%s\" gives %u, not %u", line, result, expected);
+		CHECK(strcmp(copy, line) == 0, "\"%s\" changed", line);
+		if (result == SETTING_OK || result == SETTING_PROFILE) {CHECK(id >= copy && id + id_len <= copy + len, "\"%s\" id outside the line", line);}
+	}
+}
+
+static void Fuzz_Files(void)
+{
+	/* random base sections of good, bad and repeated lines, checked against the values and report they should give */
+	static char text[32768];
+	for (uint32_t n = 0; n < FUZZ_FILES; n++)
+	{
+		int32_t expected[SET_COUNT];
+		uint8_t seen[SET_COUNT] = {0};
+		memcpy(expected, defaults, sizeof(expected));
+		uint32_t expected_errors = 0;
+		uint32_t len = 0;
+
+		uint32_t line_count = rand() % 120;
+		for (uint32_t l = 0; l < line_count; l++)
+		{
+			uint32_t k = rand() % SET_COUNT;
+			const SettingSchema* setting = &settings_schema[k];
+			switch (rand() % 6)
+			{
+			case 0:
+			case 1:
+			case 2:
+			{
+				/* a setting, allowed or not */
+				int32_t value = setting->choice_count && rand() % 4 ? setting->choices[rand() % setting->choice_count] : rand() % 100000 - 500;
+				len += sprintf(text + len, "%s%s%s=%s%ld%s\n", rand() % 2 ? " " : "", setting->id, rand() % 2 ? " " : "", rand() % 2 ? "\t" : "",
+							   (long)value, rand() % 2 ? "  # note" : "");
+				if (seen[k] || !Setting_IsAllowed(setting, value)) {expected_errors++;}
+				else
+				{
+					seen[k] = 1;
+					expected[k] = value;
+				}
+				break;
+			}
+			case 3:
+				len += sprintf(text + len, "%s\n", rand() % 2 ? "# just a comment = 5" : "");
+				break;
+			case 4:
+				len += sprintf(text + len, "%.*s = 1\n", (int)strlen(setting->id) - 1, setting->id);  /* a prefix of a real id */
+				expected_errors++;
+				break;
+			default:
+				len += sprintf(text + len, "%s = %s\n", setting->id, rand() % 2 ? "" : "99999999999");
+				expected_errors++;
+				break;
+			}
+		}
+		if (rand() % 2 && len > 0) {len--;}  /* no newline at the end */
+		text[len] = '\0';
+
+		uint32_t missing = 0;
+		for (uint32_t i = 0; i < SET_COUNT; i++) {missing += !seen[i];}
+
+		SettingParseReport report;
+		uint8_t ok = Test_File(text, &report, NULL);
+		CHECK(memcmp(settings, expected, sizeof(expected)) == 0, "file %lu values", (unsigned long)n);
+		CHECK(report.error_count == expected_errors && report.missing_count == missing && ok == (expected_errors == 0 && missing == 0),
+			  "file %lu: %lu errors, not %lu", (unsigned long)n, (unsigned long)report.error_count, (unsigned long)expected_errors);
+	}
+}
+
+int main(void)
+{
+	srand(1);
+	Setting_SetDefaults(settings_schema, defaults, SET_COUNT);
+
+	Test_Numbers();
+	Test_Delimiter();
+	Test_Profiles();
+	Test_Duplicates();
+	Fuzz_Lines();
+	Fuzz_Files();
+
+	printf("setting_fuzz: %lu failures\n", (unsigned long)fail_count);
+	return fail_count != 0;
+}
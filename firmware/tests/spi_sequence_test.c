@@ -0,0 +1,286 @@
+/*
+ * SPI register sequence tests
+ *
+ * The HAL calls are stubbed to log what each bus would have sent and under which chip select, and the transfers are
+ * completed by hand in whatever order a test wants. The sensor configurations go through the sequence and are decoded
+ * back from the bytes on the bus, then the ways a bus can fail are forced one at a time. Returns non-zero if anything fails.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sensor.h"
+#include "LSM6DSx.h"
+#include "IIS3DWB.h"
+#include "ADXL37x.h"
+
+#define TEST_BUSES 2
+#define TEST_LOG_LEN 512
+
+static uint32_t fail_count = 0;
+#define CHECK(condition, ...) do {if (!(condition)) {fail_count++; if (fail_count <= 20) {printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n");}}} while (0)
+
+/* the board: the LSM6DSx on its own bus, the IIS3DWB and ADXL37x sharing the other one */
+static SPI_HandleTypeDef spi[TEST_BUSES] = {{1}, {2}};
+static GPIO_TypeDef port_a, port_b;
+static SPISensor lsm6dsx = {.spi = &spi[0], .cs_port = &port_a, .cs_pin = 4, .convert_reg_write = LSM6DSx_ConvertWriteRegister, .convert_reg_read = LSM6DSx_ConvertReadRegister};
+static SPISensor iis3dwb = {.spi = &spi[1], .cs_port = &port_b, .cs_pin = 14, .convert_reg_write = IIS3DWB_ConvertWriteRegister, .convert_reg_read = IIS3DWB_ConvertReadRegister};
+static SPISensor adxl37x = {.spi = &spi[1], .cs_port = &port_a, .cs_pin = 1, .convert_reg_write = ADXL37x_ConvertWriteRegister, .convert_reg_read = ADXL37x_ConvertReadRegister};
+static SPISensor* const sensors[] = {&lsm6dsx, &iis3dwb, &adxl37x};
+#define SENSOR_COUNT 3
+
+/* what the stubs saw, per bus */
+static struct
+{
+	const uint8_t* pending;  /* DMA transfer started and not completed yet */
+	uint16_t pending_len;
+	uint8_t log[TEST_LOG_LEN];  /* every transfer as [length, sensor, bytes...] */
+	uint32_t log_len;
+	uint32_t abort_count;
+} bus[TEST_BUSES];
+static uint8_t cs_low[SENSOR_COUNT];
+static uint32_t fail_dma_start;  /* the next DMA start on this bus + 1 is refused */
+static volatile uint32_t time_micros;
+
+static int32_t Test_Bus(SPI_HandleTypeDef* hspi) {return hspi - spi;}
+
+static int32_t Test_Sensor(GPIO_TypeDef* port, uint16_t pin)
+{
+	for (int32_t i = 0; i < SENSOR_COUNT; i++)
+		if (sensors[i]->cs_port == port && sensors[i]->cs_pin == pin)
+			return i;
+	return -1;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	int32_t s = Test_Sensor(GPIOx, GPIO_Pin);
+	CHECK(s >= 0, "chip select of no sensor");
+	if (s >= 0) {cs_low[s] = PinState == GPIO_PIN_RESET;}
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, const uint8_t* pData, uint16_t Size)
+{
+	int32_t b = Test_Bus(hspi);
+	if (fail_dma_start == (uint32_t)b + 1)
+	{
+		fail_dma_start = 0;
+		return HAL_BUSY;
+	}
+	CHECK(bus[b].pending == NULL, "bus %ld started while busy", (long)b);
+
+	/* exactly one sensor on this bus has to be selected */
+	int32_t selected = -1;
+	for (int32_t s = 0; s < SENSOR_COUNT; s++)
+	{
+		if (!cs_low[s] || sensors[s]->spi != hspi) {continue;}
+		CHECK(selected < 0, "two chip selects low on bus %ld", (long)b);
+		selected = s;
+	}
+	CHECK(selected >= 0, "no chip select low on bus %ld", (long)b);
+
+	bus[b].pending = pData;
+	bus[b].pending_len = Size;
+	if (bus[b].log_len + Size + 2 <= TEST_LOG_LEN)
+	{
+		bus[b].log[bus[b].log_len++] = Size;
+		bus[b].log[bus[b].log_len++] = selected;
+		memcpy(&bus[b].log[bus[b].log_len], pData, Size);
+		bus[b].log_len += Size;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef* hspi)
+{
+	int32_t b = Test_Bus(hspi);
+	bus[b].pending = NULL;
+	bus[b].abort_count++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, const uint8_t* pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi; (void)pData; (void)Size; (void)Timeout;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, const uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout)
+{
+	(void)hspi; (void)pTxData; (void)pRxData; (void)Size; (void)Timeout;
+	return HAL_OK;
+}
+
+static void Test_Reset(SPISequence* sequence)
+{
+	memset(bus, 0, sizeof(bus));
+	memset(cs_low, 0, sizeof(cs_low));
+	fail_dma_start = 0;
+	SPISequence_Init(sequence);
+}
+
+/* finish the transfer on a bus, as the transmit complete interrupt would */
+static uint8_t Test_Complete(SPISequence* sequence, int32_t b, uint8_t error)
+{
+	if (bus[b].pending == NULL) {return 0;}
+	bus[b].pending = NULL;
+	SPISequence_TransmitComplete(sequence, &spi[b], error);
+	return 1;
+}
+
+/* the register writes to one sensor as they arrive on its bus, with the address of each burst auto-incremented */
+static uint32_t Test_Decode(int32_t s, uint8_t* reg, uint8_t* data)
+{
+	uint32_t count = 0;
+	int32_t b = Test_Bus(sensors[s]->spi);
+	for (uint32_t i = 0; i < bus[b].log_len; i += 2 + bus[b].log[i])
+	{
+		if (bus[b].log[i + 1] != s) {continue;}
+		int32_t first = -1;
+		for (int32_t r = 0; r < 256 && first < 0; r++)
+			if (sensors[s]->convert_reg_write(r) == bus[b].log[i + 2])
+				first = r;
+		CHECK(first >= 0, "address byte %02X of sensor %ld", bus[b].log[i + 2], (long)s);
+		for (uint32_t k = 1; k < bus[b].log[i]; k++)
+		{
+			reg[count] = first + k - 1;
+			data[count++] = bus[b].log[i + 2 + k];
+		}
+	}
+	return count;
+}
+
+static void Test_Configuration(void)
+{
+	/* the boot configuration of all three sensors, the buses finish their bursts in an interleaved order */
+	static SPISequence sequence;
+	Test_Reset(&sequence);
+	uint8_t* config_reg[SENSOR_COUNT];
+	uint8_t* config_data[SENSOR_COUNT];
+	uint8_t config_size[SENSOR_COUNT];
+	LSM6DSx_GetConfiguration(4, 3, 10, -20, 30, &config_reg[0], &config_data[0], &config_size[0]);
+	IIS3DWB_GetConfiguration(4, -5, 0, 7, &config_reg[1], &config_data[1], &config_size[1]);
+	ADXL37x_GetConfiguration(2, 5120, 0, 12, -12, &config_reg[2], &config_data[2], &config_size[2]);
+
+	uint32_t write_count = 0;
+	for (int32_t s = 0; s < SENSOR_COUNT; s++)
+	{
+		CHECK(SPISequence_Add(&sequence, sensors[s], config_reg[s], config_data[s], config_size[s]), "add sensor %ld", (long)s);
+		write_count += config_size[s];
+	}
+	CHECK(sequence.burst_count < write_count, "%u bursts for %lu registers, nothing merged", sequence.burst_count, (unsigned long)write_count);
+
+	SPISequence_Start(&sequence);
+	CHECK(bus[0].pending != NULL && bus[1].pending != NULL, "both buses started at once");
+	uint32_t steps = 0;
+	while (!SPISequence_IsDone(&sequence) && steps < 1000)
+	{
+		if (steps % 3 != 2) {(void)Test_Complete(&sequence, 1, 0);}
+		if (steps % 2 == 0) {(void)Test_Complete(&sequence, 0, 0);}
+		steps++;
+	}
+	CHECK(SPISequence_IsDone(&sequence), "sequence never finished");
+	CHECK(SPISequence_Wait(&sequence, &time_micros, 1000) == 0, "errors in a clean sequence");
+	for (int32_t s = 0; s < SENSOR_COUNT; s++) {CHECK(!cs_low[s], "chip select %ld left low", (long)s);}
+
+	/* each sensor got exactly its own writes in order */
+	for (int32_t s = 0; s < SENSOR_COUNT; s++)
+	{
+		uint8_t reg[SPI_SEQUENCE_MAX_BYTES], data[SPI_SEQUENCE_MAX_BYTES];
+		uint32_t count = Test_Decode(s, reg, data);
+		CHECK(count == config_size[s], "sensor %ld got %lu writes instead of %u", (long)s, (unsigned long)count, config_size[s]);
+		for (uint32_t i = 0; i < count && i < config_size[s]; i++)
+			CHECK(reg[i] == config_reg[s][i] && data[i] == config_data[s][i], "sensor %ld write %lu", (long)s, (unsigned long)i);
+	}
+}
+
+static void Test_Bursts(void)
+{
+	/* consecutive registers of one sensor share a burst, a gap, another sensor or a step back starts a new one */
+	static SPISequence sequence;
+	Test_Reset(&sequence);
+	const uint8_t reg[] = {0x10, 0x11, 0x12, 0x14, 0x15, 0x15, 0x14};
+	const uint8_t data[] = {1, 2, 3, 4, 5, 6, 7};
+	CHECK(SPISequence_Add(&sequence, &lsm6dsx, reg, data, 7), "add");
+	CHECK(SPISequence_Add(&sequence, &lsm6dsx, (const uint8_t[]){0x15}, (const uint8_t[]){8}, 1), "add the next register in a second call");
+	CHECK(SPISequence_Add(&sequence, &iis3dwb, (const uint8_t[]){0x17}, (const uint8_t[]){9}, 1), "add another sensor");
+	CHECK(SPISequence_Add(&sequence, &adxl37x, (const uint8_t[]){0x18}, (const uint8_t[]){10}, 1), "add another sensor on the same bus");
+
+	static const uint8_t expected_len[] = {4, 3, 2, 3, 2, 2};
+	CHECK(sequence.burst_count == sizeof(expected_len), "%u bursts", sequence.burst_count);
+	for (uint32_t i = 0; i < sequence.burst_count && i < sizeof(expected_len); i++) {CHECK(sequence.bursts[i].len == expected_len[i], "burst %lu is %u bytes", (unsigned long)i, sequence.bursts[i].len);}
+
+	/* full: the bytes run out before the bursts do, and a sequence that doesn't fit is refused */
+	Test_Reset(&sequence);
+	uint8_t many_reg[SPI_SEQUENCE_MAX_BYTES], many_data[SPI_SEQUENCE_MAX_BYTES] = {0};
+	for (uint32_t i = 0; i < SPI_SEQUENCE_MAX_BYTES; i++) {many_reg[i] = i;}
+	CHECK(SPISequence_Add(&sequence, &lsm6dsx, many_reg, many_data, SPI_SEQUENCE_MAX_BYTES - 1), "one long burst fills the bytes");
+	CHECK(!SPISequence_Add(&sequence, &iis3dwb, many_reg, many_data, 1), "no room for another burst");
+
+	Test_Reset(&sequence);
+	for (uint32_t i = 0; i < SPI_SEQUENCE_MAX_BYTES; i++) {many_reg[i] = 2 * i;}
+	CHECK(!SPISequence_Add(&sequence, &lsm6dsx, many_reg, many_data, SPI_SEQUENCE_MAX_BURSTS + 1), "one burst too many");
+	CHECK(sequence.burst_count == SPI_SEQUENCE_MAX_BURSTS, "bursts stop at the limit");
+}
+
+static void Test_Tick(int signal_number)
+{
+	(void)signal_number;
+	time_micros += 1000;
+}
+
+static void Test_Failures(void)
+{
+	static SPISequence sequence;
+	const uint8_t reg[] = {0x10, 0x20, 0x30};
+	const uint8_t data[] = {1, 2, 3};
+
+	/* an error reported by the transfer is counted and the bus carries on */
+	Test_Reset(&sequence);
+	(void)SPISequence_Add(&sequence, &lsm6dsx, reg, data, 3);
+	SPISequence_Start(&sequence);
+	uint32_t transfers = 0;
+	while (Test_Complete(&sequence, 0, transfers == 1)) {transfers++;}
+	CHECK(transfers == 3 && SPISequence_IsDone(&sequence), "%lu transfers after an error", (unsigned long)transfers);
+	CHECK(SPISequence_Wait(&sequence, &time_micros, 1000) == 1, "transfer error counted");
+
+	/* a DMA start that is refused gives up on that bus only, with its chip select released */
+	Test_Reset(&sequence);
+	(void)SPISequence_Add(&sequence, &lsm6dsx, reg, data, 3);
+	(void)SPISequence_Add(&sequence, &iis3dwb, reg, data, 3);
+	fail_dma_start = 1;
+	SPISequence_Start(&sequence);
+	CHECK(bus[0].pending == NULL && !cs_low[0], "refused bus left selected");
+	transfers = 0;
+	while (Test_Complete(&sequence, 1, 0)) {transfers++;}
+	CHECK(transfers == 3 && SPISequence_IsDone(&sequence), "other bus stopped after a refused start");
+	CHECK(SPISequence_Wait(&sequence, &time_micros, 1000) == 1, "refused start counted");
+
+	/* a bus that never completes is aborted once the wait times out, the time stamp is moved on by a timer signal */
+	Test_Reset(&sequence);
+	(void)SPISequence_Add(&sequence, &lsm6dsx, reg, data, 3);
+	(void)SPISequence_Add(&sequence, &adxl37x, reg, data, 3);
+	SPISequence_Start(&sequence);
+	(void)Test_Complete(&sequence, 0, 0);
+	signal(SIGALRM, Test_Tick);
+	struct itimerval timer = {{0, 1000}, {0, 1000}};
+	setitimer(ITIMER_REAL, &timer, NULL);
+	CHECK(SPISequence_Wait(&sequence, &time_micros, 5000) == 2, "both stuck buses counted");
+	timer = (struct itimerval){{0, 0}, {0, 0}};
+	setitimer(ITIMER_REAL, &timer, NULL);
+	CHECK(SPISequence_IsDone(&sequence), "done after the timeout");
+	CHECK(bus[0].abort_count == 1 && bus[1].abort_count == 1, "each stuck bus aborted once");
+	for (int32_t s = 0; s < SENSOR_COUNT; s++) {CHECK(!cs_low[s], "chip select %ld left low after the abort", (long)s);}
+	CHECK(!Test_Complete(&sequence, 0, 0) && !Test_Complete(&sequence, 1, 0), "transfers left running after the abort");
+}
+
+int main(void)
+{
+	Test_Configuration();
+	Test_Bursts();
+	Test_Failures();
+
+	printf("spi_sequence_test: %lu failures\n", (unsigned long)fail_count);
+	return fail_count != 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Stand-in for the HAL header on the host
+ *
+ * Only the types and calls the tested modules use are here. The calls themselves are defined by each test, so it can
+ * see what would have gone out on the bus and make any of them fail.
+ */
+
+#ifndef TESTS_STM32F4XX_HAL_H_
+#define TESTS_STM32F4XX_HAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+typedef enum
+{
+	HAL_OK = 0,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+	uint32_t id;
+} SPI_HandleTypeDef;
+
+/* internal flash */
+#define FLASH_TYPEERASE_SECTORS		0x00000000U
+#define FLASH_VOLTAGE_RANGE_3		0x00000002U
+#define FLASH_TYPEPROGRAM_WORD		0x00000002U
+#define FLASH_SECTOR_11				11U
+#define FLASH_FLAG_EOP				0x00000001U
+#define FLASH_FLAG_OPERR			0x00000002U
+#define FLASH_FLAG_WRPERR			0x00000010U
+#define FLASH_FLAG_PGAERR			0x00000020U
+#define FLASH_FLAG_PGPERR			0x00000040U
+#define FLASH_FLAG_PGSERR			0x00000080U
+#define __HAL_FLASH_CLEAR_FLAG(flag) ((void)(flag))
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef* hspi, const uint8_t* pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef* hspi, const uint8_t* pTxData, uint8_t* pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef* hspi, const uint8_t* pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef* hspi);
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+
+#endif /* TESTS_STM32F4XX_HAL_H_ */
@@ -0,0 +1,263 @@
+/*
+ * Trigger tests
+ *
+ * The trigger levels are turned into counts when the trigger is set up, so every value a sensor can give is run through
+ * the trigger, for a spread of levels across each range, and checked against comparing the value in units with the level
+ * the way the firmware did before. The same goes for the release levels of the hysteresis, and random data points near
+ * the level for the magnitude. Hand written sequences cover the minimum duration and combining channels. Returns non-zero
+ * if anything fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "trigger.h"
+
+static uint32_t fail_count = 0;
+#define CHECK(condition, ...) do {if (!(condition)) {fail_count++; if (fail_count <= 20) {printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n");}}} while (0)
+
+/* the ranges of each sensor with its bit depth, the 12 bit ADXL37x values are left justified and big endian */
+static const struct {uint32_t full_scale; uint8_t resolution;} ranges[] = {
+	{2, 16}, {4, 16}, {8, 16}, {16, 16}, {32, 16}, {125, 16}, {250, 16}, {500, 16}, {1000, 16}, {2000, 16}, {4000, 16}, {200, 12}, {400, 12}};
+
+/* levels in thousandths of the unit, on and around count boundaries and past the end of the ranges */
+static const uint32_t levels[] = {0, 1, 2, 5, 61, 62, 63, 100, 125, 250, 500, 977, 1000, 1500, 2000, 3000, 4000, 7999, 8000, 16000, 32000,
+								  56000, 100000, 200000, 399000, 400000, 500000, 692820, 2000000, 2000000000};
+
+#define NUMEL(x) (sizeof(x) / sizeof((x)[0]))
+#define MAGNITUDE_POINTS 20000
+
+/* one axis of a data point as the sensor stores it */
+static void Test_Put(uint8_t* raw, uint8_t axis, int32_t counts, uint8_t resolution)
+{
+	uint16_t value = (uint16_t)(counts << (16 - resolution));
+	uint8_t big_endian = resolution < 16;
+	raw[2 * axis] = big_endian ? value >> 8 : value & 0xFF;
+	raw[2 * axis + 1] = big_endian ? value & 0xFF : value >> 8;
+}
+
+static double Test_Units(int32_t counts, uint32_t full_scale, uint8_t resolution)
+{
+	return (double)counts * full_scale / (1 << (resolution - 1));
+}
+
+static void Test_Axes(void)
+{
+	/* every count on the selected axis, with the other axes at values that would set it off if they were looked at */
+	for (uint8_t rising = 0; rising < 2; rising++)
+	{
+		for (uint32_t r = 0; r < NUMEL(ranges); r++)
+		{
+			for (uint32_t l = 0; l < NUMEL(levels); l++)
+			{
+				uint8_t resolution = ranges[r].resolution;
+				uint8_t axis = l % 3;
+				Trigger trigger;
+				Trigger_Init(&trigger, rising, 0, 0, 0, 0);
+				Trigger_SetChannel(&trigger, 0, 1 << axis, levels[l], ranges[r].full_scale, resolution, resolution < 16);
+
+				double level = levels[l] / 1000.0;
+				int32_t limit = 1 << (resolution - 1);
+				for (int32_t counts = -limit; counts < limit; counts++)
+				{
+					uint8_t raw[6];
+					for (uint8_t k = 0; k < 3; k++) {Test_Put(raw, k, rising ? -limit : 0, resolution);}
+					Test_Put(raw, axis, counts, resolution);
+
+					double value = fabs(Test_Units(counts, ranges[r].full_scale, resolution));
+					uint8_t expected = rising ? value > level : value < level;
+					Trigger_Reset(&trigger);
+					CHECK(Trigger_Update(&trigger, 0, raw, 0) == expected, "axis %u, range %lu, level %lu, %s, %ld counts", axis,
+						  (unsigned long)ranges[r].full_scale, (unsigned long)levels[l], rising ? "rising" : "falling", (long)counts);
+				}
+			}
+		}
+	}
+}
+
+static void Test_Hysteresis(void)
+{
+	/* set the channel off, then every count on the axis, which keeps it active until it is back past the release level */
+	static const uint8_t hysteresis[] = {10, 20, 50, 100};
+	for (uint8_t rising = 0; rising < 2; rising++)
+	{
+		for (uint32_t r = 0; r < NUMEL(ranges); r++)
+		{
+			for (uint32_t l = 0; l < NUMEL(levels); l++)
+			{
+				for (uint32_t h = 0; h < NUMEL(hysteresis); h++)
+				{
+					uint8_t resolution = ranges[r].resolution;
+					int32_t limit = 1 << (resolution - 1);
+					uint8_t start[6] = {0};
+					Test_Put(start, 0, rising ? -limit : 0, resolution);
+					if (rising ? Test_Units(limit, ranges[r].full_scale, resolution) <= levels[l] / 1000.0 : levels[l] == 0) {continue;}  /* never set off */
+
+					Trigger trigger;
+					Trigger_Init(&trigger, rising, 0, 0, hysteresis[h], 0);
+					Trigger_SetChannel(&trigger, 0, 0x01, levels[l], ranges[r].full_scale, resolution, resolution < 16);
+
+					double release = levels[l] * (rising ? 100 - hysteresis[h] : 100 + hysteresis[h]) / 100000.0;
+					for (int32_t counts = -limit; counts < limit; counts++)
+					{
+						uint8_t raw[6] = {0};
+						Test_Put(raw, 0, counts, resolution);
+
+						double value = fabs(Test_Units(counts, ranges[r].full_scale, resolution));
+						uint8_t expected = rising ? value > release : value < release;
+						Trigger_Reset(&trigger);
+						CHECK(Trigger_Update(&trigger, 0, start, 0), "set off, range %lu, level %lu", (unsigned long)ranges[r].full_scale, (unsigned long)levels[l]);
+						CHECK(Trigger_Update(&trigger, 0, raw, 0) == expected, "release, range %lu, level %lu, hysteresis %u%%, %s, %ld counts",
+							  (unsigned long)ranges[r].full_scale, (unsigned long)levels[l], hysteresis[h], rising ? "rising" : "falling", (long)counts);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void Test_Magnitude(void)
+{
+	/*
+	 * Random data points, half of them with each axis near level / sqrt(3) and some with one axis near the level, checked
+	 * against the magnitude in units. The squares are summed in long double, which is exact for every data point, and the
+	 * few where the level squared can't be told apart from the sum are left out, exact ties are checked below.
+	 */
+	srand(1);
+	for (uint8_t rising = 0; rising < 2; rising++)
+	{
+		for (uint32_t r = 0; r < NUMEL(ranges); r++)
+		{
+			for (uint32_t l = 0; l < NUMEL(levels); l++)
+			{
+				uint8_t resolution = ranges[r].resolution;
+				int32_t limit = 1 << (resolution - 1);
+				Trigger trigger;
+				Trigger_Init(&trigger, rising, 1, 0, 0, 0);
+				Trigger_SetChannel(&trigger, 0, 0x01, levels[l], ranges[r].full_scale, resolution, resolution < 16);
+
+				long double level = levels[l] / 1000.0L;
+				double level_counts = levels[l] / 1000.0 * limit / ranges[r].full_scale;
+				for (uint32_t n = 0; n < MAGNITUDE_POINTS; n++)
+				{
+					int32_t counts[3];
+					for (uint8_t k = 0; k < 3; k++)
+					{
+						if (n % 2 && level_counts < limit)
+							counts[k] = (int32_t)(level_counts / sqrt(3)) + rand() % 5 - 2;
+						else
+							counts[k] = rand() % (2 * limit) - limit;
+						if (n % 2 && rand() % 2) {counts[k] = -counts[k];}
+						if (n % 7 == 0) {counts[k] = k == 0 ? (int32_t)level_counts + rand() % 3 - 1 : 0;}
+						if (counts[k] >= limit) {counts[k] = limit - 1;}
+						if (counts[k] < -limit) {counts[k] = -limit;}
+					}
+
+					uint8_t raw[6];
+					long double sum = 0;
+					for (uint8_t k = 0; k < 3; k++)
+					{
+						Test_Put(raw, k, counts[k], resolution);
+						long double value = (long double)counts[k] * ranges[r].full_scale / limit;
+						sum += value * value;
+					}
+					if (fabsl(sum - level * level) <= 1e-15L * level * level) {continue;}
+
+					uint8_t expected = rising ? sum > level * level : sum < level * level;
+					Trigger_Reset(&trigger);
+					CHECK(Trigger_Update(&trigger, 0, raw, 0) == expected, "magnitude, range %lu, level %lu, %s, %ld %ld %ld counts",
+						  (unsigned long)ranges[r].full_scale, (unsigned long)levels[l], rising ? "rising" : "falling", (long)counts[0], (long)counts[1], (long)counts[2]);
+				}
+			}
+		}
+	}
+
+	/* exactly on the level neither fires: 3 4 0 is 5 units, here 2048 counts per g */
+	for (uint8_t rising = 0; rising < 2; rising++)
+	{
+		Trigger trigger;
+		Trigger_Init(&trigger, rising, 1, 0, 0, 0);
+		Trigger_SetChannel(&trigger, 0, 0x01, 5000, 16, 16, 0);
+		uint8_t raw[6] = {0};
+		Test_Put(raw, 0, 3 * 2048, 16);
+		Test_Put(raw, 1, -4 * 2048, 16);
+		CHECK(!Trigger_Update(&trigger, 0, raw, 0), "magnitude on the level, %s", rising ? "rising" : "falling");
+		Test_Put(raw, 2, 1, 16);
+		CHECK(Trigger_Update(&trigger, 0, raw, 0) == rising, "magnitude one count past the level, %s", rising ? "rising" : "falling");
+	}
+
+	/* an oblique impact that no single axis reaches: 8 counts of 0.195 g on each axis is 1.56 g, 2.7 g together */
+	Trigger trigger;
+	uint8_t raw[6];
+	for (uint8_t k = 0; k < 3; k++) {Test_Put(raw, k, -8, 12);}
+	Trigger_Init(&trigger, 1, 1, 0, 0, 0);
+	Trigger_SetChannel(&trigger, 3, 0x01, 2500, 400, 12, 1);
+	CHECK(Trigger_Update(&trigger, 3, raw, 0), "oblique impact, magnitude");
+	Trigger_Init(&trigger, 1, 0, 0, 0, 0);
+	Trigger_SetChannel(&trigger, 3, 0x07, 1600, 400, 12, 1);
+	CHECK(!Trigger_Update(&trigger, 3, raw, 0), "oblique impact, axes");
+}
+
+static void Test_Duration(void)
+{
+	/* 1 g rising on the z axis with 20 % hysteresis and 1 ms minimum, 2048 counts per g, one data point every 250 us */
+	static const struct {int16_t counts; uint8_t fires;} sequence[] = {
+		{3000, 0}, {1700, 0}, {3000, 0}, {1700, 0}, {1700, 1},  /* 1700 is above the 1638 count release level, met after 1 ms */
+		{1600, 0}, {3000, 0}, {3000, 0}, {3000, 0}, {3000, 0}, {3000, 1}};  /* released, then 1 ms again from the next crossing */
+	Trigger trigger;
+	Trigger_Init(&trigger, 1, 0, 0, 20, 1000);
+	Trigger_SetChannel(&trigger, 0, 0x04, 1000, 16, 16, 0);
+	uint8_t raw[6] = {0};
+	for (uint32_t i = 0; i < NUMEL(sequence); i++)
+	{
+		Test_Put(raw, 2, sequence[i].counts, 16);
+		CHECK(Trigger_Update(&trigger, 0, raw, 250 * i) == sequence[i].fires, "duration, step %lu", (unsigned long)i);
+	}
+
+	/* the time stamps wrap around */
+	Trigger_Reset(&trigger);
+	Test_Put(raw, 2, 3000, 16);
+	CHECK(!Trigger_Update(&trigger, 0, raw, 0xFFFFFF00), "duration before the wrap");
+	CHECK(Trigger_Update(&trigger, 0, raw, 0x00000300), "duration after the wrap");
+}
+
+static void Test_Channels(void)
+{
+	/* accelerometer at 1 g and gyroscope at 100 dps, 2048 and 16.384 counts per unit */
+	Trigger trigger;
+	uint8_t accel[6] = {0}, gyro[6] = {0}, still[6] = {0};
+	Test_Put(accel, 1, -2100, 16);
+	Test_Put(gyro, 2, 1700, 16);
+
+	Trigger_Init(&trigger, 1, 0, 1, 0, 0);
+	Trigger_SetChannel(&trigger, 0, 0x07, 1000, 16, 16, 0);
+	Trigger_SetChannel(&trigger, 1, 0x07, 100000, 2000, 16, 0);
+	CHECK(!Trigger_Update(&trigger, 0, accel, 0), "all channels, only one");
+	CHECK(Trigger_Update(&trigger, 1, gyro, 10), "all channels, both");
+	CHECK(!Trigger_Update(&trigger, 0, still, 20), "all channels, one released");
+	CHECK(Trigger_Update(&trigger, 0, accel, 30), "all channels, both again");
+	CHECK(!Trigger_Update(&trigger, 2, accel, 40), "channel that doesn't take part");
+	Trigger_SetChannel(&trigger, 1, 0, 100000, 2000, 16, 0);
+	Trigger_Reset(&trigger);
+	CHECK(Trigger_Update(&trigger, 0, accel, 50), "all channels, the other one taken out");
+
+	Trigger_Init(&trigger, 1, 0, 1, 0, 0);
+	CHECK(!Trigger_Update(&trigger, 0, accel, 0), "all channels, none taking part");
+
+	Trigger_Init(&trigger, 1, 0, 0, 0, 0);
+	Trigger_SetChannel(&trigger, 0, 0x07, 1000, 16, 16, 0);
+	Trigger_SetChannel(&trigger, 1, 0x07, 100000, 2000, 16, 0);
+	CHECK(Trigger_Update(&trigger, 1, gyro, 0), "any channel");
+}
+
+int main(void)
+{
+	Test_Axes();
+	Test_Hysteresis();
+	Test_Magnitude();
+	Test_Duration();
+	Test_Channels();
+
+	printf("trigger_test: %lu failures\n", (unsigned long)fail_count);
+	return fail_count != 0;
+}